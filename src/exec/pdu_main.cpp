@@ -7,11 +7,11 @@
 #include <boost/program_options.hpp>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
-#include <regex>
 
 enum class SortOrder { Default, Size, AvgSize, Count };
 
@@ -58,7 +58,8 @@ struct params_t {
             ("bitwidth,b", po::bool_switch(&showBitwidth), "Display timestamp/value encoding bit width distributions")
             ("minbitwidth,m", po::bool_switch(&showMinBitwidth),
                 "Display minimum possible timestamp encoding bit width distributions (implies -b)")
-            ("filter,f", po::value(&filter), "Regex (ECMASCript) filter applied to metric family names");
+            ("filter,f", po::value(&filter), "Regex (ECMASCript) filter applied to metric family names")
+            ("window,w", po::value(&readWindow), "Read chunks in file order, this many at a time (0 reads in series order)");
 
         pos_options.add("dir", 1);
         // clang-format on
@@ -104,6 +105,7 @@ struct params_t {
     bool showBitwidth = false;
     bool showMinBitwidth = false;
     std::string filter = "";
+    size_t readWindow = 0;
     bool valid = false;
 };
 
@@ -338,11 +340,8 @@ int main(int argc, char* argv[]) {
     if (params.filter.empty()) {
         filter = [](const std::string& name) { return true; };
     } else {
-        filter = [re = std::regex(params.filter,
-                                  std::regex_constants::ECMAScript)](
-                         const std::string& name) {
-            return bool(std::regex_match(name, re));
-        };
+        filter = [re = pdu::filter::RegexMatcher(params.filter)](
+                         const std::string& name) { return re(name); };
     }
 
     fs::path dirPath = params.statsDir;
@@ -364,14 +363,66 @@ int main(int argc, char* argv[]) {
     // iterate over every chunk index in the provided directory
     // see index.h/cc for index file parsing. IndexIterator
     // just locates every index file and loads it.
-    for (auto indexPtr : IndexIterator(dirPath)) {
+    // Every series is visited exactly once, so there's no benefit to
+    // decoding them all up front; load lazily.
+    for (auto indexPtr : IndexIterator(dirPath, SeriesLoadMode::Lazy)) {
         const auto& index = *indexPtr;
         fs::path subdir = index.getDirectory();
+        // series will still be visited in order
+        index.advise(AccessPattern::Sequential);
 
         // Once a chunk file reference is encountered in the index, the
         // appropriate chunk file will be mmapped and inserted into the cache
         // as they are likely to be used again.
-        ChunkFileCache cache(subdir / "chunks");
+        // Chunks are written in series order, so there is no need to keep
+        // more than a couple of segments mapped, and pages may be dropped
+        // once done with.
+        ChunkFileCache cache(subdir / "chunks", {/* maxSegments */ 2});
+        cache.setAccessPattern(AccessPattern::Sequential);
+
+        auto readChunk = [&](AccumulatedData& acc,
+                             const ChunkReference& chunk) {
+            // ChunkView parses the chunk start info, but will not read
+            // all samples unless they are iterated over.
+            ChunkView view(cache, chunk);
+            acc.diskUsage += view.dataLen;
+            acc.sampleCount += view.sampleCount;
+
+            // iterating every sample is somewhat expensive, so only
+            // do so if needed for the requested output
+            if (params.showBitwidth) {
+                for (const auto& sample : view.instrumentedSamples()) {
+                    if (sample.meta.minTimestampBitWidth !=
+                        SampleInfo::noBitWidth) {
+                        acc.minTimestamps.record(
+                                sample.meta.minTimestampBitWidth);
+                    }
+                    acc.timestamps.record(sample.meta.timestampBitWidth);
+                    acc.values.record(sample.meta.valueBitWidth);
+                }
+            }
+        };
+
+        // With a read window, chunks of several series are collected up
+        // and read in file order. Results are only summed per metric
+        // family, so the order chunks are read in does not matter.
+        // Lazily decoded series are only valid until the next is visited;
+        // keep a copy of each chunk reference.
+        std::vector<std::pair<AccumulatedData*, ChunkReference>> pending;
+        auto readPending = [&] {
+            std::sort(pending.begin(),
+                      pending.end(),
+                      [](const auto& a, const auto& b) {
+                          return std::make_pair(a.second.getSegmentFileId(),
+                                                a.second.getOffset()) <
+                                 std::make_pair(b.second.getSegmentFileId(),
+                                                b.second.getOffset());
+                      });
+            for (const auto& [acc, chunk] : pending) {
+                readChunk(*acc, chunk);
+            }
+            pending.clear();
+        };
 
         // iterate over each time series in the index
         for (const auto& tableEntry : index.series) {
@@ -391,27 +442,17 @@ int main(int argc, char* argv[]) {
             // series in the index file specify references to chunk files
             // by segment id and offset.
             for (const auto& chunk : series.chunks) {
-                // ChunkView parses the chunk start info, but will not read
-                // all samples unless they are iterated over.
-                ChunkView view(cache, chunk);
-                acc.diskUsage += view.dataLen;
-                acc.sampleCount += view.sampleCount;
-
-                // iterating every sample is somewhat expensive, so only
-                // do so if needed for the requested output
-                if (params.showBitwidth) {
-                    for (const auto& sample : view.samples()) {
-                        if (sample.meta.minTimestampBitWidth !=
-                            SampleInfo::noBitWidth) {
-                            acc.minTimestamps.record(
-                                    sample.meta.minTimestampBitWidth);
-                        }
-                        acc.timestamps.record(sample.meta.timestampBitWidth);
-                        acc.values.record(sample.meta.valueBitWidth);
-                    }
+                if (params.readWindow) {
+                    pending.emplace_back(&acc, chunk);
+                } else {
+                    readChunk(acc, chunk);
                 }
             }
+            if (pending.size() >= params.readWindow) {
+                readPending();
+            }
         }
+        readPending();
     }
 
     // finally, display the accumulated data according to the specified
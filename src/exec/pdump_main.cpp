@@ -23,7 +23,11 @@ struct params_t {
         // clang-format off
         options.add_options()
             ("dir,d", po::value(&statsDir)->required(), "Prometheus stats directory")
-            ("query,q", po::value(&query), "Prometheus query (not implemented)");
+            ("query,q", po::value(&query), "Prometheus query (not implemented)")
+            ("threads,j", po::value(&threads), "Number of threads used to load blocks and the WAL")
+            ("window,w", po::value(&readWindow), "Read chunks in file order, this many at a time (0 reads in series order)")
+            ("prefetch,p", po::value(&prefetch), "Decode this many series ahead on background threads (0 disables)")
+            ("save-summaries", po::bool_switch(&saveSummaries), "Save label summaries of each block, to skip building them on later loads");
 
         pos_options.add("dir", 1);
         // clang-format on
@@ -51,6 +55,10 @@ struct params_t {
     }
     std::string statsDir = "";
     std::string query = "";
+    size_t threads = 1;
+    size_t readWindow = 0;
+    size_t prefetch = 0;
+    bool saveSummaries = false;
     bool valid = false;
 };
 
@@ -96,15 +104,36 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    auto data = pdu::load(params.statsDir);
+    auto data =
+            pdu::load(params.statsDir, SeriesLoadMode::Eager, params.threads);
+
+    if (params.saveSummaries) {
+        data.saveLabelSummaries();
+    }
+
+    // every sample will be read, in roughly chunk file order
+    data.setChunkAccessPattern(AccessPattern::Sequential);
 
     SeriesFilter filter;
     // filter.addFilter("__name__", "sysproc_page_faults_raw");
 
     SampleDumpVisitor foo;
+    foo.setReadWindow(params.readWindow);
+    foo.setPrefetch({params.prefetch, params.threads});
     foo.visit(data.filtered(filter));
 
     std::cout.flush();
 
+    if (params.prefetch) {
+        auto stats = foo.getPrefetchStats();
+        fmt::print(std::cerr,
+                   "prefetch: {} series, stalled {} times for {} ms\n",
+                   stats.series,
+                   stats.stalls,
+                   std::chrono::duration_cast<std::chrono::milliseconds>(
+                           stats.stallTime)
+                           .count());
+    }
+
     return 0;
 }
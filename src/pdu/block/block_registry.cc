@@ -0,0 +1,69 @@
+#include "block_registry.h"
+
+#include "mapped_file.h"
+
+BlockRegistry& BlockRegistry::instance() {
+    // never destroyed, as indexes held by other statics release their
+    // entries during shutdown
+    static auto* registry = new BlockRegistry;
+    return *registry;
+}
+
+std::shared_ptr<Index> BlockRegistry::load(
+        const boost::filesystem::path& indexFile,
+        SeriesLoadMode mode,
+        bool populate) {
+    namespace fs = boost::filesystem;
+    auto path = fs::canonical(indexFile);
+    // block directories are named by ulid
+    Key key{path.string(),
+            path.parent_path().filename().string(),
+            fs::last_write_time(path),
+            fs::file_size(path),
+            mode};
+
+    {
+        std::unique_lock lock(mutex);
+        if (auto itr = indexes.find(key); itr != indexes.end()) {
+            if (auto index = itr->second.lock()) {
+                return index;
+            }
+        }
+    }
+
+    // load without holding the lock, other blocks may be loaded
+    // concurrently.
+    // The index is owned with a deleter which releases the registry entry,
+    // so the owner handed out (and the weak reference the registry holds)
+    // is the same one Index::shared_from_this refers to.
+    std::shared_ptr<Index> index(new Index, [this, key](Index* ptr) {
+        delete ptr;
+        release(key);
+    });
+    index->load(map_file(path, populate), mode);
+
+    // declared after index, so the lock is dropped before a duplicate
+    // index releases its entry
+    std::unique_lock lock(mutex);
+    auto& entry = indexes[key];
+    // another thread may have loaded the same block in the meantime
+    if (auto existing = entry.lock()) {
+        return existing;
+    }
+    entry = index;
+    return index;
+}
+
+size_t BlockRegistry::size() const {
+    std::unique_lock lock(mutex);
+    return indexes.size();
+}
+
+void BlockRegistry::release(const Key& key) {
+    std::unique_lock lock(mutex);
+    auto itr = indexes.find(key);
+    // the entry may already have been replaced by a newer load of the block
+    if (itr != indexes.end() && itr->second.expired()) {
+        indexes.erase(itr);
+    }
+}
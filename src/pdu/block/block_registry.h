@@ -0,0 +1,59 @@
+#pragma once
+
+#include "index.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+/**
+ * Process-wide registry of loaded block indexes.
+ *
+ * Blocks are immutable once written, so loading the same block again (e.g.,
+ * repeatedly loading a data directory to pick up new data) can hand out the
+ * Index already in memory rather than parsing it again.
+ *
+ * Entries are keyed by the index path, block ulid, the index file's mtime
+ * and size, and the SeriesLoadMode, so a block replaced on disk is loaded
+ * afresh. The registry does not keep indexes alive; an entry is released
+ * once the last user drops the index.
+ *
+ * Safe for concurrent use.
+ */
+class BlockRegistry {
+public:
+    static BlockRegistry& instance();
+
+    /**
+     * Get the index at @p indexFile, loading it only if it is not already
+     * held by some other user.
+     *
+     * @p populate only applies if the index is loaded; an index already
+     * held is returned as is.
+     */
+    std::shared_ptr<Index> load(const boost::filesystem::path& indexFile,
+                                SeriesLoadMode mode = SeriesLoadMode::Eager,
+                                bool populate = false);
+
+    // number of indexes currently held
+    size_t size() const;
+
+private:
+    // path, ulid, mtime, size, mode
+    using Key = std::tuple<std::string,
+                           std::string,
+                           std::time_t,
+                           uintmax_t,
+                           SeriesLoadMode>;
+
+    void release(const Key& key);
+
+    mutable std::mutex mutex;
+    std::map<Key, std::weak_ptr<Index>> indexes;
+};
@@ -4,12 +4,45 @@
 #include <fmt/format.h>
 #include <stdexcept>
 
+namespace {
+std::mutex defaultLimitsMutex;
+ChunkFileCache::Limits defaultLimits;
+} // namespace
+
 ChunkFileCache::ChunkFileCache(boost::filesystem::path chunkDir)
-    : chunkDir(std::move(chunkDir)) {
+    : ChunkFileCache(std::move(chunkDir), getDefaultLimits()) {
+}
+
+ChunkFileCache::ChunkFileCache(boost::filesystem::path chunkDir, Limits limits)
+    : chunkDir(std::move(chunkDir)), limits(limits) {
+}
+
+ChunkFileCache::ChunkFileCache(const ChunkFileCache& other)
+    : chunkDir(other.chunkDir) {
+    std::lock_guard lock(other.mutex);
+    limits = other.limits;
+    accessPattern = other.accessPattern;
+    stats = other.stats;
+    cache = other.cache;
+    lru = other.lru;
+    // entries must refer to positions in this lru
+    for (auto itr = lru.begin(); itr != lru.end(); ++itr) {
+        cache.at(*itr).lruPos = itr;
+    }
 }
+
 std::shared_ptr<Resource> ChunkFileCache::get(uint32_t segmentId) {
-    if (auto itr = cache.find(segmentId); itr != cache.end()) {
-        return itr->second;
+    {
+        std::lock_guard lock(mutex);
+        if (auto itr = cache.find(segmentId); itr != cache.end()) {
+            auto& entry = itr->second;
+            ++stats.hits;
+            if (entry.evictable) {
+                lru.splice(lru.begin(), lru, entry.lruPos);
+            }
+            return entry.resource;
+        }
+        ++stats.misses;
     }
 
     auto path = chunkDir / fmt::format("{:0>6}", segmentId);
@@ -17,19 +50,115 @@ std::shared_ptr<Resource> ChunkFileCache::get(uint32_t segmentId) {
         throw std::runtime_error(fmt::format(
                 "Index references missing chunk file: {}\n", path.string()));
     }
-    auto res = cache.try_emplace(
-            segmentId, std::make_shared<MappedNamedFileResource>(path));
-    auto itr = res.first;
+    // map without holding the lock; another thread may map the same segment
+    // concurrently, in which case whichever is inserted first is used.
+    std::shared_ptr<Resource> resource =
+            std::make_shared<MappedNamedFileResource>(path);
 
-    return itr->second;
+    std::lock_guard lock(mutex);
+    auto [itr, inserted] = cache.try_emplace(segmentId);
+    auto& entry = itr->second;
+    if (inserted) {
+        if (accessPattern != AccessPattern::Normal) {
+            resource->advise(accessPattern);
+        }
+        entry.resource = std::move(resource);
+        entry.evictable = true;
+        entry.lruPos = lru.insert(lru.begin(), segmentId);
+        ++stats.segments;
+        stats.bytes += entry.resource->getView().size();
+    }
+    auto result = entry.resource;
+    evict();
+    return result;
 }
 
 void ChunkFileCache::store(uint32_t segmentId,
                            std::shared_ptr<Resource> resource) {
+    std::lock_guard lock(mutex);
     if (cache.find(segmentId) != cache.end()) {
         throw std::runtime_error("ChunkFileCache: resource already exists: " +
                                  std::to_string(segmentId));
     }
 
-    cache[segmentId] = std::move(resource);
-}
\ No newline at end of file
+    auto& entry = cache[segmentId];
+    entry.resource = std::move(resource);
+    ++stats.segments;
+    stats.bytes += entry.resource->getView().size();
+}
+
+void ChunkFileCache::erase(uint32_t segmentId) {
+    std::lock_guard lock(mutex);
+    auto itr = cache.find(segmentId);
+    if (itr == cache.end()) {
+        return;
+    }
+    if (itr->second.evictable) {
+        lru.erase(itr->second.lruPos);
+    }
+    --stats.segments;
+    stats.bytes -= itr->second.resource->getView().size();
+    cache.erase(itr);
+}
+
+void ChunkFileCache::setLimits(Limits newLimits) {
+    std::lock_guard lock(mutex);
+    limits = newLimits;
+    evict();
+}
+
+ChunkFileCache::Limits ChunkFileCache::getLimits() const {
+    std::lock_guard lock(mutex);
+    return limits;
+}
+
+ChunkFileCache::Stats ChunkFileCache::getStats() const {
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void ChunkFileCache::setAccessPattern(AccessPattern pattern) {
+    std::lock_guard lock(mutex);
+    accessPattern = pattern;
+    for (auto& [segmentId, entry] : cache) {
+        entry.resource->advise(pattern);
+    }
+}
+
+void ChunkFileCache::setDefaultLimits(Limits limits) {
+    std::lock_guard lock(defaultLimitsMutex);
+    defaultLimits = limits;
+}
+
+ChunkFileCache::Limits ChunkFileCache::getDefaultLimits() {
+    std::lock_guard lock(defaultLimitsMutex);
+    return defaultLimits;
+}
+
+bool ChunkFileCache::overLimits() const {
+    return (limits.maxSegments && stats.segments > limits.maxSegments) ||
+           (limits.maxBytes && stats.bytes > limits.maxBytes);
+}
+
+void ChunkFileCache::evict() {
+    // walk from the least recently used segment
+    auto itr = lru.end();
+    while (overLimits() && itr != lru.begin()) {
+        --itr;
+        auto entryItr = cache.find(*itr);
+        auto& resource = entryItr->second.resource;
+        // while the mutex is held, nothing can acquire a new reference, so
+        // a sole owner means no ChunkView is using this segment.
+        if (resource.use_count() > 1) {
+            continue;
+        }
+        if (accessPattern == AccessPattern::Sequential) {
+            resource->advise(AccessPattern::DontNeed);
+        }
+        --stats.segments;
+        stats.bytes -= resource->getView().size();
+        ++stats.evictions;
+        cache.erase(entryItr);
+        itr = lru.erase(itr);
+    }
+}
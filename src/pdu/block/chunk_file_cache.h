@@ -5,18 +5,99 @@
 
 #include <boost/filesystem.hpp>
 #include <fstream>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 
 class FileMap;
 
+/**
+ * Cache of chunk segment files, mapped on first use.
+ *
+ * Safe for concurrent use. Mapped segments may be bounded by count and by
+ * total size; once over either limit, the least recently used segments are
+ * unmapped, but only once nothing else (e.g., a ChunkView) references them.
+ * Limits are therefore soft - segments in use are never evicted.
+ *
+ * Resources provided through store() are never evicted, as they cannot be
+ * reloaded.
+ */
 class ChunkFileCache {
 public:
+    struct Limits {
+        // maximum number of mapped segments, 0 for no limit
+        size_t maxSegments = 0;
+        // maximum total size of mapped segments, 0 for no limit
+        size_t maxBytes = 0;
+    };
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        // currently cached segments and their total size
+        size_t segments = 0;
+        size_t bytes = 0;
+    };
+
     ChunkFileCache(boost::filesystem::path chunkDir = "");
+    ChunkFileCache(boost::filesystem::path chunkDir, Limits limits);
+
+    /**
+     * Copy the segments cached by @p other. Resources are shared, but
+     * either cache may then store, erase or evict segments without
+     * affecting the other.
+     */
+    ChunkFileCache(const ChunkFileCache& other);
+
     std::shared_ptr<Resource> get(uint32_t segmentId);
     void store(uint32_t segmentId, std::shared_ptr<Resource> resource);
 
+    /**
+     * Drop a segment from the cache, e.g., as the file has grown and needs
+     * mapping again. Anything still using the resource keeps it alive.
+     */
+    void erase(uint32_t segmentId);
+
+    void setLimits(Limits limits);
+    Limits getLimits() const;
+
+    Stats getStats() const;
+
+    /**
+     * Hint how chunk files will be read, applied to files already mapped
+     * and any mapped later. With Sequential, evicted files are also
+     * advised DontNeed, as a scan will not return to them.
+     */
+    void setAccessPattern(AccessPattern pattern);
+
+    /**
+     * Set the limits used by caches created without explicit limits, e.g.,
+     * those created when loading an Index.
+     */
+    static void setDefaultLimits(Limits limits);
+    static Limits getDefaultLimits();
+
 private:
+    struct Entry {
+        std::shared_ptr<Resource> resource;
+        // position in lru; only for evictable entries
+        std::list<uint32_t>::iterator lruPos;
+        bool evictable = false;
+    };
+
+    // evict unused segments until within limits. Requires mutex to be held.
+    void evict();
+    bool overLimits() const;
+
     const boost::filesystem::path chunkDir;
-    std::map<uint32_t, std::shared_ptr<Resource>> cache;
-};
\ No newline at end of file
+
+    mutable std::mutex mutex;
+    Limits limits;
+    AccessPattern accessPattern = AccessPattern::Normal;
+    Stats stats;
+    std::map<uint32_t, Entry> cache;
+    // evictable segment ids, most recently used first
+    std::list<uint32_t> lru;
+};
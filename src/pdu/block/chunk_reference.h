@@ -14,8 +14,10 @@ enum class ChunkType {
     /*
      * Raw ts / value bytes. This is never generated by Prometheus, but is used
      * in this lib when reading the WAL. A raw chunk is created as a convenient
-     * way of integrating in-memory data with that of disk, but it's not worth
-     * the CPU time re-writing an XOR chunk as it would be on disk.
+     * way of integrating in-memory data with that of disk, without spending
+     * the CPU time writing an XOR chunk as it would be on disk. Where memory
+     * matters more, WAL samples can be XOR encoded instead (see
+     * InMemWalChunk).
      */
     Raw,
     /*
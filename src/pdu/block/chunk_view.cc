@@ -2,12 +2,18 @@
 
 #include "chunk_reference.h"
 #include "index.h"
+#include "pdu/encode/bit_reader.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
-SampleIterator::SampleIterator(Decoder dec, size_t sampleCount, bool rawChunk)
+template <bool RecordBitWidths>
+BasicSampleIterator<RecordBitWidths>::BasicSampleIterator(Decoder dec,
+                                                          size_t sampleCount,
+                                                          bool rawChunk)
     : sampleCount(sampleCount), dec(std::move(dec)), rawChunk(rawChunk) {
-    advance();
+    this->advance();
 }
 
 uint8_t minBits(ssize_t value) {
@@ -60,7 +66,21 @@ uint8_t minBits(ssize_t value) {
     return bits;
 }
 
-void SampleIterator::increment() {
+template <bool RecordBitWidths>
+template <class Fn>
+auto BasicSampleIterator<RecordBitWidths>::measure(BitDecoder& bits,
+                                                   uint16_t& dest,
+                                                   Fn&& fn) {
+    if constexpr (RecordBitWidths) {
+        auto bc = bits.counter(dest);
+        return fn();
+    } else {
+        return fn();
+    }
+}
+
+template <bool RecordBitWidths>
+void BasicSampleIterator<RecordBitWidths>::increment() {
     ++currentIndex;
     if (is_end()) {
         return;
@@ -74,49 +94,48 @@ void SampleIterator::increment() {
     }
     BitDecoder bits(dec, bitState);
     if (currentIndex == 0) {
-        {
-            auto bc = bits.counter(s.meta.timestampBitWidth);
-            prev.ts = s.timestamp = dec.read_varint();
-        }
+        prev.ts = s.timestamp = measure(bits, s.meta.timestampBitWidth, [&] {
+            return int64_t(dec.read_varint());
+        });
         auto val = dec.read_int<uint64_t>();
         prev.value = s.value = reinterpret_cast<double&>(val);
 
-        s.meta.valueBitWidth = 64;
+        if constexpr (RecordBitWidths) {
+            s.meta.valueBitWidth = 64;
+        }
 
     } else if (currentIndex == 1) {
-        auto startIdx = bits.tell();
-        {
-            auto bc = bits.counter(s.meta.timestampBitWidth);
-            prev.tsDelta = dec.read_varuint();
-        }
+        prev.tsDelta = measure(bits, s.meta.timestampBitWidth, [&] {
+            return int64_t(dec.read_varuint());
+        });
         prev.ts = s.timestamp = prev.ts + prev.tsDelta;
 
-        {
-            auto bc = bits.counter(s.meta.valueBitWidth);
-            s.value = readValue(bits);
-        }
+        s.value = measure(
+                bits, s.meta.valueBitWidth, [&] { return readValue(bits); });
     } else {
-        int64_t dod = 0;
-        {
-            auto bc = bits.counter(s.meta.timestampBitWidth);
-            std::tie(s.timestamp, dod) = readTS(bits);
-        }
-        s.meta.minTimestampBitWidth = minBits(dod);
-        {
-            auto bc = bits.counter(s.meta.valueBitWidth);
-            s.value = readValue(bits);
+        auto [ts, dod] = measure(bits, s.meta.timestampBitWidth, [&] {
+            return readTS(bits);
+        });
+        s.timestamp = ts;
+        if constexpr (RecordBitWidths) {
+            s.meta.minTimestampBitWidth = minBits(dod);
         }
+        s.value = measure(
+                bits, s.meta.valueBitWidth, [&] { return readValue(bits); });
     }
 }
 
-std::pair<int64_t, int64_t> SampleIterator::readTS(BitDecoder& bits) {
+template <bool RecordBitWidths>
+std::pair<int64_t, int64_t> BasicSampleIterator<RecordBitWidths>::readTS(
+        BitDecoder& bits) {
     auto dod = readTSDod(bits);
     prev.tsDelta += dod;
     prev.ts += prev.tsDelta;
     return {prev.ts, dod};
 }
 
-int64_t SampleIterator::readTSDod(BitDecoder& bits) {
+template <bool RecordBitWidths>
+int64_t BasicSampleIterator<RecordBitWidths>::readTSDod(BitDecoder& bits) {
     uint8_t tsPrefix = 0;
     for (int i = 0; i < 4; ++i) {
         tsPrefix <<= 1;
@@ -162,7 +181,8 @@ int64_t SampleIterator::readTSDod(BitDecoder& bits) {
     return tsBits;
 }
 
-double SampleIterator::readValue(BitDecoder& bits) {
+template <bool RecordBitWidths>
+double BasicSampleIterator<RecordBitWidths>::readValue(BitDecoder& bits) {
     if (!bits.readBit()) {
         // delta is zero
         return prev.value;
@@ -198,6 +218,9 @@ double SampleIterator::readValue(BitDecoder& bits) {
     return newValue;
 }
 
+template struct BasicSampleIterator<false>;
+template struct BasicSampleIterator<true>;
+
 ChunkView::ChunkView(ChunkFileCache& cfc, const ChunkReference& chunkRef)
     : ChunkView(cfc.get(chunkRef.getSegmentFileId()),
                 chunkRef.getOffset(),
@@ -257,6 +280,133 @@ SampleIterator ChunkView::samples() const {
     return {res->getDecoder().seek(dataOffset), sampleCount, rawChunk};
 }
 
+InstrumentedSampleIterator ChunkView::instrumentedSamples() const {
+    return {res->getDecoder().seek(dataOffset), sampleCount, rawChunk};
+}
+
+namespace {
+/**
+ * Decode the first @p count samples of a Prometheus XOR chunk, passing the
+ * index, timestamp and value of each to @p sink.
+ */
+template <class Sink>
+void decodeXOR(std::string_view data, size_t count, Sink&& sink) {
+    if (count == 0) {
+        return;
+    }
+    Decoder dec(data);
+
+    // the first timestamp and value, and the first timestamp delta, are
+    // byte aligned.
+    int64_t ts = dec.read_varint();
+    auto valueBits = dec.read_int<uint64_t>();
+    sink(0, ts, valueBits);
+    if (count == 1) {
+        return;
+    }
+
+    int64_t tsDelta = dec.read_varuint();
+    ts += tsDelta;
+
+    BitReader bits(dec.read_view(dec.remaining()));
+    uint8_t leading = 0;
+    uint8_t trailing = 0;
+
+    auto readValue = [&] {
+        if (!bits.readBit()) {
+            // value unchanged
+            return;
+        }
+        if (bits.readBit()) {
+            // new leading/trailing
+            leading = bits.readBits(5);
+            uint8_t sigBits = bits.readBits(6);
+            // 0 encodes 64, see SampleIterator::readValue
+            sigBits = sigBits ? sigBits : 64;
+            if (leading + sigBits > 64) {
+                throw std::logic_error("Chunk has invalid XOR value width");
+            }
+            trailing = 64 - leading - sigBits;
+        }
+        uint8_t sigBits = 64 - leading - trailing;
+        if (!sigBits) {
+            throw std::logic_error(
+                    "Chunkfile read sigBits==0, this is not valid");
+        }
+        valueBits ^= bits.readBits(sigBits) << trailing;
+    };
+
+    readValue();
+    sink(1, ts, valueBits);
+
+    // timestamp delta-of-delta width, indexed by the number of leading ones
+    // in the prefix. These match Prometheus' xor.go
+    static constexpr uint8_t dodWidth[] = {0, 14, 17, 20, 64};
+
+    for (size_t i = 2; i < count; ++i) {
+        auto width = dodWidth[bits.readOnes(4)];
+        if (width) {
+            auto raw = bits.readBits(width);
+            // values narrower than 64 bits are sign extended, see
+            // SampleIterator::readTSDod
+            if (width < 64 && raw > (uint64_t(1) << (width - 1))) {
+                raw -= uint64_t(1) << width;
+            }
+            tsDelta += int64_t(raw);
+        }
+        ts += tsDelta;
+        readValue();
+        sink(i, ts, valueBits);
+    }
+}
+
+template <class Sink>
+size_t decodeChunk(std::string_view data,
+                   bool rawChunk,
+                   size_t count,
+                   Sink&& sink) {
+    if (!rawChunk) {
+        decodeXOR(data, count, sink);
+        return count;
+    }
+    constexpr auto sampleSize = sizeof(int64_t) + sizeof(double);
+    for (size_t i = 0; i < count; ++i) {
+        int64_t ts;
+        uint64_t valueBits;
+        std::memcpy(&ts, data.data() + i * sampleSize, sizeof(ts));
+        std::memcpy(&valueBits,
+                    data.data() + i * sampleSize + sizeof(ts),
+                    sizeof(valueBits));
+        sink(i, ts, valueBits);
+    }
+    return count;
+}
+} // namespace
+
+size_t ChunkView::decode(int64_t* timestamps,
+                         double* values,
+                         size_t capacity) const {
+    return decodeChunk(res->getView().substr(dataOffset),
+                       rawChunk,
+                       std::min(capacity, sampleCount),
+                       [=](size_t i, int64_t ts, uint64_t valueBits) {
+                           timestamps[i] = ts;
+                           std::memcpy(&values[i], &valueBits, sizeof(double));
+                       });
+}
+
+size_t ChunkView::decode(Sample* samples, size_t capacity) const {
+    return decodeChunk(res->getView().substr(dataOffset),
+                       rawChunk,
+                       std::min(capacity, sampleCount),
+                       [=](size_t i, int64_t ts, uint64_t valueBits) {
+                           samples[i].timestamp = ts;
+                           std::memcpy(&samples[i].value,
+                                       &valueBits,
+                                       sizeof(double));
+                       });
+}
+
 std::string_view ChunkView::data() const {
     return res->getView().substr(dataOffset, dataLen);
 }
@@ -10,9 +10,22 @@
 
 class Encoder;
 
-struct SampleIterator : public iterator_facade<SampleIterator, SampleInfo> {
-    SampleIterator() = default;
-    SampleIterator(Decoder dec, size_t sampleCount, bool rawChunk = false);
+/**
+ * Iterator over the samples in a single chunk.
+ *
+ * If RecordBitWidths is true, SampleInfo::meta is populated with the
+ * number of bits used to encode each sample. This is only needed for
+ * reporting encoding efficiency, and costs extra work per sample, so it is
+ * a compile time choice; SampleIterator does not record it.
+ */
+template <bool RecordBitWidths>
+struct BasicSampleIterator
+    : public iterator_facade<BasicSampleIterator<RecordBitWidths>,
+                             SampleInfo> {
+    BasicSampleIterator() = default;
+    BasicSampleIterator(Decoder dec,
+                        size_t sampleCount,
+                        bool rawChunk = false);
 
     void increment();
     const SampleInfo& dereference() const {
@@ -23,7 +36,17 @@ struct SampleIterator : public iterator_facade<SampleIterator, SampleInfo> {
         return currentIndex == sampleCount;
     }
 
+    // true if positioned at the first sample of the chunk
+    bool atFirstSample() const {
+        return currentIndex == 0;
+    }
+
 private:
+    // call fn, recording how many bits it read into dest if bit widths are
+    // being recorded
+    template <class Fn>
+    auto measure(BitDecoder& bits, uint16_t& dest, Fn&& fn);
+
     double readValue(BitDecoder& bits);
     /// return new TS, and raw DOD
     std::pair<int64_t, int64_t> readTS(BitDecoder& bits);
@@ -46,6 +69,9 @@ private:
     SampleInfo s;
 };
 
+using SampleIterator = BasicSampleIterator<false>;
+using InstrumentedSampleIterator = BasicSampleIterator<true>;
+
 // non-copying type. Holds a shared_ptr to the resource to ensure it
 // lives as long as it is being used.
 class ChunkView {
@@ -58,6 +84,19 @@ public:
 
     SampleIterator samples() const;
 
+    // iterate samples, populating SampleInfo::meta
+    InstrumentedSampleIterator instrumentedSamples() const;
+
+    /**
+     * Decode up to @p capacity samples from the start of the chunk into the
+     * provided buffers, returning the number of samples decoded.
+     *
+     * Much faster than iterating samples() when the whole chunk is needed,
+     * but provides no bit width information.
+     */
+    size_t decode(int64_t* timestamps, double* values, size_t capacity) const;
+    size_t decode(Sample* samples, size_t capacity) const;
+
     size_t numSamples() const {
         return sampleCount;
     }
@@ -81,6 +120,7 @@ public:
 
 private:
     friend void pdu::detail::serialise_impl(Encoder& e, const ChunkView& cv);
+    friend std::string_view pdu::detail::chunk_data(const ChunkView& cv);
     // offset into the resource to the chunk start
     size_t chunkOffset;
     std::shared_ptr<Resource> res;
@@ -1,63 +1,44 @@
 #include "chunk_writer.h"
 
+#include "pdu/util/host.h"
+
+#include <algorithm>
+#include <cstring>
 #include <limits>
 
 #include <boost/config.hpp>
 
-ChunkWriter::ChunkWriter(std::ostream& out) : out(out), enc(out), bits(enc) {
-    // TODO seek forward by 2 bytes for sample count
-    sampleCountPosition = out.tellp();
-    enc.write_int(uint16_t(0));
-}
-
-ChunkWriter::~ChunkWriter() {
-    close();
-}
-
-void ChunkWriter::close() {
-    if (closed()) {
-        return;
-    }
-    // flush any remaining data out of the bitwise encoder
-    bits.close();
-
-    // seek backwards, write out sample count
-    out.seekp(sampleCountPosition);
-    enc.write_int(sampleCount);
-
-    open = false;
+XORAppender::XORAppender() {
+    // sample count, updated as samples are appended
+    data.assign(sizeof(uint16_t), '\0');
 }
 
-void ChunkWriter::append(const Sample& s) {
-    if (BOOST_UNLIKELY(closed())) {
-        throw std::logic_error(
-                "ChunkWriter::append cannot write more samples to a closed "
-                "chunk");
-    }
+void XORAppender::append(const Sample& s) {
     if (BOOST_UNLIKELY(full())) {
         throw std::length_error(
-                "ChunkWriter::append cannot write more samples to full chunk "
+                "XORAppender::append cannot write more samples to full chunk "
                 "(max size " +
                 std::to_string(std::numeric_limits<uint16_t>::max()) + ")");
     }
 
     if (BOOST_UNLIKELY(sampleCount == 0)) {
-        // TODO write full sample
-        enc.write_varint(s.timestamp);
-        enc.write_int(reinterpret_cast<const uint64_t&>(s.value));
+        // zig-zag encoded, as Encoder::write_varint
+        auto ts = uint64_t(s.timestamp) << 1;
+        writeVarUInt(s.timestamp < 0 ? ~ts : ts);
+        auto value = from_host(reinterpret_cast<const uint64_t&>(s.value));
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
     } else if (BOOST_UNLIKELY(sampleCount == 1)) {
         if (BOOST_UNLIKELY(s.timestamp < prev.timestamp)) {
             throw std::logic_error(
-                    "ChunkWriter::append cannot write samples with "
+                    "XORAppender::append cannot write samples with "
                     "non-monotonic timestamps prev: " +
                     std::to_string(prev.timestamp) +
                     " new:" + std::to_string(s.timestamp));
         }
         prev.tsDelta = s.timestamp - prev.timestamp;
-        // last direct usage of encoder - after this everything goes
-        // through the BitEncoder. BitEncoder buffers one byte, would
-        // be wrong to mix and match.
-        enc.write_varuint(prev.tsDelta);
+        // last byte aligned write - after this everything is written
+        // bitwise.
+        writeVarUInt(prev.tsDelta);
         writeValue(s.value);
     } else {
         writeTSDod(s.timestamp);
@@ -66,6 +47,50 @@ void ChunkWriter::append(const Sample& s) {
     prev.timestamp = s.timestamp;
     prev.value = s.value;
     sampleCount++;
+
+    auto count = from_host(sampleCount);
+    std::memcpy(data.data(), &count, sizeof(count));
+}
+
+std::string XORAppender::release() {
+    auto chunk = std::move(data);
+    *this = XORAppender();
+    return chunk;
+}
+
+void XORAppender::writeVarUInt(uint64_t value) {
+    // max encoded size is 10 bytes
+    for (int i = 0; i < 10; ++i) {
+        auto b = uint8_t(value & 0x7f);
+        value >>= 7;
+        if (value) {
+            b |= 0x80;
+        }
+        data.push_back(char(b));
+        if (!value) {
+            break;
+        }
+    }
+}
+
+void XORAppender::writeBits(uint64_t value, size_t count) {
+    while (count > 0) {
+        if (remainingBits == 0) {
+            data.push_back('\0');
+            remainingBits = 8;
+        }
+        auto bitsToWrite = std::min(count, size_t(remainingBits));
+        auto mask = (uint16_t(1) << bitsToWrite) - 1;
+        auto bits = uint8_t(mask & (value >> (count - bitsToWrite)));
+        data.back() = char(uint8_t(data.back()) |
+                           uint8_t(bits << (remainingBits - bitsToWrite)));
+        count -= bitsToWrite;
+        remainingBits -= bitsToWrite;
+    }
+}
+
+void XORAppender::writeBit(bool val) {
+    writeBits(uint64_t(val), 1);
 }
 
 bool fitsInBits(int64_t dod, uint8_t nbits) {
@@ -79,30 +104,30 @@ bool fitsInBits(int64_t dod, uint8_t nbits) {
            dod <= int64_t(uint64_t(1) << (nbits - 1));
 }
 
-void ChunkWriter::writeTSDod(int64_t timestamp) {
+void XORAppender::writeTSDod(int64_t timestamp) {
     int64_t tsDelta = timestamp - prev.timestamp;
     int64_t tsDod = tsDelta - prev.tsDelta;
 
     if (tsDod == 0) {
-        bits.writeBit(0);
+        writeBit(0);
     } else if (fitsInBits(tsDod, 14)) {
-        bits.writeBits(0b10, 2);
-        bits.writeBits(uint64_t(tsDod), 14);
+        writeBits(0b10, 2);
+        writeBits(uint64_t(tsDod), 14);
     } else if (fitsInBits(tsDod, 17)) {
-        bits.writeBits(0b110, 3);
-        bits.writeBits(uint64_t(tsDod), 17);
+        writeBits(0b110, 3);
+        writeBits(uint64_t(tsDod), 17);
     } else if (fitsInBits(tsDod, 20)) {
-        bits.writeBits(0b1110, 4);
-        bits.writeBits(uint64_t(tsDod), 20);
+        writeBits(0b1110, 4);
+        writeBits(uint64_t(tsDod), 20);
     } else {
-        bits.writeBits(0b1111, 4);
-        bits.writeBits(uint64_t(tsDod), 64);
+        writeBits(0b1111, 4);
+        writeBits(uint64_t(tsDod), 64);
     }
 
     prev.tsDelta = tsDelta;
 }
 
-void ChunkWriter::writeValue(double val) {
+void XORAppender::writeValue(double val) {
     // translated from
     // https://github.com/prometheus/prometheus/blob/7309c20e7e5774e7838f183ec97c65baa4362edc/tsdb/chunkenc/xor.go#L220-L253
     // xor delta
@@ -111,10 +136,10 @@ void ChunkWriter::writeValue(double val) {
 
     if (!vDelta) {
         // value is identical
-        bits.writeBit(0);
+        writeBit(0);
         return;
     }
-    bits.writeBit(1);
+    writeBit(1);
     auto leadingZeros = uint8_t(__builtin_clzll(vDelta));
     auto trailingZeros = uint8_t(__builtin_ctzll(vDelta));
 
@@ -131,17 +156,17 @@ void ChunkWriter::writeValue(double val) {
     // sample.
     if (prev.leading != std::numeric_limits<uint8_t>::max() &&
         leadingZeros >= prev.leading && trailingZeros >= prev.trailing) {
-        bits.writeBit(0);
-        bits.writeBits(vDelta >> prev.trailing,
+        writeBit(0);
+        writeBits(vDelta >> prev.trailing,
                        64 - prev.leading - prev.trailing);
     } else {
         prev.leading = leadingZeros;
         prev.trailing = trailingZeros;
 
-        bits.writeBit(1);
+        writeBit(1);
         // write the number of leading zeroes, encoded in 5 bits
         // (hence the max of 31)
-        bits.writeBits(leadingZeros, 5);
+        writeBits(leadingZeros, 5);
 
         // encode the number of significant bits (bits which are not in the
         // leading or trailing zeroes)
@@ -152,22 +177,47 @@ void ChunkWriter::writeValue(double val) {
         // for this).
         // 64 & 0b111111 = 0;
         uint64_t sigBits = 64 - leadingZeros - trailingZeros;
-        bits.writeBits(sigBits, 6);
+        writeBits(sigBits, 6);
 
         // finally, write the actual bits which have changed:
-        bits.writeBits(vDelta >> trailingZeros, sigBits);
+        writeBits(vDelta >> trailingZeros, sigBits);
+    }
+}
+
+ChunkWriter::ChunkWriter(std::ostream& out) : out(out) {
+}
+
+ChunkWriter::~ChunkWriter() {
+    close();
+}
+
+void ChunkWriter::close() {
+    if (closed()) {
+        return;
+    }
+    auto bytes = appender.bytes();
+    out.write(bytes.data(), bytes.size());
+    open = false;
+}
+
+void ChunkWriter::append(const Sample& s) {
+    if (BOOST_UNLIKELY(closed())) {
+        throw std::logic_error(
+                "ChunkWriter::append cannot write more samples to a closed "
+                "chunk");
     }
+    appender.append(s);
 }
 
 bool ChunkWriter::empty() const {
-    return sampleCount == 0;
+    return appender.empty();
 }
 
 bool ChunkWriter::full() const {
-    return sampleCount == std::numeric_limits<uint16_t>::max();
+    return appender.full();
 }
 
 ChunkWriter& operator<<(ChunkWriter& writer, const Sample& s) {
     writer.append(s);
     return writer;
-}
\ No newline at end of file
+}
@@ -1,38 +1,65 @@
 #pragma once
 
 #include "pdu/block/sample.h"
-#include "pdu/encode/bit_encoder.h"
-#include "pdu/encode/encoder.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <limits>
+#include <string>
+#include <string_view>
 
-class ChunkWriter {
+/**
+ * Builds an XOR chunk in memory, one sample at a time.
+ *
+ * Bits are written straight into the chunk bytes, and the sample count at
+ * the start of the chunk is kept up to date, so the bytes always form a
+ * complete chunk which may be read while more samples are still to be
+ * appended. Beyond the bytes themselves only a few words of state are
+ * held, so many chunks may be built at once (e.g., one per series in the
+ * WAL).
+ */
+class XORAppender {
 public:
-    ChunkWriter(std::ostream& out);
+    XORAppender();
 
-    ~ChunkWriter();
+    void append(const Sample& s);
 
-    void close();
+    // the chunk written so far, including the sample count
+    std::string_view bytes() const {
+        return data;
+    }
 
-    void append(const Sample& s);
+    /**
+     * Take the chunk bytes, leaving this appender empty and ready to start
+     * a new chunk.
+     */
+    std::string release();
 
-    bool empty() const;
+    uint16_t size() const {
+        return sampleCount;
+    }
 
-    bool full() const;
+    bool empty() const {
+        return sampleCount == 0;
+    }
 
-    bool closed() const {
-        return !open;
+    bool full() const {
+        return sampleCount == std::numeric_limits<uint16_t>::max();
     }
 
 private:
+    void writeVarUInt(uint64_t value);
+    void writeBits(uint64_t value, size_t count);
+    void writeBit(bool val);
+
     void writeTSDod(int64_t timestamp);
     void writeValue(double val);
 
-    std::ostream& out;
-    Encoder enc;
-    BitEncoder bits;
+    std::string data;
     uint16_t sampleCount = 0;
+    // unwritten low bits of the last byte of data
+    uint8_t remainingBits = 0;
 
     struct {
         int64_t timestamp = 0;
@@ -41,8 +68,33 @@ private:
         uint8_t leading = std::numeric_limits<uint8_t>::max();
         uint8_t trailing = 0;
     } prev;
+};
+
+/**
+ * Writes an XOR chunk to a stream. The chunk is written out when closed,
+ * either explicitly or on destruction.
+ */
+class ChunkWriter {
+public:
+    ChunkWriter(std::ostream& out);
+
+    ~ChunkWriter();
+
+    void close();
+
+    void append(const Sample& s);
+
+    bool empty() const;
+
+    bool full() const;
 
-    std::ostream::pos_type sampleCountPosition;
+    bool closed() const {
+        return !open;
+    }
+
+private:
+    std::ostream& out;
+    XORAppender appender;
 
     bool open = true;
 };
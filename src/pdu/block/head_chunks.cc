@@ -3,7 +3,15 @@
 #include "mapped_file.h"
 #include "pdu/filter/series_filter.h"
 
-HeadChunks::HeadChunks(const boost::filesystem::path& dataDir) {
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+
+HeadChunks::HeadChunks(const boost::filesystem::path& dataDir,
+                       size_t threads,
+                       ChunkType walChunkType)
+    : dataDir(dataDir), walChunkType(walChunkType) {
     auto headChunksDir = dataDir / "chunks_head";
     namespace fs = boost::filesystem;
     if (!fs::exists(headChunksDir) || !fs::exists(dataDir / "wal")) {
@@ -12,23 +20,9 @@ HeadChunks::HeadChunks(const boost::filesystem::path& dataDir) {
 
     cache = std::make_shared<ChunkFileCache>(headChunksDir);
 
-    std::vector<std::string> chunkFileNames;
-
-    for (const auto& chunkFile : fs::directory_iterator(headChunksDir)) {
-        chunkFileNames.emplace_back(chunkFile.path().filename().string());
-    }
-
-    std::sort(chunkFileNames.begin(), chunkFileNames.end());
-
-    for (int i = 0; i < chunkFileNames.size(); ++i) {
-        const auto& filename = chunkFileNames[i];
-        uint64_t fileId;
-        try {
-            fileId = std::stoull(filename);
-        } catch (const std::exception&) {
-            throw std::runtime_error("Head chunk has unexpected filename: " +
-                                     filename);
-        }
+    auto chunkFiles = findChunkFiles();
+    for (int i = 0; i < chunkFiles.size(); ++i) {
+        auto fileId = chunkFiles[i];
         auto fileResource = cache->get(fileId);
         auto dec = fileResource->getDecoder();
 
@@ -38,46 +32,204 @@ HeadChunks::HeadChunks(const boost::filesystem::path& dataDir) {
             // the last chunk file may be partially constructed
             // all others are expected to be fully valid
             // TODO: CRCs should be checked
-            if (i != chunkFileNames.size() - 1) {
+            if (i != chunkFiles.size() - 1) {
                 throw;
             }
         }
     }
 
     // WAL
-    WalLoader wl(seriesMap, symbols, walChunks);
-    wl.load(dataDir);
+    WalLoader wl(seriesMap, *symbols.back(), walChunks, walChunkType);
+    wl.load(dataDir, threads);
+    walPosition = wl.getPosition();
+
+    publishWalChunks();
+    sortRefs();
+}
+
+HeadChunks::HeadChunks(const HeadChunks& other)
+    : SeriesSource(other),
+      dataDir(other.dataDir),
+      walChunkType(other.walChunkType),
+      chunkFileEnds(other.chunkFileEnds),
+      walChunkFileCount(other.walChunkFileCount),
+      freeWalChunkFileIds(other.freeWalChunkFileIds),
+      walPosition(other.walPosition),
+      seriesMap(other.seriesMap),
+      sortedRefs(other.sortedRefs),
+      walChunks(other.walChunks) {
+    if (other.cache) {
+        cache = std::make_shared<ChunkFileCache>(*other.cache);
+    }
+    // references to symbols are never released until the last head using
+    // them is destroyed, so may be shared. Other copies of other may be
+    // acquiring symbols concurrently, so new symbols need refs of their own.
+    symbols.clear();
+    std::copy_if(other.symbols.begin(),
+                 other.symbols.end(),
+                 std::back_inserter(symbols),
+                 [](const auto& refs) { return refs->size() != 0; });
+    symbols.push_back(std::make_shared<SymbolRefs>());
+}
+
+std::shared_ptr<HeadChunks> HeadChunks::refreshed() const {
+    std::shared_ptr<HeadChunks> head(new HeadChunks(*this));
+    if (!head->refresh()) {
+        return nullptr;
+    }
+    return head;
+}
+
+bool HeadChunks::refresh() {
+    namespace fs = boost::filesystem;
+    bool hasHead = fs::exists(dataDir / "chunks_head") &&
+                   fs::exists(dataDir / "wal");
+    if (!cache || !hasHead) {
+        // nothing to refresh if there was and still is no head
+        return !cache && !hasHead;
+    }
+
+    auto chunkFiles = findChunkFiles();
+    for (const auto& [fileId, end] : chunkFileEnds) {
+        if (!std::binary_search(chunkFiles.begin(), chunkFiles.end(), fileId)) {
+            // chunk files are only removed when the head is truncated
+            return false;
+        }
+    }
+
+    for (int i = 0; i < chunkFiles.size(); ++i) {
+        auto fileId = chunkFiles[i];
+        auto endItr = chunkFileEnds.find(fileId);
+        auto fileResource = cache->get(fileId);
+        auto size = fs::file_size(dataDir / "chunks_head" /
+                                  fmt::format("{:0>6}", fileId));
+        if (fileResource->getView().size() != size) {
+            // the file has grown since it was mapped, map it again
+            cache->erase(fileId);
+            fileResource = cache->get(fileId);
+        } else if (endItr != chunkFileEnds.end()) {
+            // nothing new in this file
+            continue;
+        }
+        auto dec = fileResource->getDecoder();
+
+        try {
+            if (endItr == chunkFileEnds.end()) {
+                loadChunkFile(dec, fileId);
+            } else {
+                dec.seek(endItr->second);
+                loadChunks(dec, fileId);
+            }
+        } catch (const std::runtime_error& e) {
+            // as when loading, the last file may be partially written
+            if (i != chunkFiles.size() - 1) {
+                throw;
+            }
+        }
+    }
+
+    WalLoader wl(seriesMap, *symbols.back(), walChunks, walChunkType);
+    if (!wl.resume(dataDir, walPosition)) {
+        return false;
+    }
+    walPosition = wl.getPosition();
+
+    publishWalChunks();
+    sortRefs();
+    return true;
+}
+
+std::vector<uint64_t> HeadChunks::findChunkFiles() const {
+    std::vector<uint64_t> fileIds;
+    namespace fs = boost::filesystem;
+    for (const auto& chunkFile :
+         fs::directory_iterator(dataDir / "chunks_head")) {
+        auto filename = chunkFile.path().filename().string();
+        try {
+            fileIds.push_back(std::stoull(filename));
+        } catch (const std::exception&) {
+            throw std::runtime_error("Head chunk has unexpected filename: " +
+                                     filename);
+        }
+    }
+
+    std::sort(fileIds.begin(), fileIds.end());
+    return fileIds;
+}
 
+void HeadChunks::publishWalChunks() {
     // now the wal has been loaded, stick the fake chunks into the cache
-    // and add references to them to the series.
-
-    int counter = 0;
-    for (const auto& [ref, memchunk] : walChunks) {
-        if (memchunk.empty()) {
-            // if no samples were loaded from the wal for this series ref
-            // why is it in the map??
-            throw std::logic_error(
-                    "WAL has chunk but no data for series ref: " +
-                    std::to_string(ref));
+    // and add references to them to the series. Series and chunks which
+    // have not changed keep those published already.
+    auto changed = walChunks.takeModified();
+    changed.insert(changed.end(),
+                   seriesWithNewChunks.begin(),
+                   seriesWithNewChunks.end());
+    seriesWithNewChunks.clear();
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    for (auto ref : changed) {
+        auto memchunk = walChunks.find(ref);
+        if (memchunk == walChunks.end()) {
+            continue;
         }
-        auto [resource, chunkref] = memchunk.makeResource();
+        auto& chunks = seriesMap[ref].chunks;
+        auto isWalChunk = [](const auto& chunkref) {
+            return chunkref.getSegmentFileId() >= DummyFileIdBase;
+        };
+        for (const auto& chunkref : chunks) {
+            if (isWalChunk(chunkref)) {
+                auto fileId = chunkref.getSegmentFileId();
+                cache->erase(fileId);
+                freeWalChunkFileIds.push_back(fileId - DummyFileIdBase);
+            }
+        }
+        chunks.erase(std::remove_if(chunks.begin(), chunks.end(), isWalChunk),
+                     chunks.end());
+
+        // samples for a series may all have been dropped as they are
+        // also in head chunks.
+        for (auto& [resource, chunkref] : memchunk->second->makeResources()) {
+            uint32_t id = walChunkFileCount;
+            if (freeWalChunkFileIds.empty()) {
+                ++walChunkFileCount;
+            } else {
+                id = freeWalChunkFileIds.back();
+                freeWalChunkFileIds.pop_back();
+            }
+            auto fileId = DummyFileIdBase + id;
+            chunkref.fileReference = makeFileReference(fileId, 0);
 
-        auto fileId = DummyFileIdBase + counter;
-        chunkref.fileReference = makeFileReference(fileId, 0);
+            cache->store(fileId, std::move(resource));
+            chunks.push_back(chunkref);
+        }
+    }
+}
 
-        cache->store(fileId, std::move(resource));
-        seriesMap[ref].chunks.push_back(chunkref);
-        ++counter;
+void HeadChunks::sortRefs() {
+    // series are iterated in insertion order, so those added since the
+    // refs were last sorted are at the end.
+    auto sorted = sortedRefs.size();
+    sortedRefs.reserve(seriesMap.size());
+    for (auto itr = std::next(seriesMap.begin(), sorted);
+         itr != seriesMap.end();
+         ++itr) {
+        sortedRefs.push_back(itr->first);
     }
+    std::sort(sortedRefs.begin() + sorted, sortedRefs.end());
+    std::inplace_merge(
+            sortedRefs.begin(), sortedRefs.begin() + sorted, sortedRefs.end());
 }
 
-std::set<SeriesSource::SeriesRef> HeadChunks::getFilteredSeriesRefs(
+PostingList HeadChunks::getFilteredSeriesRefs(
         const SeriesFilter& filter) const {
-    std::set<SeriesSource::SeriesRef> res;
+    PostingList res;
 
-    for (const auto& [ref, series] : seriesMap) {
-        if (filter(series)) {
-            res.insert(ref);
+    // refs are visited in sorted order, so are pushed in sorted order
+    for (auto ref : sortedRefs) {
+        if (filter(seriesMap.at(ref))) {
+            res.push_back(ref);
         }
     }
     return res;
@@ -111,6 +263,11 @@ void HeadChunks::loadChunkFile(Decoder& dec, uint64_t fileId) {
     dec.read_int<uint8_t>();
     dec.read_int<uint8_t>();
 
+    loadChunks(dec, fileId);
+}
+
+void HeadChunks::loadChunks(Decoder& dec, uint64_t fileId) {
+    chunkFileEnds[fileId] = dec.tell();
     while (dec.remaining() > HeadChunkMetaMinLen) {
         auto res = readHeadChunkMeta(dec, fileId);
         if (!res) {
@@ -118,6 +275,16 @@ void HeadChunks::loadChunkFile(Decoder& dec, uint64_t fileId) {
             break;
         }
         auto [seriesRef, chunkRef] = *res;
+
+        // WAL samples now in this chunk need not be held in memory too
+        if (auto* walChunk = walChunks.modify(seriesRef)) {
+            walChunk->setMinTime(chunkRef.maxTime + 1);
+        }
+
+        // WAL chunks are published after head chunks, so need publishing
+        // again for this series.
         seriesMap[seriesRef].chunks.push_back(std::move(chunkRef));
+        seriesWithNewChunks.push_back(seriesRef);
+        chunkFileEnds[fileId] = dec.tell();
     }
 }
\ No newline at end of file
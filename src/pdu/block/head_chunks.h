@@ -11,7 +11,6 @@
 #include <boost/filesystem.hpp>
 #include <map>
 #include <memory>
-#include <set>
 #include <utility>
 #include <vector>
 
@@ -21,9 +20,31 @@ inline constexpr size_t HeadChunkMetaMinLen = 8 + 8 + 8 + 1 + 1 + 4;
 
 class HeadChunks : public SeriesSource {
 public:
-    HeadChunks(const boost::filesystem::path& dataDir);
+    /**
+     * Load head chunks and replay the WAL, using up to @p threads threads
+     * for the replay. Samples from the WAL are held in memory as chunks of
+     * @p walChunkType, see InMemWalChunk.
+     */
+    HeadChunks(const boost::filesystem::path& dataDir,
+               size_t threads = 1,
+               ChunkType walChunkType = ChunkType::Raw);
 
-    std::set<SeriesRef> getFilteredSeriesRefs(
+    /**
+     * Get a new HeadChunks, holding everything this does plus head chunks
+     * and WAL records written since this was loaded. Series and WAL chunks
+     * already loaded are shared with this rather than read again; only
+     * those gaining chunks or samples are copied, see SharedRefMap.
+     *
+     * This HeadChunks is not modified, so series and samples already read
+     * from it remain valid, and it may be read (or refreshed) concurrently.
+     *
+     * Returns nullptr if the head has been truncated since (e.g., after
+     * compacting it into a block), in which case a new HeadChunks should be
+     * loaded instead.
+     */
+    std::shared_ptr<HeadChunks> refreshed() const;
+
+    PostingList getFilteredSeriesRefs(
             const SeriesFilter& filter) const override;
 
     const Series& getSeries(SeriesRef ref) const override;
@@ -33,14 +54,49 @@ public:
 protected:
     // allow tests to default construct and manually load data
     HeadChunks() = default;
+
+    // copy of @p other, with refs of its own for new symbols
+    HeadChunks(const HeadChunks& other);
+
+    // load data written since, see refreshed(). Only to be called on a
+    // new copy, before it is shared.
+    bool refresh();
+
+    // ids of the files in chunks_head, in order
+    std::vector<uint64_t> findChunkFiles() const;
     void loadChunkFile(Decoder& dec, uint64_t fileId);
+    // load chunks from the current position of dec up to the end of file
+    void loadChunks(Decoder& dec, uint64_t fileId);
+
+    // add references to in memory chunks of WAL samples to the series
+    // whose chunks have changed since last published, replacing any
+    // added previously.
+    void publishWalChunks();
+    void sortRefs();
+
+    boost::filesystem::path dataDir;
+    ChunkType walChunkType = ChunkType::Raw;
 
     std::shared_ptr<ChunkFileCache> cache;
+    // for each head chunk file, the offset following the last chunk read
+    std::map<uint64_t, size_t> chunkFileEnds;
+    // dummy file ids used by in memory WAL chunks. Ids below the count
+    // have been assigned; those released since may be assigned again.
+    uint32_t walChunkFileCount = 0;
+    std::vector<uint32_t> freeWalChunkFileIds;
+    WalPosition walPosition;
 
     // seriesRef to chunk references
-    std::map<size_t, Series> seriesMap;
-    // storage for strings referenced from the wal.
-    std::set<std::string, std::less<>> symbols;
+    WalSeriesMap seriesMap;
+    // refs of series given head chunks since WAL chunks were published
+    std::vector<uint64_t> seriesWithNewChunks;
+    // all refs in seriesMap, sorted once loading is complete
+    std::vector<size_t> sortedRefs;
+    // references to the symbols used by series from the wal. Only the
+    // last is added to; earlier ones are shared with the heads this was
+    // refreshed from.
+    std::vector<std::shared_ptr<SymbolRefs>> symbols{
+            std::make_shared<SymbolRefs>()};
     // storage for data read from the wal
-    std::map<size_t, InMemWalChunk> walChunks;
+    WalChunkMap walChunks;
 };
\ No newline at end of file
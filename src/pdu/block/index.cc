@@ -8,6 +8,8 @@
 #include <boost/filesystem.hpp>
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+
 std::ostream& operator<<(std::ostream& os, const Series& s) {
     for (const auto& [k, v] : s.labels) {
         os << k << " " << v << "\n";
@@ -19,8 +21,14 @@ int8_t compare(const Series& a, const Series& b) {
     auto aItr = a.labels.begin();
     auto bItr = b.labels.begin();
     for (; aItr != a.labels.end() && bItr != b.labels.end(); ++aItr, ++bItr) {
-        if (*aItr != *bItr) {
-            return *aItr < *bItr ? -1 : 1;
+        if (aItr.ids() == bItr.ids()) {
+            // interned symbols are unique, the strings must match
+            continue;
+        }
+        auto aLabel = *aItr;
+        auto bLabel = *bItr;
+        if (aLabel != bLabel) {
+            return aLabel < bLabel ? -1 : 1;
         }
     }
     // to reach this point, the first N labels must have matched between
@@ -38,30 +46,69 @@ int8_t compare(const Series& a, const Series& b) {
 }
 
 std::string_view SymbolTable::lookup(size_t index) const {
-    if (index >= symbols.size()) {
+    if (index >= offsets.size()) {
+        throw std::domain_error("SymbolTable: too high index");
+    }
+
+    Decoder dec(data);
+    dec.seek(offsets[index]);
+    auto strLen = dec.read_varuint();
+    return dec.read_view(strLen);
+}
+
+SymbolTable::~SymbolTable() {
+    releaseIds();
+}
+
+SymbolDictionary::Id SymbolTable::globalId(size_t index) const {
+    if (index >= offsets.size()) {
         throw std::domain_error("SymbolTable: too high index");
     }
+    auto& id = globalIds[index];
+    auto value = id.load(std::memory_order_acquire);
+    if (value != SymbolDictionary::Invalid) {
+        return value;
+    }
+    auto& dict = SymbolDictionary::instance();
+    auto acquired = dict.acquire(lookup(index));
+    if (!id.compare_exchange_strong(value, acquired)) {
+        // another thread interned the symbol first, and holds the reference
+        // this table keeps. Both will have been given the same ID.
+        dict.release(acquired);
+    }
+    return acquired;
+}
 
-    return symbols.at(index);
+void SymbolTable::releaseIds() {
+    auto& dict = SymbolDictionary::instance();
+    for (auto& id : globalIds) {
+        auto value = id.load(std::memory_order_acquire);
+        if (value != SymbolDictionary::Invalid) {
+            dict.release(value);
+        }
+    }
+    globalIds.clear();
 }
 
 void SymbolTable::load(Decoder& dec) {
-    dec.read_int<uint32_t>(); // len
+    auto len = dec.read_int<uint32_t>();
     auto numSymbols = dec.read_int<uint32_t>();
 
-    symbols.reserve(numSymbols);
+    // len covers the symbol count and the symbols themselves
+    data = dec.read_view(len - sizeof(uint32_t));
 
-    std::string value;
+    releaseIds();
+    offsets.clear();
+    offsets.reserve(numSymbols);
+
+    Decoder symbolDec(data);
     for (int i = 0; i < numSymbols; ++i) {
-        auto strLen = dec.read_varuint();
-        if (strLen == 0) {
-            symbols.push_back("");
-            continue;
-        }
-        value.resize(strLen);
-        dec.read(value.data(), strLen);
-        symbols.push_back(value);
+        offsets.push_back(symbolDec.tell());
+        auto strLen = symbolDec.read_varuint();
+        symbolDec.seek(strLen, std::ios_base::cur);
     }
+
+    globalIds = std::vector<std::atomic<SymbolDictionary::Id>>(numSymbols);
 }
 
 void TOC::load(Decoder& dec) {
@@ -73,6 +120,136 @@ void TOC::load(Decoder& dec) {
     dec.read_int_to(postings_offset_table_offset);
 }
 
+SeriesLabels::value_type SeriesLabels::const_iterator::operator*() const {
+    const auto& dict = SymbolDictionary::instance();
+    return {dict.lookup(itr->first), dict.lookup(itr->second)};
+}
+
+SeriesLabels::SeriesLabels(const SeriesLabels& other)
+    : labels(other.labels), owning(other.owning) {
+    if (owning) {
+        acquireAll();
+    }
+}
+
+SeriesLabels::SeriesLabels(SeriesLabels&& other) noexcept
+    : labels(std::move(other.labels)), owning(other.owning) {
+    other.labels.clear();
+    other.owning = false;
+}
+
+SeriesLabels& SeriesLabels::operator=(const SeriesLabels& other) {
+    if (this != &other) {
+        *this = SeriesLabels(other);
+    }
+    return *this;
+}
+
+SeriesLabels& SeriesLabels::operator=(SeriesLabels&& other) noexcept {
+    if (this != &other) {
+        if (owning) {
+            releaseAll();
+        }
+        labels = std::move(other.labels);
+        owning = other.owning;
+        other.labels.clear();
+        other.owning = false;
+    }
+    return *this;
+}
+
+SeriesLabels::~SeriesLabels() {
+    if (owning) {
+        releaseAll();
+    }
+}
+
+void SeriesLabels::acquireAll() const {
+    auto& dict = SymbolDictionary::instance();
+    for (const auto& [name, value] : labels) {
+        dict.acquire(name);
+        dict.acquire(value);
+    }
+}
+
+void SeriesLabels::releaseAll() const {
+    auto& dict = SymbolDictionary::instance();
+    for (const auto& [name, value] : labels) {
+        dict.release(name);
+        dict.release(value);
+    }
+}
+
+void SeriesLabels::add(LabelId ids) {
+    auto& dict = SymbolDictionary::instance();
+    auto name = dict.lookup(ids.first);
+    // labels are normally added in order, so this is usually an append
+    auto pos = labels.end();
+    if (!labels.empty() && name <= dict.lookup(labels.back().first)) {
+        pos = std::lower_bound(labels.begin(),
+                               labels.end(),
+                               name,
+                               [&dict](const LabelId& label, auto key) {
+                                   return dict.lookup(label.first) < key;
+                               });
+        if (pos != labels.end() && pos->first == ids.first) {
+            return;
+        }
+    }
+    labels.insert(pos, ids);
+    if (owning) {
+        dict.acquire(ids.first);
+        dict.acquire(ids.second);
+    }
+}
+
+void SeriesLabels::add(std::string_view name, std::string_view value) {
+    if (!owning) {
+        // labels added so far are held by the source of the series, which
+        // the views passed here need not outlive
+        acquireAll();
+        owning = true;
+    }
+    auto& dict = SymbolDictionary::instance();
+    auto ids = LabelId{dict.acquire(name), dict.acquire(value)};
+    // add() acquires its own references if the label is new
+    add(ids);
+    dict.release(ids.first);
+    dict.release(ids.second);
+}
+
+SeriesLabels::const_iterator SeriesLabels::find(std::string_view name) const {
+    const auto& dict = SymbolDictionary::instance();
+    // series have few labels, a linear scan beats binary search here as
+    // every probe costs a dictionary lookup
+    for (auto pos = labels.begin(); pos != labels.end(); ++pos) {
+        auto order = dict.lookup(pos->first).compare(name);
+        if (order == 0) {
+            return const_iterator(pos);
+        }
+        if (order > 0) {
+            break;
+        }
+    }
+    return end();
+}
+
+std::string_view SeriesLabels::at(std::string_view name) const {
+    auto itr = find(name);
+    if (itr == end()) {
+        throw std::out_of_range("Series has no label " + std::string(name));
+    }
+    return SymbolDictionary::instance().lookup(itr.ids().second);
+}
+
+bool operator==(const SeriesLabels& a, const SeriesLabels& b) {
+    return a.ids() == b.ids();
+}
+
+bool operator!=(const SeriesLabels& a, const SeriesLabels& b) {
+    return !(a == b);
+}
+
 void Series::load(Decoder& dec, const SymbolTable& symbols) {
     auto len = dec.read_varuint(); // maybe?
     auto labelCount = dec.read_varuint();
@@ -80,7 +257,7 @@ void Series::load(Decoder& dec, const SymbolTable& symbols) {
     for (int i = 0; i < labelCount; ++i) {
         auto name_id = dec.read_varuint();
         auto value_id = dec.read_varuint();
-        labels.emplace(symbols.lookup(name_id), symbols.lookup(value_id));
+        labels.add({symbols.globalId(name_id), symbols.globalId(value_id)});
     }
 
     auto chunkCount = dec.read_varuint();
@@ -115,18 +292,103 @@ void Series::load(Decoder& dec, const SymbolTable& symbols) {
     dec.read_int<uint32_t>(); // CRC
 }
 
-void SeriesTable::load(Decoder& dec,
-                       const SymbolTable& symbols,
-                       size_t expectedEnd) {
-    while (dec.consume_to_alignment(16) < expectedEnd) {
-        auto offset = dec.tell();
+void SeriesTable::load(Decoder& d,
+                       const SymbolTable& symbolTable,
+                       size_t expectedEnd,
+                       SeriesLoadMode loadMode) {
+    mode = loadMode;
+    dec = d;
+    symbols = &symbolTable;
+
+    while (d.consume_to_alignment(16) < expectedEnd) {
+        auto offset = d.tell();
         size_t id = offset / 16;
+        refs.push_back(id);
+        if (isLazy()) {
+            // skip over the series entry and the trailing CRC, it will be
+            // decoded if it is needed
+            auto len = d.read_varuint();
+            d.seek(len + 4, std::ios_base::cur);
+            continue;
+        }
         Series s;
-        s.load(dec, symbols);
+        s.load(d, symbolTable);
         series[id] = std::move(s);
     }
 }
 
+SeriesTableIterator SeriesTable::begin() const {
+    return {*this};
+}
+
+const Series& SeriesTable::at(uint64_t ref) const {
+    if (!isLazy()) {
+        return series.at(ref);
+    }
+    std::lock_guard lock(lazyMutex);
+    if (auto itr = series.find(ref); itr != series.end()) {
+        return itr->second;
+    }
+    return series.emplace(ref, decode(ref)).first->second;
+}
+
+Series SeriesTable::decode(uint64_t ref) const {
+    if (!contains(ref)) {
+        throw std::out_of_range("SeriesTable: unknown series ref: " +
+                                std::to_string(ref));
+    }
+    auto d = dec;
+    d.seek(ref * 16);
+    Series s;
+    s.load(d, *symbols);
+    return s;
+}
+
+bool SeriesTable::contains(uint64_t ref) const {
+    return std::binary_search(refs.begin(), refs.end(), ref);
+}
+
+SeriesTableIterator::SeriesTableIterator(const SeriesTable& table)
+    : table(table), itr(table.series.begin()) {
+    update();
+}
+
+SeriesTableIterator::SeriesTableIterator(const SeriesTableIterator& other)
+    : table(other.table), itr(other.itr), refIdx(other.refIdx) {
+    update();
+}
+
+void SeriesTableIterator::increment() {
+    if (table.isLazy()) {
+        ++refIdx;
+    } else {
+        ++itr;
+    }
+    update();
+}
+
+const SeriesTable::value_type& SeriesTableIterator::dereference() const {
+    if (table.isLazy()) {
+        return *current;
+    }
+    return *itr;
+}
+
+bool SeriesTableIterator::is_end() const {
+    if (table.isLazy()) {
+        return refIdx == table.refs.size();
+    }
+    return itr == table.series.end();
+}
+
+void SeriesTableIterator::update() {
+    if (!table.isLazy() || is_end()) {
+        return;
+    }
+    auto ref = table.refs[refIdx];
+    current.emplace(ref, table.decode(ref));
+}
+
 void from_json(const nlohmann::json& j, IndexMeta& meta) {
     j.at("ulid").get_to(meta.ulid);
     j.at("minTime").get_to(meta.minTime);
@@ -154,7 +416,7 @@ void from_json(const nlohmann::json& j, IndexMeta& meta) {
     }
 }
 
-void Index::load(std::shared_ptr<Resource> res) {
+void Index::load(std::shared_ptr<Resource> res, SeriesLoadMode mode) {
     resource = std::move(res);
 
     namespace fs = boost::filesystem;
@@ -189,6 +451,11 @@ void Index::load(std::shared_ptr<Resource> res) {
         metaF.close();
     }
 
+    // eager loading reads every series front to back, lazily loaded
+    // indexes are only read for individual lookups.
+    resource->advise(mode == SeriesLoadMode::Lazy ? AccessPattern::Random
+                                                  : AccessPattern::Sequential);
+
     Decoder dec(resource->getDecoder());
     dec.seek(-(8 * 6 + 4), std::ios::end);
 
@@ -206,7 +473,7 @@ void Index::load(std::shared_ptr<Resource> res) {
     }
 
     dec.seek(toc.series_offset);
-    series.load(dec, symbols, toc.label_indices_offset);
+    series.load(dec, symbols, toc.label_indices_offset, mode);
 
     if (!toc.postings_offset_table_offset) {
         throw std::runtime_error("No posting offset table in index file");
@@ -214,9 +481,31 @@ void Index::load(std::shared_ptr<Resource> res) {
 
     dec.seek(toc.postings_offset_table_offset);
     postings.load(dec);
+
+    if (auto saved = LabelSummary::load(subdir / LabelSummary::FileName,
+                                        resource->getView().size())) {
+        labelSummary = std::move(*saved);
+    } else {
+        labelSummary = LabelSummary::build(postings);
+    }
+
+    if (mode == SeriesLoadMode::Eager) {
+        // later accesses are postings lookups
+        resource->advise(AccessPattern::Normal);
+    }
 }
 
-std::set<SeriesSource::SeriesRef> Index::getFilteredSeriesRefs(
+void Index::saveLabelSummary() const {
+    namespace fs = boost::filesystem;
+    labelSummary.save(fs::path(getDirectory()) / LabelSummary::FileName,
+                      resource->getView().size());
+}
+
+void Index::advise(AccessPattern pattern) const {
+    resource->advise(pattern);
+}
+
+PostingList Index::getFilteredSeriesRefs(
         const SeriesFilter& filter) const {
     return filter(*this);
 }
@@ -225,16 +514,24 @@ const Series& Index::getSeries(SeriesRef ref) const {
     return series.at(ref);
 }
 
-const std::shared_ptr<ChunkFileCache>& Index::getCachePtr() const {
-    return cache;
+std::shared_ptr<const Series> Index::getSeriesPtr(SeriesRef ref) const {
+    if (!series.isLazy()) {
+        return SeriesSource::getSeriesPtr(ref);
+    }
+    // decode a copy of the series which lives only as long as the caller
+    // needs it, rather than retaining every series ever visited.
+    // The labels reference the symbol table, so the index must outlive it.
+    struct Holder {
+        std::shared_ptr<const SeriesSource> index;
+        Series series;
+    };
+    auto holder = std::make_shared<Holder>(
+            Holder{shared_from_this(), series.decode(ref)});
+    return {holder, &holder->series};
 }
 
-Posting::Posting(Decoder dec) {
-    auto len = dec.read_int<uint32_t>();
-    auto entries = dec.read_int<uint32_t>();
-    for (int i = 0; i < entries; ++i) {
-        seriesReferences.insert(dec.read_int<uint32_t>());
-    }
+const std::shared_ptr<ChunkFileCache>& Index::getCachePtr() const {
+    return cache;
 }
 
 void PostingOffsetTable::load(Decoder dec) {
@@ -242,16 +539,74 @@ void PostingOffsetTable::load(Decoder dec) {
     dec.read_int_to(entries);
     // postings are lazily loaded.
     offsetTableDec = dec;
+
+    samples.clear();
+    PostingOffset po;
+    std::string_view prevKey;
+    for (size_t i = 0; i < entries; ++i) {
+        auto position = dec.tell();
+        po.load(dec);
+        if (i % SampleInterval == 0 || po.labelKey != prevKey) {
+            samples.push_back({po.labelKey, po.labelValue, i, position});
+        }
+        prevKey = po.labelKey;
+    }
 }
 
 PostingOffsetIterator PostingOffsetTable::begin() const {
     return {offsetTableDec, entries};
 }
 
-std::shared_ptr<Index> loadIndex(const std::string& fname) {
-    auto resource = map_file(fname);
+std::vector<std::string_view> PostingOffsetTable::labelKeys() const {
+    // the first entry for every key is sampled
+    std::vector<std::string_view> keys;
+    for (const auto& sample : samples) {
+        if (keys.empty() || keys.back() != sample.labelKey) {
+            keys.push_back(sample.labelKey);
+        }
+    }
+    return keys;
+}
+
+PostingOffsetIterator PostingOffsetTable::forLabel(
+        std::string_view labelKey) const {
+    // the first entry for every key is sampled, so the first sample with
+    // the key is the first entry with the key.
+    auto first = std::lower_bound(
+            samples.begin(),
+            samples.end(),
+            labelKey,
+            [](const Sample& s, std::string_view key) {
+                return s.labelKey < key;
+            });
+
+    if (first == samples.end() || first->labelKey != labelKey) {
+        return {offsetTableDec, 0};
+    }
+
+    // and so the first sample with a greater key is the first entry
+    // after all those with this key.
+    auto last = std::upper_bound(
+            first,
+            samples.end(),
+            labelKey,
+            [](std::string_view key, const Sample& s) {
+                return key < s.labelKey;
+            });
+
+    size_t endIdx = last == samples.end() ? entries : last->entryIdx;
+
+    auto dec = offsetTableDec;
+    dec.seek(first->position);
+    return {dec, endIdx - first->entryIdx};
+}
+
+std::shared_ptr<Index> loadIndex(const std::string& fname,
+                                 SeriesLoadMode mode,
+                                 bool populate) {
+    auto resource = map_file(fname, populate);
 
     auto index = std::make_shared<Index>();
-    index->load(resource);
+    index->load(resource, mode);
     return index;
 }
\ No newline at end of file
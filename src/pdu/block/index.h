@@ -1,13 +1,20 @@
 #pragma once
 
 #include "chunk_reference.h"
+#include "label_summary.h"
 #include "resource.h"
 #include "series_source.h"
+#include "symbol_dictionary.h"
 
+#include "posting_list.h"
 #include "posting_offset_iterator.h"
 
 #include <nlohmann/json_fwd.hpp>
+#include <atomic>
+#include <iterator>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
@@ -15,11 +22,48 @@
 
 class Decoder;
 
+/**
+ * Symbols stored in an index file.
+ *
+ * Symbols are not copied out of the index; they are looked up in the
+ * (mmapped) resource on demand. The returned views are valid as long as the
+ * resource is, which an Index holds for its lifetime.
+ */
 struct SymbolTable {
-    std::vector<std::string> symbols;
     std::string_view lookup(size_t index) const;
 
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+    ~SymbolTable();
+
+    /**
+     * Get the SymbolDictionary ID of the symbol at the given index.
+     *
+     * Symbols are only interned the first time they are needed, so loading
+     * an index does not copy every symbol into the dictionary. The table
+     * holds a reference to each symbol interned until it is destroyed, so
+     * series decoded from it need not hold their own.
+     */
+    SymbolDictionary::Id globalId(size_t index) const;
+
     void load(Decoder& dec);
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+private:
+    // release every symbol interned so far
+    void releaseIds();
+
+    // the symbol entries in the index
+    std::string_view data;
+    // offset of each symbol (length prefix) within data
+    std::vector<uint32_t> offsets;
+    // dictionary ID of each symbol, or Invalid if not yet interned. Lazily
+    // loaded series may be decoded concurrently, hence atomic.
+    mutable std::vector<std::atomic<SymbolDictionary::Id>> globalIds;
 };
 
 struct TOC {
@@ -33,8 +77,148 @@ struct TOC {
     void load(Decoder& dec);
 };
 
+/**
+ * The labels of a series, held as the SymbolDictionary IDs of each name and
+ * value, in name order. Series from different sources can then be checked
+ * for equality by integer comparisons.
+ *
+ * IDs are assigned in first-seen order, not label order (a process-wide
+ * order preserving numbering would need renumbering as symbols arrive), so
+ * ordering still compares the strings of the first differing label, and
+ * finding a label looks up names in the dictionary. Lookups do not lock,
+ * keeping both comparable in cost to a map of views.
+ *
+ * Labels added by ID are assumed to be held by the source of the series
+ * (e.g., the index symbol table), and must not outlive it. Labels added by
+ * name and value hold their own references, so remain valid however long
+ * the labels are kept.
+ *
+ * Read as a map from name to value, though views are looked up from the
+ * dictionary on each access.
+ */
+class SeriesLabels {
+public:
+    using Id = SymbolDictionary::Id;
+    // dictionary IDs of a label name and value
+    using LabelId = std::pair<Id, Id>;
+    using key_type = std::string_view;
+    using mapped_type = std::string_view;
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = SeriesLabels::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+
+        struct pointer {
+            const value_type* operator->() const {
+                return &value;
+            }
+            value_type value;
+        };
+
+        const_iterator() = default;
+        explicit const_iterator(std::vector<LabelId>::const_iterator itr)
+            : itr(itr) {
+        }
+
+        value_type operator*() const;
+        pointer operator->() const {
+            return {**this};
+        }
+
+        const_iterator& operator++() {
+            ++itr;
+            return *this;
+        }
+        const_iterator operator++(int) {
+            auto prev = *this;
+            ++itr;
+            return prev;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return itr == other.itr;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return itr != other.itr;
+        }
+
+        // dictionary IDs of the current label
+        const LabelId& ids() const {
+            return *itr;
+        }
+
+    private:
+        std::vector<LabelId>::const_iterator itr;
+    };
+    using iterator = const_iterator;
+
+    SeriesLabels() = default;
+    SeriesLabels(const SeriesLabels& other);
+    SeriesLabels(SeriesLabels&& other) noexcept;
+    SeriesLabels& operator=(const SeriesLabels& other);
+    SeriesLabels& operator=(SeriesLabels&& other) noexcept;
+    ~SeriesLabels();
+
+    /**
+     * Add a label held by the source of the series. Ignored if the series
+     * already has a label with the same name.
+     */
+    void add(LabelId ids);
+
+    /**
+     * Add a label, interning the name and value in the SymbolDictionary.
+     * Ignored if the series already has a label with the same name.
+     */
+    void add(std::string_view name, std::string_view value);
+
+    const_iterator begin() const {
+        return const_iterator(labels.begin());
+    }
+    const_iterator end() const {
+        return const_iterator(labels.end());
+    }
+
+    size_t size() const {
+        return labels.size();
+    }
+    bool empty() const {
+        return labels.empty();
+    }
+
+    const_iterator find(std::string_view name) const;
+
+    size_t count(std::string_view name) const {
+        return find(name) != end();
+    }
+
+    // throws std::out_of_range if there is no label with the given name
+    std::string_view at(std::string_view name) const;
+
+    const std::vector<LabelId>& ids() const {
+        return labels;
+    }
+
+private:
+    // acquire or release a reference to every label held
+    void acquireAll() const;
+    void releaseAll() const;
+
+    std::vector<LabelId> labels;
+    // whether references are held for each label
+    bool owning = false;
+};
+
+bool operator==(const SeriesLabels& a, const SeriesLabels& b);
+bool operator!=(const SeriesLabels& a, const SeriesLabels& b);
+
 struct Series {
-    std::map<std::string_view, std::string_view> labels;
+    using LabelId = SeriesLabels::LabelId;
+
+    SeriesLabels labels;
     std::vector<ChunkReference> chunks;
 
     using const_iterator = decltype(chunks)::const_iterator;
@@ -51,13 +235,23 @@ struct Series {
         return chunks.empty();
     }
 
+    /**
+     * Add a label to this series, interning the name and value in the
+     * SymbolDictionary. The views need not outlive the call.
+     */
+    void addLabel(std::string_view key, std::string_view value) {
+        labels.add(key, value);
+    }
+
     void load(Decoder& dec, const SymbolTable& symbols);
 };
 
 std::ostream& operator<<(std::ostream& os, const Series& s);
 
 // perform 3 way lexicographical compare on the labels from a pair of series
-// (i.e., in the style of strcmp, or C++ 20 <=>)
+// (i.e., in the style of strcmp, or C++ 20 <=>).
+// Labels with matching interned IDs are skipped without comparing strings;
+// only the first differing label is compared as strings.
 int8_t compare(const Series& a, const Series& b);
 
 inline bool operator<(const Series& a, const Series& b) {
@@ -68,32 +262,99 @@ inline bool operator>(const Series& a, const Series& b) {
     return compare(a, b) > 0;
 }
 
+enum class SeriesLoadMode {
+    // decode every series in the index when it is loaded
+    Eager,
+    // only record where each series is; decode them from the mapped index
+    // on demand
+    Lazy,
+};
+
+class SeriesTableIterator;
+
 struct SeriesTable {
-    std::map<uint64_t, Series> series;
-    using const_iterator = decltype(series)::const_iterator;
+    using value_type = std::pair<const uint64_t, Series>;
 
-    void load(Decoder& dec, const SymbolTable& symbols, size_t expectedEnd);
+    void load(Decoder& dec,
+              const SymbolTable& symbols,
+              size_t expectedEnd,
+              SeriesLoadMode mode = SeriesLoadMode::Eager);
 
-    auto begin() const {
-        return series.begin();
+    SeriesTableIterator begin() const;
+
+    EndSentinel end() const {
+        return {};
     }
 
-    auto end() const {
-        return series.end();
+    /**
+     * Get the series with the given ref.
+     *
+     * In lazy mode, the series will be decoded and kept for the lifetime of
+     * the table, so the returned reference remains valid. Prefer decode()
+     * when the series is only needed briefly.
+     */
+    const Series& at(uint64_t ref) const;
+
+    // decode a new copy of the series with the given ref from the index
+    Series decode(uint64_t ref) const;
+
+    bool contains(uint64_t ref) const;
+
+    size_t size() const {
+        return refs.size();
     }
 
-    const auto& at(uint64_t k) const {
-        return series.at(k);
+    bool isLazy() const {
+        return mode == SeriesLoadMode::Lazy;
     }
 
-    auto find(uint64_t k) const {
-        return series.find(k);
+    // sorted refs of every series in the table
+    const std::vector<uint32_t>& getRefs() const {
+        return refs;
     }
+
+private:
+    friend class SeriesTableIterator;
+
+    SeriesLoadMode mode = SeriesLoadMode::Eager;
+    // decoder over the whole index file; series refs are offsets into
+    // the file, divided by 16.
+    Decoder dec;
+    const SymbolTable* symbols = nullptr;
+    std::vector<uint32_t> refs;
+
+    // all series if eager, or series requested through at() if lazy.
+    mutable std::map<uint64_t, Series> series;
+    mutable std::mutex lazyMutex;
 };
 
-struct Posting {
-    Posting(Decoder dec);
-    std::set<size_t> seriesReferences;
+/**
+ * Iterator over every entry in a SeriesTable, in ref order.
+ *
+ * If the table is lazy, each series is decoded as it is reached, and is
+ * only valid until the iterator is advanced.
+ */
+class SeriesTableIterator
+    : public iterator_facade<SeriesTableIterator, SeriesTable::value_type> {
+public:
+    SeriesTableIterator(const SeriesTable& table);
+    SeriesTableIterator(const SeriesTableIterator& other);
+
+    void increment();
+
+    const SeriesTable::value_type& dereference() const;
+
+    bool is_end() const;
+
+private:
+    void update();
+
+    const SeriesTable& table;
+    // eager
+    std::map<uint64_t, Series>::const_iterator itr;
+    // lazy
+    size_t refIdx = 0;
+    std::optional<SeriesTable::value_type> current;
 };
 
 struct PostingOffsetTable {
@@ -104,10 +365,39 @@ struct PostingOffsetTable {
         return {};
     };
 
+    /**
+     * Iterate only the entries with the given label key.
+     *
+     * Uses the sampled entries to jump directly to the first entry for the
+     * key, rather than scanning the whole table.
+     */
+    PostingOffsetIterator forLabel(std::string_view labelKey) const;
+
+    // every distinct label key in the table, in sorted order
+    std::vector<std::string_view> labelKeys() const;
+
+    size_t size() const {
+        return entries;
+    }
+
 private:
+    // Like Prometheus, keep every Nth entry of the table in memory, plus
+    // the first entry for every label key. Entries are sorted by key then
+    // value, so the samples can be binary searched.
+    static constexpr size_t SampleInterval = 32;
+    struct Sample {
+        std::string_view labelKey;
+        std::string_view labelValue;
+        // index of the entry within the table
+        size_t entryIdx;
+        // position of the entry in the decoder
+        size_t position;
+    };
+
     uint32_t len;
     uint32_t entries;
     Decoder offsetTableDec;
+    std::vector<Sample> samples;
 };
 
 struct IndexMeta {
@@ -151,30 +441,63 @@ struct Index : public SeriesSource {
 
     IndexMeta meta;
 
+    // read from the sidecar file in the block directory if present and
+    // valid, built from the postings otherwise
+    LabelSummary labelSummary;
+
     // store mmapped chunk files on first access, as they are likely to be
     // used repeatedly.
     std::shared_ptr<ChunkFileCache> cache;
 
-    void load(std::shared_ptr<Resource> resource);
+    void load(std::shared_ptr<Resource> resource,
+              SeriesLoadMode mode = SeriesLoadMode::Eager);
+
+    PostingList getSeriesRefs(const PostingOffset& offset) const {
+        return PostingList::decode(resource->getDecoder().seek(offset.offset));
+    }
 
-    std::set<size_t> getSeriesRefs(const PostingOffset& offset) const {
-        Posting p(resource->getDecoder().seek(offset.offset));
-        return p.seriesReferences;
+    // number of series in the postings list, without decoding it
+    size_t getSeriesRefCount(const PostingOffset& offset) const {
+        return PostingList::decodeSize(
+                resource->getDecoder().seek(offset.offset));
     }
 
     const std::string& getDirectory() const {
         return resource->getDirectory();
     }
 
-    std::set<SeriesRef> getFilteredSeriesRefs(
+    /**
+     * Save the label summary to the block directory, so it need not be
+     * built when the block is next loaded.
+     */
+    void saveLabelSummary() const;
+
+    PostingList getFilteredSeriesRefs(
             const SeriesFilter& filter) const override;
 
     const Series& getSeries(SeriesRef ref) const override;
 
+    std::shared_ptr<const Series> getSeriesPtr(SeriesRef ref) const override;
+
     const std::shared_ptr<ChunkFileCache>& getCachePtr() const override;
 
+    /**
+     * Hint how the index file will be accessed from now on. Loading sets a
+     * suitable pattern for the SeriesLoadMode, but callers may know better
+     * (e.g., visiting every series of a lazily loaded index in order).
+     */
+    void advise(AccessPattern pattern) const;
+
 private:
     std::shared_ptr<Resource> resource;
 };
 
-std::shared_ptr<Index> loadIndex(const std::string& fname);
\ No newline at end of file
+/**
+ * Load the index at the given path.
+ *
+ * If @p populate is true, the whole index file is pre-faulted when mapped
+ * (MAP_POPULATE) rather than read in on demand.
+ */
+std::shared_ptr<Index> loadIndex(const std::string& fname,
+                                 SeriesLoadMode mode = SeriesLoadMode::Eager,
+                                 bool populate = false);
\ No newline at end of file
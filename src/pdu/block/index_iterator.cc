@@ -3,8 +3,11 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
-IndexIterator::IndexIterator(const boost::filesystem::path& path)
-    : path(path), dirIter(this->path) {
+#include <optional>
+
+IndexIterator::IndexIterator(const boost::filesystem::path& path,
+                             SeriesLoadMode mode)
+    : path(path), dirIter(this->path), mode(mode) {
     advanceToValidIndex();
 }
 
@@ -13,26 +16,47 @@ void IndexIterator::increment() {
     advanceToValidIndex();
 }
 
+namespace {
+/**
+ * Get the path of the index file in the given block directory, if the
+ * directory appears to be a complete block.
+ */
+std::optional<boost::filesystem::path> getBlockIndexFile(
+        const boost::filesystem::path& subdir) {
+    if (subdir.filename().string().find(".tmp") != std::string::npos) {
+        // this is a directory left over during compaction
+        // probably shouldn't read it as it may be partial
+        // and probably duplicates other data.
+        // may be
+        //  "XXX.tmp-for-deletion"
+        //  "XXX.tmp-for-creation"
+        // or the legacy
+        //  "XXX.tmp"
+        return {};
+    }
+    auto indexFile = subdir / "index";
+    if (boost::filesystem::is_regular_file(indexFile)) {
+        return indexFile;
+    }
+    return {};
+}
+} // namespace
+
+std::vector<boost::filesystem::path> findIndexFiles(
+        const boost::filesystem::path& dataDir) {
+    std::vector<boost::filesystem::path> indexFiles;
+    for (const auto& entry : boost::filesystem::directory_iterator(dataDir)) {
+        if (auto indexFile = getBlockIndexFile(entry.path())) {
+            indexFiles.push_back(std::move(*indexFile));
+        }
+    }
+    return indexFiles;
+}
+
 void IndexIterator::advanceToValidIndex() {
-    namespace fs = boost::filesystem;
     while (dirIter != end(dirIter)) {
-        const auto& file = *dirIter;
-        const auto& subdir = file.path();
-        if (subdir.filename().string().find(".tmp") != std::string::npos) {
-            ++dirIter;
-            // this is a directory left over during compaction
-            // probably shouldn't read it as it may be partial
-            // and probably duplicates other data.
-            // may be
-            //  "XXX.tmp-for-deletion"
-            //  "XXX.tmp-for-creation"
-            // or the legacy
-            //  "XXX.tmp"
-            continue;
-        }
-        const auto& indexFile = subdir / "index";
-        if (fs::is_regular_file(indexFile)) {
-            index = loadIndex(indexFile.string());
+        if (auto indexFile = getBlockIndexFile(dirIter->path())) {
+            index = loadIndex(indexFile->string(), mode);
             break;
         }
 
@@ -4,13 +4,23 @@
 #include "pdu/util/iterator_facade.h"
 
 #include <boost/filesystem.hpp>
+#include <vector>
+
+/**
+ * Find the index file of every block in a data directory, in directory
+ * iteration order (the same order IndexIterator visits them).
+ */
+std::vector<boost::filesystem::path> findIndexFiles(
+        const boost::filesystem::path& dataDir);
 
 class IndexIterator
     : public iterator_facade<IndexIterator, std::shared_ptr<Index>> {
 public:
-    IndexIterator(const boost::filesystem::path& path);
+    IndexIterator(const boost::filesystem::path& path,
+                  SeriesLoadMode mode = SeriesLoadMode::Eager);
 
-    IndexIterator(const IndexIterator& other) : dirIter(other.dirIter) {
+    IndexIterator(const IndexIterator& other)
+        : dirIter(other.dirIter), mode(other.mode) {
         advanceToValidIndex();
     }
 
@@ -30,4 +40,5 @@ private:
     std::shared_ptr<Index> index = nullptr;
     boost::filesystem::path path;
     boost::filesystem::directory_iterator dirIter;
+    SeriesLoadMode mode;
 };
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "label_summary.h"
+
+#include "index.h"
+
+#include "pdu/encode/decoder.h"
+#include "pdu/encode/encoder.h"
+#include "pdu/exceptions.h"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+constexpr uint32_t Magic = 0x50445553; // "PDUS"
+constexpr uint8_t Version = 1;
+
+constexpr std::string_view MetricName = "__name__";
+
+// FNV-1a. Must be stable across builds and platforms, as summaries may be
+// saved to disk.
+class Hasher {
+public:
+    Hasher& add(std::string_view str) {
+        for (unsigned char c : str) {
+            hash ^= c;
+            hash *= 0x100000001b3ull;
+        }
+        return *this;
+    }
+
+    Hasher& add(char c) {
+        return add(std::string_view(&c, 1));
+    }
+
+    uint64_t get() const {
+        return hash;
+    }
+
+private:
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+uint64_t hashLabel(std::string_view name) {
+    return Hasher().add('L').add(name).get();
+}
+
+uint64_t hashValue(std::string_view name, std::string_view value) {
+    return Hasher().add('V').add(name).add('\0').add(value).get();
+}
+
+// final mix from MurmurHash3, used to derive the second hash for double
+// hashing
+uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+} // namespace
+
+LabelSummary LabelSummary::build(const PostingOffsetTable& postings) {
+    // label names come from the sampled entries of the offset table, only
+    // the entries for __name__ need decoding.
+    auto names = postings.labelKeys();
+    std::vector<std::string_view> values;
+    for (const auto& po : postings.forLabel(MetricName)) {
+        values.push_back(po.labelValue);
+    }
+
+    LabelSummary summary;
+    size_t elements = std::max(size_t(1), names.size() + values.size());
+    summary.bits.assign((elements * BitsPerElement + 63) / 64, 0);
+    for (auto name : names) {
+        summary.insert(hashLabel(name));
+    }
+    for (auto value : values) {
+        summary.insert(hashValue(MetricName, value));
+    }
+    return summary;
+}
+
+std::optional<LabelSummary> LabelSummary::load(
+        const boost::filesystem::path& file, uint64_t indexSize) {
+    std::ifstream in(file.string(), std::ios::in | std::ios::binary);
+    if (!in.good()) {
+        return {};
+    }
+    std::string data{std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>()};
+
+    try {
+        Decoder dec(data);
+        if (dec.read_int<uint32_t>() != Magic ||
+            dec.read_int<uint8_t>() != Version ||
+            dec.read_int<uint64_t>() != indexSize) {
+            return {};
+        }
+        LabelSummary summary;
+        summary.hashCount = dec.read_int<uint8_t>();
+        auto words = dec.read_varuint();
+        if (summary.hashCount == 0 || words == 0 ||
+            words * sizeof(uint64_t) != dec.remaining()) {
+            return {};
+        }
+        summary.bits.resize(words);
+        for (auto& word : summary.bits) {
+            dec.read_int_to(word);
+        }
+        return summary;
+    } catch (const pdu::EOFError&) {
+        // truncated
+        return {};
+    }
+}
+
+void LabelSummary::save(const boost::filesystem::path& file,
+                        uint64_t indexSize) const {
+    namespace fs = boost::filesystem;
+    // write to a temporary file first, so a concurrent reader never sees
+    // a partially written summary
+    auto tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp.string(),
+                          std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good()) {
+            throw std::runtime_error("Failed to open \"" + tmp.string() +
+                                     "\" to save label summary");
+        }
+        Encoder enc(out);
+        enc.write_int(Magic);
+        enc.write_int(Version);
+        enc.write_int(indexSize);
+        enc.write_int(hashCount);
+        enc.write_varuint(bits.size());
+        for (auto word : bits) {
+            enc.write_int(word);
+        }
+        out.close();
+        if (!out.good()) {
+            throw std::runtime_error("Failed to write label summary to \"" +
+                                     tmp.string() + "\"");
+        }
+    }
+    fs::rename(tmp, file);
+}
+
+bool LabelSummary::mayContainLabel(std::string_view name) const {
+    return contains(hashLabel(name));
+}
+
+bool LabelSummary::mayContainValue(std::string_view name,
+                                   std::string_view value) const {
+    if (name != MetricName) {
+        return true;
+    }
+    return contains(hashValue(name, value));
+}
+
+void LabelSummary::insert(uint64_t hash) {
+    size_t bitCount = bits.size() * 64;
+    auto step = mix(hash) | 1;
+    for (uint8_t i = 0; i < hashCount; ++i, hash += step) {
+        auto bit = hash % bitCount;
+        bits[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool LabelSummary::contains(uint64_t hash) const {
+    if (empty()) {
+        return true;
+    }
+    size_t bitCount = bits.size() * 64;
+    auto step = mix(hash) | 1;
+    for (uint8_t i = 0; i < hashCount; ++i, hash += step) {
+        auto bit = hash % bitCount;
+        if (!(bits[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace boost::filesystem {
+class path;
+}
+
+struct PostingOffsetTable;
+
+/**
+ * Compact summary of the labels present in a block, allowing queries to
+ * skip blocks which cannot contain a matching series without decoding any
+ * postings.
+ *
+ * A Bloom filter over every label name, and every value of the metric name
+ * label (__name__). May report a label as present when it is not, but never
+ * the reverse. A default constructed summary reports everything as present.
+ */
+class LabelSummary {
+public:
+    // name of the sidecar file the summary may be saved to, in the block
+    // directory alongside the index
+    static constexpr const char* FileName = "pdu-label-summary";
+
+    static LabelSummary build(const PostingOffsetTable& postings);
+
+    /**
+     * Read a summary previously saved for an index file of the given size.
+     *
+     * Returns nothing if the file does not exist, is not a valid summary, or
+     * was saved for a different index; the caller should build it instead.
+     */
+    static std::optional<LabelSummary> load(
+            const boost::filesystem::path& file, uint64_t indexSize);
+
+    /**
+     * Write the summary to the given file, replacing it atomically if it
+     * already exists.
+     */
+    void save(const boost::filesystem::path& file, uint64_t indexSize) const;
+
+    bool mayContainLabel(std::string_view name) const;
+
+    /**
+     * Whether any series may have the given label value. Only values of
+     * __name__ are summarised; other labels are always assumed present.
+     */
+    bool mayContainValue(std::string_view name, std::string_view value) const;
+
+    bool empty() const {
+        return bits.empty();
+    }
+
+private:
+    void insert(uint64_t hash);
+    bool contains(uint64_t hash) const;
+
+    // ~1% false positive rate at 10 bits per element
+    static constexpr uint8_t DefaultHashCount = 7;
+    static constexpr size_t BitsPerElement = 10;
+
+    std::vector<uint64_t> bits;
+    uint8_t hashCount = DefaultHashCount;
+};
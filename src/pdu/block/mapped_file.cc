@@ -1,6 +1,7 @@
 #include "mapped_file.h"
 
 #include <boost/filesystem.hpp>
+#include <sys/mman.h>
 #include <exception>
 
 // implements the required interface for boost mapped_region to map
@@ -16,8 +17,44 @@ MappedFileResource::MappedFileResource(int fd) {
     loadMappable(MappableFD{fd});
 }
 
+void MappedFileResource::advise(AccessPattern pattern) {
+    if (data.empty()) {
+        // nothing mapped
+        return;
+    }
+    auto advice = mapped_region::advice_normal;
+    switch (pattern) {
+    case AccessPattern::Normal:
+        advice = mapped_region::advice_normal;
+        break;
+    case AccessPattern::Sequential:
+        advice = mapped_region::advice_sequential;
+        break;
+    case AccessPattern::Random:
+        advice = mapped_region::advice_random;
+        break;
+    case AccessPattern::WillNeed:
+        advice = mapped_region::advice_willneed;
+        break;
+    case AccessPattern::DontNeed:
+        advice = mapped_region::advice_dontneed;
+        break;
+    }
+    // purely a hint, failure is not an error
+    region.advise(advice);
+}
+
+map_options_t MappedFileResource::mapOptions(bool populate) {
+#ifdef MAP_POPULATE
+    if (populate) {
+        return MAP_POPULATE;
+    }
+#endif
+    return default_map_options;
+}
+
 MappedNamedFileResource::MappedNamedFileResource(
-        const boost::filesystem::path& fileName)
+        const boost::filesystem::path& fileName, bool populate)
     : directory(fileName.parent_path().string()) {
     if (boost::filesystem::is_empty(fileName)) {
         // nothing in the file, mapping will fail.
@@ -25,7 +62,7 @@ MappedNamedFileResource::MappedNamedFileResource(
     }
     file_mapping mappedFile = {fileName.c_str(), read_only};
 
-    loadMappable(mappedFile);
+    loadMappable(mappedFile, populate);
 }
 
 std::shared_ptr<Resource> try_map_fd(int fd) {
@@ -36,10 +73,12 @@ std::shared_ptr<Resource> try_map_fd(int fd) {
     }
 }
 
-std::shared_ptr<Resource> map_file(const std::string& fileName) {
-    return std::make_shared<MappedNamedFileResource>(fileName);
+std::shared_ptr<Resource> map_file(const std::string& fileName,
+                                   bool populate) {
+    return std::make_shared<MappedNamedFileResource>(fileName, populate);
 }
 
-std::shared_ptr<Resource> map_file(const boost::filesystem::path& fileName) {
-    return std::make_shared<MappedNamedFileResource>(fileName);
+std::shared_ptr<Resource> map_file(const boost::filesystem::path& fileName,
+                                   bool populate) {
+    return std::make_shared<MappedNamedFileResource>(fileName, populate);
 }
\ No newline at end of file
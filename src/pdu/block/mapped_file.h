@@ -24,6 +24,8 @@ struct MappedFileResource : public Resource {
     MappedFileResource() = default;
     MappedFileResource(int fd);
 
+    void advise(AccessPattern pattern) override;
+
     Decoder getDecoder() const override {
         return {data};
     }
@@ -42,10 +44,14 @@ struct MappedFileResource : public Resource {
     }
 
 protected:
+    /**
+     * @param populate if true, pre-fault the whole mapping (MAP_POPULATE,
+     *        where supported) rather than faulting pages in on access.
+     */
     template <class MemoryMappable>
-    void loadMappable(const MemoryMappable& mm) {
+    void loadMappable(const MemoryMappable& mm, bool populate = false) {
         // Map the whole file with read permissions
-        region = {mm, read_only};
+        region = {mm, read_only, 0, 0, nullptr, mapOptions(populate)};
 
         // Get the address of the mapped region
         void* addr = region.get_address();
@@ -54,12 +60,15 @@ protected:
         data = {static_cast<char*>(addr), size};
     }
 
+    static map_options_t mapOptions(bool populate);
+
     mapped_region region;
     std::string_view data;
 };
 
 struct MappedNamedFileResource : public MappedFileResource {
-    MappedNamedFileResource(const boost::filesystem::path& fileName);
+    MappedNamedFileResource(const boost::filesystem::path& fileName,
+                            bool populate = false);
 
     const std::string& getDirectory() const override {
         return directory;
@@ -70,5 +79,7 @@ protected:
 };
 
 std::shared_ptr<Resource> try_map_fd(int fd);
-std::shared_ptr<Resource> map_file(const std::string& fileName);
-std::shared_ptr<Resource> map_file(const boost::filesystem::path& fileName);
\ No newline at end of file
+std::shared_ptr<Resource> map_file(const std::string& fileName,
+                                   bool populate = false);
+std::shared_ptr<Resource> map_file(const boost::filesystem::path& fileName,
+                                   bool populate = false);
\ No newline at end of file
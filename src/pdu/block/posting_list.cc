@@ -0,0 +1,180 @@
+#include "posting_list.h"
+
+#include "pdu/encode/decoder.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+uint32_t readBigEndian32(const char* data) {
+    auto* bytes = reinterpret_cast<const uint8_t*>(data);
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+using RefItr = std::vector<PostingList::value_type>::const_iterator;
+
+/**
+ * Find the first element in [first, last) not less than value, searching
+ * exponentially further from first.
+ *
+ * Cheap when the target is expected to be close to first, as it is when
+ * intersecting a small list with a large one.
+ */
+RefItr gallop(RefItr first, RefItr last, PostingList::value_type value) {
+    size_t step = 1;
+    auto lower = first;
+    while (lower + step < last && *(lower + step) < value) {
+        lower += step;
+        step *= 2;
+    }
+    auto upper = std::min(lower + step + 1, last);
+    return std::lower_bound(lower, upper, value);
+}
+} // namespace
+
+PostingList PostingList::decode(Decoder dec) {
+    dec.read_int<uint32_t>(); // len
+    auto entries = dec.read_int<uint32_t>();
+
+    auto data = dec.read_view(entries * sizeof(uint32_t));
+
+    std::vector<value_type> refs(entries);
+    for (size_t i = 0; i < entries; ++i) {
+        refs[i] = readBigEndian32(data.data() + i * sizeof(uint32_t));
+    }
+    return PostingList(std::move(refs));
+}
+
+size_t PostingList::decodeSize(Decoder dec) {
+    dec.read_int<uint32_t>(); // len
+    return dec.read_int<uint32_t>();
+}
+
+PostingList difference(const PostingList& a, const PostingList& b) {
+    std::vector<PostingList::value_type> result;
+    result.reserve(a.size());
+    std::set_difference(a.begin(),
+                        a.end(),
+                        b.begin(),
+                        b.end(),
+                        std::back_inserter(result));
+    return PostingList(std::move(result));
+}
+
+PostingList intersect(const PostingList& a, const PostingList& b) {
+    const auto& small = a.size() <= b.size() ? a : b;
+    const auto& large = a.size() <= b.size() ? b : a;
+
+    if (small.empty()) {
+        return {};
+    }
+
+    std::vector<PostingList::value_type> result;
+
+    // Linear merging does work proportional to the size of both lists;
+    // for skewed lists, searching for each element of the smaller list
+    // is cheaper.
+    constexpr size_t gallopRatio = 16;
+    if (large.size() / small.size() < gallopRatio) {
+        result.reserve(small.size());
+        std::set_intersection(small.begin(),
+                              small.end(),
+                              large.begin(),
+                              large.end(),
+                              std::back_inserter(result));
+        return PostingList(std::move(result));
+    }
+
+    auto itr = large.begin();
+    for (auto ref : small) {
+        itr = gallop(itr, large.end(), ref);
+        if (itr == large.end()) {
+            break;
+        }
+        if (*itr == ref) {
+            result.push_back(ref);
+        }
+    }
+    return PostingList(std::move(result));
+}
+
+PostingList intersect(std::vector<PostingList> lists) {
+    if (lists.empty()) {
+        return {};
+    }
+
+    std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) {
+        return a.size() < b.size();
+    });
+
+    auto result = std::move(lists.front());
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+        result = intersect(result, lists[i]);
+    }
+    return result;
+}
+
+PostingList unite(std::vector<PostingList> lists) {
+    lists.erase(std::remove_if(lists.begin(),
+                               lists.end(),
+                               [](const auto& list) { return list.empty(); }),
+                lists.end());
+
+    if (lists.empty()) {
+        return {};
+    }
+    if (lists.size() == 1) {
+        return std::move(lists.front());
+    }
+
+    size_t total = 0;
+    PostingList::value_type maxRef = 0;
+    for (const auto& list : lists) {
+        total += list.size();
+        maxRef = std::max(maxRef, list.values().back());
+    }
+
+    std::vector<PostingList::value_type> result;
+
+    if (lists.size() == 2) {
+        result.reserve(total);
+        std::set_union(lists[0].begin(),
+                       lists[0].end(),
+                       lists[1].begin(),
+                       lists[1].end(),
+                       std::back_inserter(result));
+        return PostingList(std::move(result));
+    }
+
+    // A bitmap costs one bit per possible ref, setting and scanning it is
+    // linear. Only worth it if enough of the bits will be set.
+    constexpr size_t bitsPerWord = 64;
+    if (total >= maxRef / bitsPerWord) {
+        std::vector<uint64_t> bitmap(maxRef / bitsPerWord + 1);
+        for (const auto& list : lists) {
+            for (auto ref : list) {
+                bitmap[ref / bitsPerWord] |= uint64_t(1) << (ref % bitsPerWord);
+            }
+        }
+        result.reserve(total);
+        for (size_t word = 0; word < bitmap.size(); ++word) {
+            auto bits = bitmap[word];
+            while (bits) {
+                auto bit = __builtin_ctzll(bits);
+                result.push_back(word * bitsPerWord + bit);
+                // clear lowest set bit
+                bits &= bits - 1;
+            }
+        }
+        return PostingList(std::move(result));
+    }
+
+    result.reserve(total);
+    for (const auto& list : lists) {
+        result.insert(result.end(), list.begin(), list.end());
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return PostingList(std::move(result));
+}
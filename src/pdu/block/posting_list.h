@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Decoder;
+
+/**
+ * Sorted, de-duplicated list of series references.
+ *
+ * Replaces node based sets when collecting postings; lists are decoded
+ * directly from the index into contiguous storage, and combined with
+ * union/intersection kernels which exploit the ordering.
+ */
+class PostingList {
+public:
+    using value_type = size_t;
+    using const_iterator = std::vector<value_type>::const_iterator;
+
+    PostingList() = default;
+    /**
+     * Construct from refs which are already sorted and unique.
+     */
+    explicit PostingList(std::vector<value_type> refs) : refs(std::move(refs)) {
+    }
+
+    /**
+     * Decode a postings list from an index.
+     *
+     * The decoder should point to the start of the postings entry (the
+     * length field), as referenced by the postings offset table.
+     */
+    static PostingList decode(Decoder dec);
+
+    /**
+     * Read only the number of refs in a postings list, from the same
+     * position as decode().
+     */
+    static size_t decodeSize(Decoder dec);
+
+    const_iterator begin() const {
+        return refs.begin();
+    }
+
+    const_iterator end() const {
+        return refs.end();
+    }
+
+    value_type operator[](size_t idx) const {
+        return refs[idx];
+    }
+
+    size_t size() const {
+        return refs.size();
+    }
+
+    bool empty() const {
+        return refs.empty();
+    }
+
+    const std::vector<value_type>& values() const {
+        return refs;
+    }
+
+    // append a ref, which must be greater than any already present.
+    void push_back(value_type ref) {
+        refs.push_back(ref);
+    }
+
+    bool operator==(const PostingList& other) const {
+        return refs == other.refs;
+    }
+
+    bool operator!=(const PostingList& other) const {
+        return !(*this == other);
+    }
+
+private:
+    std::vector<value_type> refs;
+};
+
+/**
+ * Find the refs present in both lists.
+ *
+ * If one list is much smaller than the other, the larger list is searched
+ * by galloping (exponential search) rather than stepped through linearly.
+ */
+PostingList intersect(const PostingList& a, const PostingList& b);
+
+/**
+ * Find the refs present in every list.
+ *
+ * Lists are intersected smallest first, stopping early if the result
+ * becomes empty. An empty input produces an empty result.
+ */
+PostingList intersect(std::vector<PostingList> lists);
+
+/**
+ * Find the refs present in @p a but not in @p b.
+ */
+PostingList difference(const PostingList& a, const PostingList& b);
+
+/**
+ * Find the refs present in any list.
+ *
+ * Dense unions are accumulated in a bitmap over the ref range, sparse ones
+ * by sorting the concatenated lists.
+ */
+PostingList unite(std::vector<PostingList> lists);
@@ -6,6 +6,20 @@ namespace boost::filesystem {
 class path;
 }
 
+// How a resource is expected to be accessed, allowing e.g., a mapped file to
+// adjust kernel readahead. Mirrors madvise.
+enum class AccessPattern {
+    Normal,
+    // read front to back; read ahead aggressively
+    Sequential,
+    // point lookups; avoid reading neighbouring pages
+    Random,
+    // will be needed soon; start reading it in
+    WillNeed,
+    // not needed again soon; pages may be dropped
+    DontNeed,
+};
+
 // Abstract type for a resource able to return a Decoder on demand.
 // Subclasses handle e.g., a mapped file.
 // An Index holds a provided Resource for it's lifetime.
@@ -21,6 +35,13 @@ struct Resource {
 
     virtual bool empty() const = 0;
 
+    /**
+     * Hint how this resource will be accessed. Only meaningful for
+     * resources backed by a mapping, no-op otherwise.
+     */
+    virtual void advise(AccessPattern) {
+    }
+
     virtual ~Resource();
 };
 
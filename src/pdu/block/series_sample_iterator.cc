@@ -2,39 +2,82 @@
 
 #include "pdu/block/chunk_file_cache.h"
 
+#include <algorithm>
+#include <limits>
+
 SeriesSampleIterator::SeriesSampleIterator(
         std::shared_ptr<const Series> seriesPtr,
-        std::shared_ptr<ChunkFileCache> cfc)
-    : series(std::move(seriesPtr)), cfc(std::move(cfc)) {
+        std::shared_ptr<ChunkFileCache> cfc,
+        TimeRange range)
+    : series(std::move(seriesPtr)), cfc(std::move(cfc)), range(range) {
     itr = series->begin();
-    if (itr != series->end()) {
-        cv = ChunkView(*this->cfc, *itr);
-        sampleItr = cv.samples();
-    }
+    loadChunk();
+    skipOutOfRange();
 }
 
 SeriesSampleIterator::SeriesSampleIterator(const SeriesSampleIterator& other) {
     series = other.series;
     itr = other.itr;
     cfc = other.cfc;
+    range = other.range;
     if (itr != series->end()) {
         cv = ChunkView(*cfc, *itr);
         sampleItr = cv.samples();
+        skipOutOfRange();
     }
 }
 
 void SeriesSampleIterator::increment() {
     ++sampleItr;
-    while (sampleItr == end(sampleItr)) {
+    skipOutOfRange();
+}
+
+void SeriesSampleIterator::loadChunk() {
+    while (itr != series->end() && !range.overlaps(*itr)) {
         ++itr;
-        if (itr == series->end()) {
-            return;
-        }
+    }
+    if (itr != series->end()) {
         cv = ChunkView(*cfc, *itr);
         sampleItr = cv.samples();
     }
 }
 
+void SeriesSampleIterator::skipOutOfRange() {
+    while (itr != series->end()) {
+        if (sampleItr == end(sampleItr)) {
+            ++itr;
+            loadChunk();
+        } else if (sampleItr->timestamp < range.minTime) {
+            ++sampleItr;
+        } else if (sampleItr->timestamp > range.maxTime) {
+            // samples within a chunk are ordered, nothing more of interest
+            // in this chunk
+            ++itr;
+            loadChunk();
+        } else {
+            return;
+        }
+    }
+}
+
+void SeriesSampleIterator::readAll(std::vector<Sample>& samples) {
+    while (itr != series->end()) {
+        if (sampleItr.atFirstSample() &&
+            range.contains(int64_t(itr->minTime), int64_t(itr->maxTime))) {
+            // every sample in this chunk is wanted
+            auto offset = samples.size();
+            samples.resize(offset + cv.numSamples());
+            cv.decode(samples.data() + offset, cv.numSamples());
+            ++itr;
+            loadChunk();
+            skipOutOfRange();
+            continue;
+        }
+        samples.push_back(*sampleItr);
+        increment();
+    }
+}
+
 size_t SeriesSampleIterator::getNumSamples() const {
     if (!series) {
         throw std::runtime_error(
@@ -42,8 +85,34 @@ size_t SeriesSampleIterator::getNumSamples() const {
     }
     size_t total = 0;
     for (const auto& cr : *series) {
-        total += ChunkView(*cfc, cr).sampleCount;
+        if (!range.overlaps(cr)) {
+            continue;
+        }
+        ChunkView cv(*cfc, cr);
+        if (range.contains(int64_t(cr.minTime), int64_t(cr.maxTime))) {
+            total += cv.sampleCount;
+            continue;
+        }
+        // chunk straddles the edge of the range, count individually
+        for (const auto& sample : cv.samples()) {
+            total += range.contains(sample.timestamp);
+        }
     }
 
     return total;
 }
+
+TimeRange SeriesSampleIterator::getTimeBounds() const {
+    TimeRange bounds{std::numeric_limits<int64_t>::max(),
+                     std::numeric_limits<int64_t>::min()};
+    for (auto cr = itr; cr != series->end(); ++cr) {
+        if (!range.overlaps(*cr)) {
+            continue;
+        }
+        bounds.minTime = std::min(bounds.minTime, int64_t(cr->minTime));
+        bounds.maxTime = std::max(bounds.maxTime, int64_t(cr->maxTime));
+    }
+    bounds.minTime = std::max(bounds.minTime, range.minTime);
+    bounds.maxTime = std::min(bounds.maxTime, range.maxTime);
+    return bounds;
+}
@@ -2,10 +2,12 @@
 
 #include "pdu/block/chunk_view.h"
 #include "pdu/block/index.h"
+#include "pdu/block/time_range.h"
 #include "pdu/serialisation/serialisation_impl_fwd.h"
 #include "pdu/util/iterator_facade.h"
 
 #include <memory>
+#include <vector>
 
 // forward decl
 class ChunkFileCache;
@@ -15,8 +17,14 @@ class SeriesSampleIterator
     : public iterator_facade<SeriesSampleIterator, SampleInfo> {
 public:
     SeriesSampleIterator() = default;
+    /**
+     * Iterate the samples of a series, optionally only those within the
+     * given time range. Chunks entirely outside the range are skipped
+     * without being read.
+     */
     SeriesSampleIterator(std::shared_ptr<const Series> series,
-                         std::shared_ptr<ChunkFileCache> cfc);
+                         std::shared_ptr<ChunkFileCache> cfc,
+                         TimeRange range = {});
     SeriesSampleIterator(const SeriesSampleIterator& other);
 
     void increment();
@@ -30,7 +38,26 @@ public:
 
     size_t getNumSamples() const;
 
+    /**
+     * Get the span of time covered by the remaining chunks which overlap the
+     * range, clamped to the range. Taken from the chunk references, no
+     * chunks are read.
+     */
+    TimeRange getTimeBounds() const;
+
+    /**
+     * Append all remaining samples to @p samples, leaving this iterator at
+     * the end. Whole chunks are bulk decoded where possible.
+     */
+    void readAll(std::vector<Sample>& samples);
+
 private:
+    // starting from the chunk at itr, find the next chunk which overlaps
+    // the range and start reading it
+    void loadChunk();
+    // advance to the next sample within the range, if any
+    void skipOutOfRange();
+
     friend void pdu::detail::serialise_impl(Encoder& e,
                                             const SeriesSampleIterator& ssi);
     // needs friendship to count up chunks
@@ -41,6 +68,7 @@ private:
     Series::const_iterator itr;
 
     std::shared_ptr<ChunkFileCache> cfc;
+    TimeRange range;
     ChunkView cv;
     SampleIterator sampleItr;
 };
\ No newline at end of file
@@ -1,21 +1,36 @@
 #pragma once
 
+#include "posting_list.h"
+
 #include <cstdint>
 #include <memory>
-#include <set>
 
 class SeriesFilter;
 class ChunkFileCache;
 class Series;
 
-class SeriesSource {
+class SeriesSource : public std::enable_shared_from_this<SeriesSource> {
 public:
-    using SeriesRef = size_t;
-    virtual std::set<SeriesRef> getFilteredSeriesRefs(
+    using SeriesRef = PostingList::value_type;
+
+    virtual ~SeriesSource() = default;
+
+    virtual PostingList getFilteredSeriesRefs(
             const SeriesFilter& filter) const = 0;
 
     virtual const Series& getSeries(SeriesRef ref) const = 0;
 
+    /**
+     * Get a series which shares ownership with this source, extending the
+     * life of the source until there are no users of the series.
+     *
+     * Sources which decode series on demand may return a new copy of the
+     * series on each call.
+     */
+    virtual std::shared_ptr<const Series> getSeriesPtr(SeriesRef ref) const {
+        return {shared_from_this(), &getSeries(ref)};
+    }
+
     virtual const std::shared_ptr<ChunkFileCache>& getCachePtr() const = 0;
 
     ChunkFileCache& getCache() const {
@@ -0,0 +1,117 @@
+#include "symbol_dictionary.h"
+
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+SymbolDictionary& SymbolDictionary::instance() {
+    // never destroyed, as symbols may still be released by other statics
+    // (e.g., data held by Python) during shutdown
+    static auto* dictionary = new SymbolDictionary;
+    return *dictionary;
+}
+
+SymbolDictionary::~SymbolDictionary() {
+    for (auto& block : blocks) {
+        delete[] block.load();
+    }
+}
+
+SymbolDictionary::Id SymbolDictionary::acquire(std::string_view symbol) {
+    {
+        // most symbols will already be held, e.g., by another block
+        std::shared_lock lock(mutex);
+        if (auto itr = ids.find(symbol); itr != ids.end()) {
+            // the entry may be about to be freed, having no references.
+            // release() checks again once it has the exclusive lock.
+            find(itr->second)->refs.fetch_add(1, std::memory_order_relaxed);
+            return itr->second;
+        }
+    }
+
+    std::unique_lock lock(mutex);
+    // may have been interned since the shared lock was released
+    if (auto itr = ids.find(symbol); itr != ids.end()) {
+        find(itr->second)->refs.fetch_add(1, std::memory_order_relaxed);
+        return itr->second;
+    }
+
+    Id id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        if (nextId == std::numeric_limits<Id>::max()) {
+            throw std::length_error("SymbolDictionary: out of symbol ids");
+        }
+        id = nextId++;
+        size_t index = id - 1 + FirstBlockSize;
+        size_t block = 63 - __builtin_clzll(index) - FirstBlockBits;
+        if (!blocks[block].load(std::memory_order_relaxed)) {
+            blocks[block].store(new Entry[FirstBlockSize << block],
+                                std::memory_order_release);
+        }
+    }
+
+    auto& entry = *find(id);
+    entry.symbol = symbol;
+    entry.refs.store(1, std::memory_order_relaxed);
+    entry.live = true;
+    ids.emplace(entry.symbol, id);
+    return id;
+}
+
+void SymbolDictionary::acquire(Id id) {
+    auto* entry = find(id);
+    if (!entry) {
+        throwUnknownId();
+    }
+    entry->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SymbolDictionary::release(Id id) {
+    auto* entry = find(id);
+    if (!entry) {
+        throwUnknownId();
+    }
+    if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    std::unique_lock lock(mutex);
+    // the symbol may have been acquired again by name since, or already
+    // freed by another release which raced with such an acquire.
+    if (entry->refs.load(std::memory_order_relaxed) != 0 || !entry->live) {
+        return;
+    }
+    ids.erase(entry->symbol);
+    std::string().swap(entry->symbol);
+    entry->live = false;
+    freeIds.push_back(id);
+}
+
+size_t SymbolDictionary::size() const {
+    std::shared_lock lock(mutex);
+    return ids.size();
+}
+
+void SymbolDictionary::throwUnknownId() {
+    throw std::domain_error("SymbolDictionary: unknown symbol id");
+}
+
+SymbolRefs::~SymbolRefs() {
+    auto& dict = SymbolDictionary::instance();
+    for (const auto& [symbol, id] : held) {
+        dict.release(id);
+    }
+}
+
+SymbolDictionary::Id SymbolRefs::acquire(std::string_view symbol) {
+    if (auto itr = held.find(symbol); itr != held.end()) {
+        return itr->second;
+    }
+    auto& dict = SymbolDictionary::instance();
+    auto id = dict.acquire(symbol);
+    held.emplace(dict.lookup(id), id);
+    return id;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Process-wide interning of label names and values.
+ *
+ * Every distinct symbol in use by any block, the head or a deserialised
+ * series is assigned a small integer ID, so label equality across sources
+ * can be checked by comparing IDs rather than strings.
+ *
+ * The dictionary owns a copy of each symbol, and counts references to it.
+ * Once the last reference is released the symbol is freed, and its ID may
+ * later be reused for another symbol. Sources usually hold one reference
+ * per distinct symbol on behalf of all their series (see SymbolRefs),
+ * rather than each series holding its own.
+ */
+class SymbolDictionary {
+public:
+    using Id = uint32_t;
+
+    // never assigned to a symbol, may be used to mark "not yet interned"
+    static constexpr Id Invalid = 0;
+
+    static SymbolDictionary& instance();
+
+    ~SymbolDictionary();
+
+    /**
+     * Get the ID of the provided symbol, assigning it one if it is not
+     * currently held, and add a reference to it.
+     */
+    Id acquire(std::string_view symbol);
+
+    // add a reference to a symbol the caller already holds
+    void acquire(Id id);
+
+    void release(Id id);
+
+    /**
+     * Get the symbol with the given ID. The caller must hold a reference
+     * to it; the view is valid until that reference is released.
+     *
+     * Does not lock, so is cheap enough to use in place of storing views.
+     * Inline, as it is on the path of every label access.
+     */
+    std::string_view lookup(Id id) const {
+        auto* entry = find(id);
+        if (!entry) {
+            throwUnknownId();
+        }
+        return entry->symbol;
+    }
+
+    // number of symbols currently held
+    size_t size() const;
+
+private:
+    struct Entry {
+        std::string symbol;
+        std::atomic<uint32_t> refs = 0;
+        // false once freed, until the ID is reused
+        bool live = false;
+    };
+
+    Entry* find(Id id) const {
+        if (id == Invalid) {
+            return nullptr;
+        }
+        size_t index = id - 1 + FirstBlockSize;
+        size_t block = 63 - __builtin_clzll(index) - FirstBlockBits;
+        auto* entries = blocks[block].load(std::memory_order_acquire);
+        if (!entries) {
+            return nullptr;
+        }
+        return &entries[index - (FirstBlockSize << block)];
+    }
+
+    [[noreturn]] static void throwUnknownId();
+
+    // Entries are held in blocks which are never moved, so may be read
+    // without locking. Block i holds FirstBlockSize << i entries, so few
+    // blocks cover every possible ID.
+    static constexpr size_t FirstBlockBits = 10;
+    static constexpr size_t FirstBlockSize = size_t(1) << FirstBlockBits;
+    static constexpr size_t MaxBlocks = 32 - FirstBlockBits + 1;
+
+    mutable std::shared_mutex mutex;
+    std::array<std::atomic<Entry*>, MaxBlocks> blocks{};
+    // one past the highest ID assigned so far
+    Id nextId = 1;
+    // IDs of freed symbols, to be reused
+    std::vector<Id> freeIds;
+    // views of the symbols held in entries
+    std::unordered_map<std::string_view, Id> ids;
+};
+
+/**
+ * References to dictionary symbols held on behalf of a source of series,
+ * e.g., the head. Each distinct symbol is acquired once, however many
+ * series use it, and all are released on destruction.
+ *
+ * Not safe for concurrent use.
+ */
+class SymbolRefs {
+public:
+    SymbolRefs() = default;
+    SymbolRefs(const SymbolRefs&) = delete;
+    SymbolRefs& operator=(const SymbolRefs&) = delete;
+    ~SymbolRefs();
+
+    /**
+     * Get the dictionary ID of @p symbol, acquiring it if it is not
+     * already held.
+     */
+    SymbolDictionary::Id acquire(std::string_view symbol);
+
+    // number of distinct symbols held
+    size_t size() const {
+        return held.size();
+    }
+
+private:
+    // keys view the symbols in the dictionary, valid while held
+    std::unordered_map<std::string_view, SymbolDictionary::Id> held;
+};
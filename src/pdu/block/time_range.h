@@ -0,0 +1,38 @@
+#pragma once
+
+#include "chunk_reference.h"
+
+#include <cstdint>
+#include <limits>
+
+/**
+ * Inclusive range of sample timestamps (milliseconds since the epoch).
+ *
+ * Default constructed ranges are unbounded, and include every sample.
+ */
+struct TimeRange {
+    int64_t minTime = std::numeric_limits<int64_t>::min();
+    int64_t maxTime = std::numeric_limits<int64_t>::max();
+
+    bool unbounded() const {
+        return minTime == std::numeric_limits<int64_t>::min() &&
+               maxTime == std::numeric_limits<int64_t>::max();
+    }
+
+    bool contains(int64_t ts) const {
+        return minTime <= ts && ts <= maxTime;
+    }
+
+    bool contains(int64_t otherMin, int64_t otherMax) const {
+        return minTime <= otherMin && otherMax <= maxTime;
+    }
+
+    bool overlaps(int64_t otherMin, int64_t otherMax) const {
+        return minTime <= otherMax && otherMin <= maxTime;
+    }
+
+    bool overlaps(const ChunkReference& cr) const {
+        // chunk times are stored unsigned, but are really signed
+        return overlaps(int64_t(cr.minTime), int64_t(cr.maxTime));
+    }
+};
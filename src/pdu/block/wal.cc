@@ -1,15 +1,272 @@
 #include "wal.h"
 
+#include "chunk_view.h"
+#include "chunk_writer.h"
 #include "index.h"
 #include "mapped_file.h"
 #include "resource.h"
+#include "pdu/util/thread_pool.h"
 
 #include <boost/filesystem.hpp>
 
 #include <snappy.h>
+#include <algorithm>
+#include <deque>
+#include <future>
 #include <numeric>
 
-void WalLoader::load(const boost::filesystem::path& dataDir) {
+namespace {
+/**
+ * Decode a samples record, calling fn(ref, ts, value) for each sample.
+ */
+template <class Fn>
+void forEachSample(Decoder& dec, Fn&& fn) {
+    if (dec.empty()) {
+        return;
+    }
+    auto baseRef = dec.read_int<uint64_t>();
+    auto baseTs = int64_t(dec.read_int<uint64_t>());
+
+    while (!dec.empty()) {
+        // read deltas
+        auto dRef = dec.read_varint();
+        auto dTs = dec.read_varint();
+
+        auto valRaw = dec.read_int<uint64_t>();
+        double value = reinterpret_cast<double&>(valRaw);
+
+        fn(uint64_t(baseRef + dRef), int64_t(baseTs + dTs), value);
+    }
+}
+
+// A page aligned range of a WAL segment, starting at a record boundary.
+struct WalPiece {
+    Decoder dec;
+    // offset of the piece in its segment
+    size_t begin;
+    bool isLastFile;
+};
+
+// Records decoded from a single WalPiece, in WAL order.
+struct DecodedPiece {
+    // series records are applied as-is when merging, but need copying
+    // as the reader reuses its buffers.
+    std::vector<std::string> seriesRecords;
+    // samples between consecutive series records form a batch, stably
+    // sorted by series ref.
+    std::vector<WalSample> samples;
+    // batchEnds[i] is the end of the batch of samples preceding
+    // seriesRecords[i]
+    std::vector<size_t> batchEnds;
+    // offset in the piece following the last complete record
+    size_t end = 0;
+};
+
+bool startsRecord(char fragmentType) {
+    auto type = uint8_t(fragmentType) & ~Compressed;
+    return type != RecordMid && type != RecordEnd;
+}
+
+/**
+ * Split a segment into pieces of roughly pieceSize bytes.
+ *
+ * Fragments never cross page boundaries, so any page starting with
+ * anything but a mid or end fragment starts a new record. Prometheus
+ * does not let records span segments, so the segment end is a record
+ * boundary too; a record left incomplete there is rejected when decoded,
+ * as for a serial replay.
+ */
+void splitSegment(const Resource& segment,
+                  size_t pieceSize,
+                  bool isLastFile,
+                  std::vector<WalPiece>& pieces) {
+    auto data = segment.getView();
+    auto dec = segment.getDecoder();
+    size_t begin = 0;
+    while (begin < data.size()) {
+        auto end = begin + pieceSize;
+        while (end < data.size() && !startsRecord(data[end])) {
+            end += PageSize;
+        }
+        end = std::min(end, data.size());
+        pieces.push_back({dec.substr(begin, end - begin),
+                          begin,
+                          isLastFile && end == data.size()});
+        begin = end;
+    }
+}
+
+DecodedPiece decodePiece(WalPiece piece) {
+    DecodedPiece result;
+    WalRecordReader reader;
+    size_t batchStart = 0;
+    auto endBatch = [&] {
+        std::stable_sort(result.samples.begin() + batchStart,
+                         result.samples.end(),
+                         [](const auto& a, const auto& b) {
+                             return a.ref < b.ref;
+                         });
+        batchStart = result.samples.size();
+    };
+
+    while (!piece.dec.empty()) {
+        std::optional<std::string_view> record;
+        try {
+            record = reader.next(piece.dec, piece.isLastFile);
+        } catch (const std::logic_error&) {
+            // as in WalLoader::loadFile, the last file may end part way
+            // through a record still being written.
+            if (!piece.isLastFile || !piece.dec.empty() ||
+                !reader.inPartialRecord()) {
+                throw;
+            }
+            break;
+        }
+        if (reader.atRecordBoundary()) {
+            result.end = piece.dec.tell();
+        }
+        if (!record) {
+            continue;
+        }
+        Decoder dec(*record);
+        auto type = dec.read_int<uint8_t>();
+        switch (type) {
+        case 1:
+            // Series definitions
+            endBatch();
+            result.batchEnds.push_back(result.samples.size());
+            result.seriesRecords.emplace_back(*record);
+            break;
+        case 2:
+            // Samples
+            forEachSample(dec, [&](uint64_t ref, int64_t ts, double value) {
+                result.samples.push_back({ref, ts, value});
+            });
+            break;
+        case 3:
+            // Tombstone, ignore.
+            break;
+        default:
+            throw std::invalid_argument(
+                    "WAL: Record contains unknown record type: " +
+                    std::to_string(int(type)));
+        }
+        reader.clear();
+    }
+    endBatch();
+    return result;
+}
+} // namespace
+
+void WalLoader::load(const boost::filesystem::path& dataDir, size_t threads) {
+    auto walSegments = findSegments(dataDir);
+    position = {};
+    if (!walSegments.empty()) {
+        position.firstSegment = walSegments.front();
+    }
+
+    if (threads > 1) {
+        loadParallel(walSegments, threads);
+        return;
+    }
+
+    for (int i = 0; i < walSegments.size(); ++i) {
+        position.segment = walSegments[i];
+        position.offset = loadFile(walSegments[i], i == walSegments.size() - 1);
+    }
+}
+
+bool WalLoader::resume(const boost::filesystem::path& dataDir,
+                       const WalPosition& from) {
+    auto walSegments = findSegments(dataDir);
+    if (walSegments.empty() || from.firstSegment.empty()) {
+        // nothing to resume from, fine only if there's still nothing
+        return walSegments.empty() && from.firstSegment.empty();
+    }
+    if (walSegments.front() != from.firstSegment) {
+        // a new checkpoint was written, or old segments removed.
+        return false;
+    }
+    auto itr = std::find(walSegments.begin(), walSegments.end(), from.segment);
+    if (itr == walSegments.end() ||
+        boost::filesystem::file_size(from.segment) < from.offset) {
+        return false;
+    }
+
+    position = from;
+    reader.clear();
+    for (; itr != walSegments.end(); ++itr) {
+        auto offset = *itr == from.segment ? from.offset : 0;
+        position.segment = *itr;
+        position.offset = loadFile(*itr, itr + 1 == walSegments.end(), offset);
+    }
+    return true;
+}
+
+void WalLoader::loadParallel(const std::vector<std::string>& segments,
+                             size_t threads) {
+    std::vector<std::shared_ptr<Resource>> resources;
+    size_t totalSize = 0;
+    for (const auto& segment : segments) {
+        resources.push_back(map_file(segment));
+        resources.back()->advise(AccessPattern::Sequential);
+        totalSize += resources.back()->getView().size();
+    }
+
+    // aim for a few pieces per thread to even out the work, but never
+    // smaller than a page.
+    auto pieceSize = totalSize / (threads * 4);
+    pieceSize = std::max(PageSize, pieceSize - pieceSize % PageSize);
+
+    std::vector<WalPiece> pieces;
+    for (size_t i = 0; i < resources.size(); ++i) {
+        splitSegment(
+                *resources[i], pieceSize, i == resources.size() - 1, pieces);
+    }
+
+    // declared after the resources, so workers have finished with them
+    // before they are unmapped, even if a piece fails to decode.
+    ThreadPool pool(threads);
+    std::deque<std::future<DecodedPiece>> decoded;
+    auto nextPiece = pieces.begin();
+    // decoded samples are larger than their encoded form, so limit how far
+    // decoding may run ahead of merging.
+    auto submitUpTo = [&](size_t inFlight) {
+        while (decoded.size() < inFlight && nextPiece != pieces.end()) {
+            decoded.push_back(pool.submit(
+                    [piece = *nextPiece] { return decodePiece(piece); }));
+            ++nextPiece;
+        }
+    };
+    submitUpTo(threads * 2);
+
+    // merge in WAL order; later pieces continue decoding meanwhile.
+    // Series records may create series which samples in later batches
+    // refer to, so must be applied in order relative to the samples.
+    size_t lastPieceEnd = 0;
+    while (!decoded.empty()) {
+        auto piece = decoded.front().get();
+        decoded.pop_front();
+        lastPieceEnd = piece.end;
+        submitUpTo(threads * 2);
+        const auto* samples = piece.samples.data();
+        size_t batchStart = 0;
+        for (size_t i = 0; i < piece.seriesRecords.size(); ++i) {
+            addSamples(samples + batchStart, samples + piece.batchEnds[i]);
+            loadRecord(Decoder(piece.seriesRecords[i]));
+            batchStart = piece.batchEnds[i];
+        }
+        addSamples(samples + batchStart, samples + piece.samples.size());
+    }
+
+    position.segment = segments.empty() ? "" : segments.back();
+    if (!pieces.empty() && pieces.back().isLastFile) {
+        position.offset = pieces.back().begin + lastPieceEnd;
+    }
+}
+
+std::vector<std::string> WalLoader::findSegments(
+        const boost::filesystem::path& dataDir) const {
     auto walDir = dataDir / "wal";
     // no need for a resource cache, WAL segments are read once.
 
@@ -64,24 +321,48 @@ void WalLoader::load(const boost::filesystem::path& dataDir) {
         std::swap(walSegments, ckptSegments);
     }
 
-    for (int i = 0; i < walSegments.size(); ++i) {
-        loadFile(walSegments[i], i == walSegments.size() - 1);
-    }
+    return walSegments;
 }
 
-void WalLoader::loadFile(const boost::filesystem::path& file, bool isLast) {
+size_t WalLoader::loadFile(const boost::filesystem::path& file,
+                           bool isLast,
+                           size_t offset) {
     auto resource = map_file(file);
     if (resource->empty()) {
-        return;
+        return 0;
     }
     auto dec = resource->getDecoder();
+    dec.seek(offset);
     while (!dec.empty()) {
-        loadFragment(dec, isLast);
+        try {
+            loadFragment(dec, isLast);
+        } catch (const std::logic_error&) {
+            // the last file may still be being written, and end part way
+            // through a record. The record will be read in full on resume.
+            if (!isLast || !dec.empty() || !reader.inPartialRecord()) {
+                throw;
+            }
+            reader.clear();
+            break;
+        }
+        if (reader.atRecordBoundary()) {
+            offset = dec.tell();
+        }
     }
+    return offset;
 }
 
 void WalLoader::loadFragment(Decoder& dec, bool isLastFile) {
+    if (auto record = reader.next(dec, isLastFile)) {
+        loadRecord(Decoder(*record));
+        clear();
+    }
+}
+
+std::optional<std::string_view> WalRecordReader::next(Decoder& dec,
+                                                      bool isLastFile) {
     std::string_view record;
+    boundary = false;
 
     while (!dec.empty()) {
         auto type = dec.read_int<uint8_t>();
@@ -102,10 +383,12 @@ void WalLoader::loadFragment(Decoder& dec, bool isLastFile) {
                     throw std::logic_error(
                             "WAL: too few bytes left to read to page boundary");
                 }
+            } else {
+                boundary = true;
             }
             dec.seek(pos);
             clear();
-            return;
+            return {};
         }
 
         if (dec.remaining() < 6) {
@@ -113,7 +396,7 @@ void WalLoader::loadFragment(Decoder& dec, bool isLastFile) {
                 // this is the last block of the wal and may be incomplete
                 // skip the decoder to the end and treat this block as done
                 dec.read_view(dec.remaining());
-                return;
+                return {};
             } else {
                 throw std::logic_error("WAL: too few bytes for fragment meta");
             }
@@ -127,7 +410,7 @@ void WalLoader::loadFragment(Decoder& dec, bool isLastFile) {
                 // partial record, but that is okay for the end of the last
                 // file. discard.
                 dec.read_view(dec.remaining());
-                return;
+                return {};
             } else {
                 throw std::logic_error("WAL: too few bytes for fragment body");
             }
@@ -227,9 +510,8 @@ void WalLoader::loadFragment(Decoder& dec, bool isLastFile) {
                 decompressedBuffer.size());
     }
 
-    loadRecord(Decoder(record));
-
-    clear();
+    boundary = true;
+    return record;
 }
 
 void WalLoader::loadRecord(Decoder dec) {
@@ -263,87 +545,203 @@ void WalLoader::loadSeries(Decoder& dec) {
             auto key = addSymbol(dec.read_view(len));
             len = dec.read_varuint();
             auto value = addSymbol(dec.read_view(len));
-            series.labels.emplace(key, value);
+            series.labels.add({key, value});
         }
     }
 }
 
-InMemWalChunk::InMemWalChunk() {
-    // reserving space for at least 100 samples for this time series
-    // might be an overestimate, but probably better than
-    // reallocating too often.
-    data.reserve(100 * (sizeof(int64_t) + sizeof(double)));
+InMemWalChunk::InMemWalChunk(ChunkType type) : type(type) {
+    if (type != ChunkType::Raw && type != ChunkType::XORData) {
+        throw std::invalid_argument(
+                "InMemWalChunk: chunks must be Raw or XORData");
+    }
 }
 
 void InMemWalChunk::setMinTime(int64_t ts) {
+    if (empty()) {
+        minTime = ts;
+        return;
+    }
+    if (ts <= int64_t(minTime)) {
+        return;
+    }
     minTime = ts;
+
+    // samples already added before the new min time need dropping, e.g.,
+    // as a newer head chunk now holds them.
+    if (type == ChunkType::Raw) {
+        // samples are in time order, find the first to keep
+        constexpr size_t sampleSize = sizeof(int64_t) + sizeof(double);
+        // the dropped bytes may be viewed by copies, so are left in place
+        for (; rawBegin < rawEnd; rawBegin += sampleSize) {
+            int64_t sampleTs;
+            std::memcpy(&sampleTs,
+                        raw->bytes.get() + rawBegin,
+                        sizeof(sampleTs));
+            if (sampleTs >= ts) {
+                break;
+            }
+        }
+        return;
+    }
+
+    // XOR chunks can only be appended to; re-encode the samples kept.
+    auto resources = makeResources();
+    finished.clear();
+    current = {};
+    std::vector<Sample> samples;
+    for (const auto& [resource, ref] : resources) {
+        ChunkView cv(resource, 0, ref.type);
+        samples.resize(cv.numSamples());
+        cv.decode(samples.data(), samples.size());
+        for (const auto& sample : samples) {
+            addSample(sample.timestamp, sample.value);
+        }
+    }
 }
 void InMemWalChunk::addSample(int64_t ts, double value) {
     if (ts < minTime) {
         return;
     }
     maxTime = ts > maxTime ? ts : maxTime;
-    auto pos = data.size();
-    data.resize(pos + sizeof(int64_t) + sizeof(double));
 
-    std::memcpy(&data[pos], &ts, sizeof(ts));
-    std::memcpy(&data[pos + sizeof(ts)], &value, sizeof(value));
+    if (type == ChunkType::XORData) {
+        if (current.empty()) {
+            currentMinTime = ts;
+        }
+        currentMaxTime = ts;
+        current.append({ts, value});
+        if (current.size() == XORChunkSamples) {
+            finishXORChunk();
+        }
+        return;
+    }
+
+    appendRaw(ts, value);
+}
+
+void InMemWalChunk::appendRaw(int64_t ts, double value) {
+    constexpr size_t sampleSize = sizeof(int64_t) + sizeof(double);
+    auto end = rawEnd + sampleSize;
+    // claim the space following this chunk's samples. A copy of this
+    // chunk may have claimed it first, in which case this chunk needs a
+    // buffer of its own.
+    auto expected = rawEnd;
+    if (!raw || end > raw->capacity ||
+        !raw->used.compare_exchange_strong(expected, end)) {
+        auto size = rawEnd - rawBegin;
+        // start with space for 100 samples; might be an overestimate, but
+        // probably better than reallocating too often.
+        auto capacity = std::max(100 * sampleSize, 2 * (size + sampleSize));
+        auto buffer = std::make_shared<RawBuffer>(capacity);
+        if (size) {
+            std::memcpy(buffer->bytes.get(), raw->bytes.get() + rawBegin, size);
+        }
+        buffer->used = size + sampleSize;
+        raw = std::move(buffer);
+        rawBegin = 0;
+        rawEnd = size;
+        end = size + sampleSize;
+    }
+
+    auto* pos = raw->bytes.get() + rawEnd;
+    std::memcpy(pos, &ts, sizeof(ts));
+    std::memcpy(pos + sizeof(ts), &value, sizeof(value));
+    rawEnd = end;
 }
 
-std::pair<std::shared_ptr<Resource>, ChunkReference>
-InMemWalChunk::makeResource() const {
+void InMemWalChunk::finishXORChunk() {
+    ChunkReference ref;
+    ref.type = ChunkType::XORData;
+    ref.minTime = currentMinTime;
+    ref.maxTime = currentMaxTime;
+
+    auto chunk = current.release();
+    chunk.shrink_to_fit();
+    finished.emplace_back(std::make_shared<OwningMemResource>(std::move(chunk)),
+                          ref);
+}
+
+InMemWalChunk::ChunkResources InMemWalChunk::makeResources() const {
+    if (type == ChunkType::XORData) {
+        auto resources = finished;
+        if (!current.empty()) {
+            // the current chunk stays open, so later samples can still be
+            // added to it, e.g., on refresh. Copy what has been written so
+            // far, at most XORChunkSamples samples.
+            ChunkReference ref;
+            ref.type = ChunkType::XORData;
+            ref.minTime = currentMinTime;
+            ref.maxTime = currentMaxTime;
+            resources.emplace_back(std::make_shared<OwningMemResource>(
+                                           std::string(current.bytes())),
+                                   ref);
+        }
+        return resources;
+    }
+
     ChunkReference ref;
     ref.type = ChunkType::Raw;
     ref.minTime = minTime;
     ref.maxTime = maxTime;
 
-    auto resource = std::make_shared<MemResource>(
-            std::string_view((char*)data.data(), data.size()));
+    std::string_view samples;
+    if (raw) {
+        samples = {(const char*)raw->bytes.get() + rawBegin, rawEnd - rawBegin};
+    }
+    auto resource = std::make_shared<MemResource>(samples);
 
-    return {std::move(resource), std::move(ref)};
+    return {{std::move(resource), std::move(ref)}};
 }
 
-void WalLoader::loadSamples(Decoder& dec) {
-    if (dec.empty()) {
-        return;
+bool InMemWalChunk::empty() const {
+    if (type == ChunkType::XORData) {
+        return finished.empty() && current.empty();
     }
-    auto baseRef = dec.read_int<uint64_t>();
-    auto baseTs = int64_t(dec.read_int<uint64_t>());
-
-    while (!dec.empty()) {
-        // read deltas
-        auto dRef = dec.read_varint();
-        auto dTs = dec.read_varint();
-
-        auto valRaw = dec.read_int<uint64_t>();
-        double value = reinterpret_cast<double&>(valRaw);
+    return rawBegin == rawEnd;
+}
 
-        auto ref = uint64_t(baseRef + dRef);
-        auto ts = int64_t(baseTs + dTs);
+void WalLoader::loadSamples(Decoder& dec) {
+    forEachSample(dec, [this](uint64_t ref, int64_t ts, double value) {
+        if (auto* chunk = getWalChunk(ref)) {
+            chunk->addSample(ts, value);
+        }
+    });
+}
 
-        auto seriesItr = seriesMap.find(ref);
-        if (seriesItr == seriesMap.end()) {
-            continue;
+void WalLoader::addSamples(const WalSample* begin, const WalSample* end) {
+    while (begin != end) {
+        auto ref = begin->ref;
+        auto runEnd = std::find_if(
+                begin, end, [ref](const auto& s) { return s.ref != ref; });
+        if (auto* chunk = getWalChunk(ref)) {
+            for (; begin != runEnd; ++begin) {
+                chunk->addSample(begin->ts, begin->value);
+            }
         }
+        begin = runEnd;
+    }
+}
 
-        auto& headChunks = seriesItr->second.chunks;
+InMemWalChunk* WalLoader::getWalChunk(uint64_t ref) {
+    auto seriesItr = seriesMap.find(ref);
+    if (seriesItr == seriesMap.end()) {
+        return nullptr;
+    }
 
-        // if this is the first sample from the WAL for a given TS, set the
-        // min time so duplicate samples can be discarded (Head chunks and WAL
-        // may overlap)
-        if (walChunks.find(ref) == walChunks.end() && !headChunks.empty()) {
-            walChunks[ref].setMinTime(headChunks.back().maxTime + 1);
-        }
+    auto [chunk, inserted] = walChunks.try_emplace(ref, chunkType);
 
-        walChunks[ref].addSample(ts, value);
+    auto& headChunks = seriesItr->second->chunks;
+
+    // if this is the first sample from the WAL for a given TS, set the
+    // min time so duplicate samples can be discarded (Head chunks and WAL
+    // may overlap)
+    if (inserted && !headChunks.empty()) {
+        chunk->setMinTime(headChunks.back().maxTime + 1);
     }
+    return chunk;
 }
 
-std::string_view WalLoader::addSymbol(std::string_view sym) {
-    auto symbolItr = symbols.find(sym);
-    if (symbolItr == symbols.end()) {
-        auto res = symbols.insert(std::string(sym));
-        symbolItr = res.first;
-    }
-    return *symbolItr;
+SymbolDictionary::Id WalLoader::addSymbol(std::string_view sym) {
+    return symbols.acquire(sym);
 }
\ No newline at end of file
@@ -1,20 +1,23 @@
 #pragma once
 
+#include "chunk_reference.h"
+#include "chunk_writer.h"
+#include "index.h"
 #include "pdu/encode/decoder.h"
+#include "pdu/util/flat_ref_map.h"
 
+#include <atomic>
 #include <cstdint>
-#include <map>
 #include <memory>
-#include <set>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
 inline constexpr size_t PageSize = 32 * 1024;
 
 // forward decls
-class ChunkReference;
 class Resource;
-class Series;
 namespace boost::filesystem {
 class path;
 }
@@ -28,33 +31,108 @@ enum RecordType {
     Compressed = 0b1000
 };
 
+/**
+ * Samples for one series read from the WAL, held in memory.
+ *
+ * Samples are stored either as raw timestamp/value pairs (ChunkType::Raw),
+ * which is cheap to build, or XOR encoded as Prometheus would on disk
+ * (ChunkType::XORData), which is roughly a tenth of the size. XOR samples
+ * are cut into chunks of XORChunkSamples, as Prometheus cuts head chunks.
+ *
+ * Copies are cheap, sharing samples already added with the original; either
+ * may then add samples without affecting the other.
+ */
 class InMemWalChunk {
 public:
-    InMemWalChunk();
+    using ChunkResources =
+            std::vector<std::pair<std::shared_ptr<Resource>, ChunkReference>>;
 
+    static constexpr uint16_t XORChunkSamples = 120;
+
+    explicit InMemWalChunk(ChunkType type = ChunkType::Raw);
+
+    /**
+     * Discard samples before @p ts, including any already added.
+     */
     void setMinTime(int64_t ts);
     void addSample(int64_t ts, double value);
 
-    std::pair<std::shared_ptr<Resource>, ChunkReference> makeResource() const;
+    /**
+     * Get resources holding the samples added, and references to the
+     * chunks within them.
+     *
+     * Raw resources view the samples in place, and are invalidated by
+     * adding more samples to this chunk (but not to copies of it).
+     * Finished XOR chunks are shared, not copied; only the chunk still
+     * being written is.
+     */
+    ChunkResources makeResources() const;
 
-    bool empty() const {
-        return data.empty();
-    }
+    bool empty() const;
 
 private:
-    std::vector<uint8_t> data;
+    /**
+     * Storage for raw samples, shared by copies of a chunk. Each copy
+     * views its own range of it; bytes in that range never change, so a
+     * copy may append in place only if no other copy has appended past the
+     * end of its range already.
+     */
+    struct RawBuffer {
+        explicit RawBuffer(size_t capacity)
+            : bytes(new uint8_t[capacity]), capacity(capacity) {
+        }
+        std::unique_ptr<uint8_t[]> bytes;
+        const size_t capacity;
+        // end of the bytes written by any chunk sharing this buffer
+        std::atomic<size_t> used{0};
+    };
+
+    void appendRaw(int64_t ts, double value);
+    void finishXORChunk();
+
+    ChunkType type;
+    // raw samples, only used for ChunkType::Raw
+    std::shared_ptr<RawBuffer> raw;
+    size_t rawBegin = 0;
+    size_t rawEnd = 0;
     uint64_t minTime = 0;
     uint64_t maxTime = 0;
+
+    // the XOR chunk currently being written
+    XORAppender current;
+    int64_t currentMinTime = 0;
+    int64_t currentMaxTime = 0;
+    // XOR chunks which were filled
+    ChunkResources finished;
 };
 
-class WalLoader {
+/**
+ * Reassembles WAL records from their page fragments, decompressing them
+ * if required.
+ */
+class WalRecordReader {
 public:
-    WalLoader(std::map<size_t, Series>& series,
-              std::set<std::string, std::less<>>& symbols,
-              std::map<size_t, InMemWalChunk>& walChunks)
-        : seriesMap(series), symbols(symbols), walChunks(walChunks) {
+    /**
+     * Read fragments from @p dec until a whole record has been assembled.
+     *
+     * Returns nothing if the rest of the page was empty, or if the end of
+     * the last file was truncated. The returned view is valid until the
+     * next call to clear().
+     */
+    std::optional<std::string_view> next(Decoder& dec, bool isLastFile);
+
+    /**
+     * Whether the last call to next() left the decoder at a record
+     * boundary, i.e., it did not discard a truncated record.
+     */
+    bool atRecordBoundary() const {
+        return boundary;
+    }
+
+    // whether fragments of a record have been read, but not its end
+    bool inPartialRecord() const {
+        return inPartialFragment;
     }
-    void load(const boost::filesystem::path& file);
 
     void clear() {
         rawBuffer.clear();
@@ -63,28 +141,127 @@ public:
         needsDecompressing = false;
     }
 
+private:
+    std::vector<uint8_t> rawBuffer;
+    std::vector<uint8_t> decompressedBuffer;
+    bool inPartialFragment = false;
+    bool needsDecompressing = false;
+    bool boundary = true;
+};
+
+struct WalSample {
+    uint64_t ref;
+    int64_t ts;
+    double value;
+};
+
+/**
+ * How far through the WAL a WalLoader has read.
+ */
+struct WalPosition {
+    // the first segment read, a checkpoint segment if there was one. If
+    // it is no longer the first segment, the WAL has been truncated.
+    std::string firstSegment;
+    // the segment last read, and the offset in it following the last
+    // complete record.
+    std::string segment;
+    size_t offset = 0;
+};
+
+// values are shared between copies, see SharedRefMap
+using WalSeriesMap = SharedRefMap<Series>;
+using WalChunkMap = SharedRefMap<InMemWalChunk>;
+
+class WalLoader {
+public:
+    /**
+     * @p chunkType selects how samples are stored in the walChunks,
+     * see InMemWalChunk.
+     */
+    WalLoader(WalSeriesMap& series,
+              SymbolRefs& symbols,
+              WalChunkMap& walChunks,
+              ChunkType chunkType = ChunkType::Raw)
+        : seriesMap(series),
+          symbols(symbols),
+          walChunks(walChunks),
+          chunkType(chunkType) {
+    }
+
+    /**
+     * Replay the latest checkpoint and the WAL segments following it.
+     *
+     * If @p threads is greater than 1, segments are split into pieces at
+     * record boundaries, and the pieces are decompressed and decoded
+     * concurrently. Decoded samples are then merged per series in WAL
+     * order, giving the same result as a serial replay.
+     */
+    void load(const boost::filesystem::path& dataDir, size_t threads = 1);
+
+    /**
+     * Load only the records written since @p from, e.g., the position
+     * reached by an earlier load().
+     *
+     * Returns false if the WAL has been truncated since, in which case
+     * nothing is loaded, and the WAL needs loading from scratch.
+     */
+    bool resume(const boost::filesystem::path& dataDir,
+                const WalPosition& from);
+
+    const WalPosition& getPosition() const {
+        return position;
+    }
+
+    void clear() {
+        reader.clear();
+    }
+
 protected:
-    void loadFile(const boost::filesystem::path& file, bool isLast = false);
+    std::vector<std::string> findSegments(
+            const boost::filesystem::path& dataDir) const;
+    void loadParallel(const std::vector<std::string>& segments,
+                      size_t threads);
+
+    /**
+     * Load records from @p file, starting at @p offset. Returns the offset
+     * following the last complete record.
+     */
+    size_t loadFile(const boost::filesystem::path& file,
+                    bool isLast = false,
+                    size_t offset = 0);
     void loadFragment(Decoder& dec, bool isLastFile);
     void loadRecord(Decoder dec);
     void loadSeries(Decoder& dec);
     void loadSamples(Decoder& dec);
 
     /**
-     * copy a provided symbol into the symbol set, and return a view
-     * to the stored symbol.
+     * Add samples to the wal chunks of their series. Samples must be in WAL
+     * order for each series, but samples for the same series are best kept
+     * adjacent as each run needs only one lookup.
+     */
+    void addSamples(const WalSample* begin, const WalSample* end);
+
+    /**
+     * Get the in memory chunk for the given series ref, creating it if
+     * needed. Returns nullptr if the series is not known (yet), in which
+     * case samples for it are discarded.
+     */
+    InMemWalChunk* getWalChunk(uint64_t ref);
+
+    /**
+     * Intern a provided symbol in the SymbolDictionary, and return its ID.
      *
-     * Series take string view labels, so the underlying data needs to be stored
-     * in the symbol table.
+     * The WAL data is not kept once loaded, so the dictionary must hold a
+     * copy of every symbol. References are held in the symbol refs passed
+     * in, rather than by each series.
      */
-    std::string_view addSymbol(std::string_view sym);
+    SymbolDictionary::Id addSymbol(std::string_view sym);
 
-    std::map<size_t, Series>& seriesMap;
-    std::set<std::string, std::less<>>& symbols;
-    std::map<size_t, InMemWalChunk>& walChunks;
+    WalSeriesMap& seriesMap;
+    SymbolRefs& symbols;
+    WalChunkMap& walChunks;
+    ChunkType chunkType;
 
-    std::vector<uint8_t> rawBuffer;
-    std::vector<uint8_t> decompressedBuffer;
-    bool inPartialFragment = false;
-    bool needsDecompressing = false;
+    WalRecordReader reader;
+    WalPosition position;
 };
\ No newline at end of file
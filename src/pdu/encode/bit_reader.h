@@ -0,0 +1,107 @@
+#pragma once
+
+#include "pdu/util/host.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+/**
+ * Reads big-endian bit sequences from a contiguous buffer.
+ *
+ * Unlike BitDecoder, which refills one byte at a time through a Decoder,
+ * this keeps up to 64 bits buffered and refills a whole word at a time.
+ * Intended for hot decoding loops, e.g., bulk decoding XOR chunks.
+ */
+class BitReader {
+public:
+    explicit BitReader(std::string_view data)
+        : ptr(reinterpret_cast<const uint8_t*>(data.data())),
+          end(ptr + data.size()) {
+    }
+
+    bool readBit() {
+        return readBits(1);
+    }
+
+    /**
+     * Read @p count bits (1 to 64 inclusive), returned in the low bits of
+     * the result.
+     */
+    uint64_t readBits(uint8_t count) {
+        if (count > MaxRead) {
+            auto high = readBits(count - 32);
+            return (high << 32) | readBits(32);
+        }
+        if (available < count) {
+            refill();
+            if (available < count) {
+                throw std::runtime_error("BitReader: read past end of data");
+            }
+        }
+        auto result = buffer >> (64 - count);
+        consume(count);
+        return result;
+    }
+
+    /**
+     * Count and consume consecutive set bits, stopping after the first unset
+     * bit or after @p max set bits (max <= 56).
+     *
+     * Decodes unary prefixes like those used for XOR chunk timestamps
+     * without reading one bit at a time.
+     */
+    uint8_t readOnes(uint8_t max) {
+        if (available < max) {
+            refill();
+        }
+        // bits past `available` are either zero or the following data, so
+        // cannot produce a longer run than really exists
+        auto inverted = ~buffer;
+        uint8_t ones = inverted ? __builtin_clzll(inverted) : 64;
+        if (ones >= max) {
+            ones = max;
+        }
+        uint8_t used = ones == max ? max : ones + 1;
+        if (available < used) {
+            throw std::runtime_error("BitReader: read past end of data");
+        }
+        consume(used);
+        return ones;
+    }
+
+private:
+    // at least this many bits are available after a refill, unless at the
+    // end of the data
+    static constexpr uint8_t MaxRead = 56;
+
+    void consume(uint8_t count) {
+        buffer <<= count;
+        available -= count;
+    }
+
+    void refill() {
+        if (end - ptr >= 8) {
+            uint64_t word;
+            std::memcpy(&word, ptr, sizeof(word));
+            buffer |= to_host(word) >> available;
+            // bytes partially loaded will be loaded again next time, and
+            // OR'd in to the same position
+            auto bytes = (64 - available) / 8;
+            ptr += bytes;
+            available += bytes * 8;
+            return;
+        }
+        while (available <= 56 && ptr != end) {
+            buffer |= uint64_t(*ptr++) << (56 - available);
+            available += 8;
+        }
+    }
+
+    const uint8_t* ptr;
+    const uint8_t* end;
+    // unread bits, most significant first
+    uint64_t buffer = 0;
+    uint8_t available = 0;
+};
@@ -2,6 +2,8 @@
 
 #include "pdu/filter/cross_index_sample_iterator.h"
 #include "pdu/filter/filtered_index_iterator.h"
+#include "pdu/filter/prefetching_series_iterator.h"
+#include "pdu/filter/regex_matcher.h"
 #include "pdu/filter/sample_visitor.h"
 #include "pdu/filter/series_filter.h"
 #include "pdu/filter/series_iterator.h"
\ No newline at end of file
@@ -1,25 +1,146 @@
 #include "cross_index_sample_iterator.h"
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+bool sourcesOverlap(const std::vector<TimeRange>& bounds) {
+    // sources are ordered by time, if each starts after every earlier one
+    // ends they can be read one after another.
+    auto latest = std::numeric_limits<int64_t>::min();
+    bool first = true;
+    for (const auto& span : bounds) {
+        if (span.minTime > span.maxTime) {
+            continue;
+        }
+        if (!first && span.minTime <= latest) {
+            return true;
+        }
+        first = false;
+        latest = std::max(latest, span.maxTime);
+    }
+    return false;
+}
+
+void mergeSources(const std::vector<std::vector<Sample>>& sources,
+                  std::vector<Sample>& samples) {
+    // std::merge is stable, so of equal timestamps the sample from the
+    // earlier source comes first.
+    auto byTime = [](const Sample& a, const Sample& b) {
+        return a.timestamp < b.timestamp;
+    };
+    std::vector<Sample> merged;
+    std::vector<Sample> tmp;
+    for (const auto& next : sources) {
+        tmp.clear();
+        tmp.reserve(merged.size() + next.size());
+        std::merge(merged.begin(),
+                   merged.end(),
+                   next.begin(),
+                   next.end(),
+                   std::back_inserter(tmp),
+                   byTime);
+        std::swap(merged, tmp);
+    }
+
+    auto last = std::unique(
+            merged.begin(), merged.end(), [](const auto& a, const auto& b) {
+                return a.timestamp == b.timestamp;
+            });
+    samples.insert(samples.end(), merged.begin(), last);
+}
+
 CrossIndexSampleIterator::CrossIndexSampleIterator(
         std::list<SeriesSampleIterator> subiters)
-    : subiterators(subiters) {
-    while (!subiterators.empty() &&
-           subiterators.front() == end(subiterators.front())) {
-        subiterators.pop_front();
+    : subiterators(subiters.begin(), subiters.end()) {
+    subiterators.erase(std::remove_if(subiterators.begin(),
+                                      subiterators.end(),
+                                      [](const auto& sub) {
+                                          return sub == end(sub);
+                                      }),
+                       subiterators.end());
+
+    std::vector<TimeRange> bounds;
+    bounds.reserve(subiterators.size());
+    for (const auto& sub : subiterators) {
+        bounds.push_back(sub.getTimeBounds());
     }
+    merging = sourcesOverlap(bounds);
+    advanceToNext();
 }
 
 void CrossIndexSampleIterator::increment() {
-    if (!subiterators.empty()) {
+    if (subiterators.empty()) {
+        return;
+    }
+    if (!merging) {
         ++subiterators.front();
+        advanceToNext();
+        return;
+    }
+    // skip the current sample, and the same timestamp in any other source
+    auto ts = subiterators[current]->timestamp;
+    for (auto& sub : subiterators) {
+        if (sub->timestamp == ts) {
+            ++sub;
+        }
+    }
+    advanceToNext();
+}
+
+void CrossIndexSampleIterator::advanceToNext() {
+    if (!merging) {
+        while (!subiterators.empty() &&
+               subiterators.front() == end(subiterators.front())) {
+            subiterators.erase(subiterators.begin());
+        }
+        return;
     }
-    while (!subiterators.empty() &&
-           subiterators.front() == end(subiterators.front())) {
-        subiterators.pop_front();
+    subiterators.erase(std::remove_if(subiterators.begin(),
+                                      subiterators.end(),
+                                      [](const auto& sub) {
+                                          return sub == end(sub);
+                                      }),
+                       subiterators.end());
+    // min_element finds the first of equal timestamps, so the earliest
+    // source wins.
+    auto earliest = std::min_element(subiterators.begin(),
+                                     subiterators.end(),
+                                     [](const auto& a, const auto& b) {
+                                         return a->timestamp < b->timestamp;
+                                     });
+    current = std::distance(subiterators.begin(), earliest);
+}
+
+void CrossIndexSampleIterator::readAll(std::vector<Sample>& samples) {
+    if (!merging) {
+        for (auto& sub : subiterators) {
+            sub.readAll(samples);
+        }
+        subiterators.clear();
+        return;
     }
+
+    // bulk decode each source, then merge
+    std::vector<std::vector<Sample>> sources(subiterators.size());
+    for (size_t i = 0; i < subiterators.size(); ++i) {
+        subiterators[i].readAll(sources[i]);
+    }
+    subiterators.clear();
+    current = 0;
+    mergeSources(sources, samples);
 }
 
 size_t CrossIndexSampleIterator::getNumSamples() const {
+    if (merging) {
+        // duplicates can only be found by reading the samples
+        auto copy = *this;
+        size_t total = 0;
+        for (; copy != end(copy); ++copy) {
+            ++total;
+        }
+        return total;
+    }
     size_t total = 0;
     for (const auto& sub : subiterators) {
         total += sub.getNumSamples();
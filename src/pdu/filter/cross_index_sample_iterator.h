@@ -1,13 +1,40 @@
 #pragma once
 
 #include "pdu/block/series_sample_iterator.h"
+#include "pdu/block/time_range.h"
 #include "pdu/serialisation/serialisation_impl_fwd.h"
 #include "pdu/util/iterator_facade.h"
 
 #include <list>
+#include <vector>
 
 class Encoder;
 
+/**
+ * Whether sources of a series covering the given spans of time (in source
+ * order) overlap, and so must be merged rather than read one after
+ * another. Empty spans (minTime > maxTime) are ignored.
+ */
+bool sourcesOverlap(const std::vector<TimeRange>& bounds);
+
+/**
+ * Merge the samples of each source of a series (in source order, each in
+ * timestamp order) by timestamp, appending them to @p samples. Of samples
+ * with equal timestamps, only the one from the earliest source is kept.
+ */
+void mergeSources(const std::vector<std::vector<Sample>>& sources,
+                  std::vector<Sample>& samples);
+
+/**
+ * Iterate the samples of a series held in multiple sources (blocks and the
+ * head), in timestamp order.
+ *
+ * Sources usually cover disjoint spans of time, and are simply read one
+ * after another. If the spans of any sources overlap (e.g., overlapping
+ * blocks, or a backfilled block overlapping the head), the sources are
+ * instead merged by timestamp, and samples with a timestamp already seen
+ * from an earlier source are dropped.
+ */
 class CrossIndexSampleIterator
     : public iterator_facade<CrossIndexSampleIterator, SampleInfo> {
 public:
@@ -16,7 +43,7 @@ public:
 
     void increment();
     const SampleInfo& dereference() const {
-        return *subiterators.front();
+        return *subiterators[current];
     }
 
     bool is_end() const {
@@ -25,8 +52,27 @@ public:
 
     size_t getNumSamples() const;
 
+    /**
+     * Append all remaining samples to @p samples, leaving this iterator at
+     * the end.
+     */
+    void readAll(std::vector<Sample>& samples);
+
+    // true if sources overlap in time, and are being merged
+    bool isMerging() const {
+        return merging;
+    }
+
 private:
+    // drop exhausted subiterators, and if merging, find the one with the
+    // earliest sample.
+    void advanceToNext();
+
     friend void pdu::detail::serialise_impl(
             Encoder& e, const CrossIndexSampleIterator& cisi);
-    std::list<SeriesSampleIterator> subiterators;
+    // kept in source order, so of equal timestamps the earliest source wins
+    std::vector<SeriesSampleIterator> subiterators;
+    // index of the subiterator holding the current sample
+    size_t current = 0;
+    bool merging = false;
 };
\ No newline at end of file
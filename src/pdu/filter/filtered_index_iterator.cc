@@ -2,9 +2,21 @@
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
+
+namespace {
+bool hasChunkInRange(const Series& series, const TimeRange& range) {
+    return range.unbounded() ||
+           std::any_of(series.begin(), series.end(), [&range](const auto& cr) {
+               return range.overlaps(cr);
+           });
+}
+} // namespace
+
 SeriesHandle::SeriesHandle(std::shared_ptr<SeriesSource> source,
-                           std::shared_ptr<const Series> series)
-    : source(std::move(source)), series(std::move(series)){};
+                           std::shared_ptr<const Series> series,
+                           TimeRange range)
+    : source(std::move(source)), series(std::move(series)), range(range){};
 
 const Series& SeriesHandle::getSeries() const {
     return *series;
@@ -15,7 +27,7 @@ std::shared_ptr<const Series> SeriesHandle::getSeriesPtr() const {
 }
 
 SeriesSampleIterator SeriesHandle::getSamples() const {
-    return {series, source->getCachePtr()};
+    return {series, source->getCachePtr(), range};
 }
 
 void SeriesHandle::getChunks() const {
@@ -23,32 +35,26 @@ void SeriesHandle::getChunks() const {
 }
 
 FilteredSeriesSourceIterator::FilteredSeriesSourceIterator(
-        const std::shared_ptr<SeriesSource>& source, const SeriesFilter& filter)
-    : source(source) {
+        const std::shared_ptr<SeriesSource>& source,
+        const SeriesFilter& filter,
+        TimeRange range)
+    : source(source), range(range) {
     filteredSeriesRefs = source->getFilteredSeriesRefs(filter);
-    refItr = filteredSeriesRefs.begin();
 
     update();
 }
 
-FilteredSeriesSourceIterator::FilteredSeriesSourceIterator(
-        const FilteredSeriesSourceIterator& other) {
-    source = other.source;
-    filteredSeriesRefs = other.filteredSeriesRefs;
-    refItr = filteredSeriesRefs.begin();
-    std::advance(refItr,
-                 std::distance(other.filteredSeriesRefs.begin(), other.refItr));
-    handle = other.handle;
-}
-
 void FilteredSeriesSourceIterator::increment() {
-    ++refItr;
+    ++refIdx;
     update();
 }
 
 void FilteredSeriesSourceIterator::update() {
-    if (refItr != filteredSeriesRefs.end()) {
+    for (; !is_end(); ++refIdx) {
         auto seriesPtr = getCurrentSeries();
-        handle = {source, seriesPtr};
+        if (hasChunkInRange(*seriesPtr, range)) {
+            handle = {source, seriesPtr, range};
+            return;
+        }
     }
 }
\ No newline at end of file
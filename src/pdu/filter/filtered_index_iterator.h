@@ -3,18 +3,19 @@
 #include "pdu/block/chunk_file_cache.h"
 #include "pdu/block/index.h"
 #include "pdu/block/series_sample_iterator.h"
+#include "pdu/block/time_range.h"
 #include "pdu/filter/series_filter.h"
 #include "pdu/util/iterator_facade.h"
 
 #include <memory>
-#include <set>
 
 class SeriesHandle {
 public:
     SeriesHandle() = default;
 
     SeriesHandle(std::shared_ptr<SeriesSource> source,
-                 std::shared_ptr<const Series> series);
+                 std::shared_ptr<const Series> series,
+                 TimeRange range = {});
 
     const Series& getSeries() const;
 
@@ -27,15 +28,19 @@ public:
 private:
     std::shared_ptr<SeriesSource> source;
     std::shared_ptr<const Series> series;
+    TimeRange range;
 };
 
 class FilteredSeriesSourceIterator
     : public iterator_facade<FilteredSeriesSourceIterator, SeriesHandle> {
 public:
+    /**
+     * Iterate the series in a source matching the filter. If a bounded
+     * range is provided, series with no chunks in that range are skipped.
+     */
     FilteredSeriesSourceIterator(const std::shared_ptr<SeriesSource>& source,
-                                 const SeriesFilter& filter);
-
-    FilteredSeriesSourceIterator(const FilteredSeriesSourceIterator& other);
+                                 const SeriesFilter& filter,
+                                 TimeRange range = {});
 
     void increment();
 
@@ -44,7 +49,7 @@ public:
     }
 
     bool is_end() const {
-        return refItr == filteredSeriesRefs.end();
+        return refIdx == filteredSeriesRefs.size();
     }
 
     std::shared_ptr<SeriesSource> getSource() const {
@@ -53,12 +58,12 @@ public:
 
 private:
     // update the SeriesHandle to point to the series referenced by the current
-    // value of refItr
+    // value of refIdx, advancing past any series outside the time range
     void update();
 
     std::shared_ptr<const Series> getCurrentSeries() const {
-        // This creates an aliasing shared ptr. It can be used to access the
-        // const Series it points to, but it shares the ownership information
+        // This creates a shared ptr which can be used to access the
+        // const Series it points to, but shares the ownership information
         // with the index.
         // This prolongs the index's life until there are no users of any
         // of its contained series.
@@ -66,12 +71,14 @@ private:
         // in the Python bindings; for C++ this is relatively unnecessary as
         // it is reasonable to expect destroying a container (the index) to
         // invalidate interators and references to its contents.
-        const auto& series = source->getSeries(*refItr);
-        return std::shared_ptr<const Series>(source, &series);
+        // Lazily loaded indexes decode the series on demand, and it is
+        // released once the last user is done with it.
+        return source->getSeriesPtr(filteredSeriesRefs[refIdx]);
     }
 
     std::shared_ptr<SeriesSource> source;
-    std::set<size_t> filteredSeriesRefs;
-    std::set<size_t>::const_iterator refItr;
+    PostingList filteredSeriesRefs;
+    size_t refIdx = 0;
+    TimeRange range;
     SeriesHandle handle;
 };
\ No newline at end of file
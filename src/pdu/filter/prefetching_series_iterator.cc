@@ -0,0 +1,172 @@
+#include "prefetching_series_iterator.h"
+
+#include "pdu/util/thread_pool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+struct PrefetchingSeriesIterator::State {
+    State(SeriesIterator itr, PrefetchOptions options)
+        : source(std::move(itr)),
+          depth(std::max(size_t(1), options.depth)),
+          pool(options.threads > 1 ? options.threads : 0),
+          freeBuffers(depth + 1) {
+        producer = std::thread([this] { produce(); });
+    }
+
+    ~State() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        producer.join();
+    }
+
+    // runs on the background thread; walks the series and queues up
+    // decoding of each, staying at most depth series ahead.
+    void produce() {
+        try {
+            while (source != end(source)) {
+                std::vector<Sample> buffer;
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [this] {
+                        return stopping ||
+                               (queue.size() < depth && !freeBuffers.empty());
+                    });
+                    if (stopping) {
+                        return;
+                    }
+                    buffer = std::move(freeBuffers.back());
+                    freeBuffers.pop_back();
+                }
+                auto decode = [series = *source,
+                               buffer = std::move(buffer)]() mutable {
+                    PrefetchedSeries result{series, std::move(buffer)};
+                    series.getSamples().readAll(result.samples);
+                    return result;
+                };
+                auto decoded = pool.submit(std::move(decode));
+                ++source;
+                {
+                    std::lock_guard lock(mutex);
+                    queue.push_back(std::move(decoded));
+                }
+                cv.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard lock(mutex);
+            finished = true;
+        }
+        cv.notify_all();
+    }
+
+    // take the next series from the queue, waiting if necessary. Returns
+    // false if there are no more series.
+    bool next() {
+        std::future<PrefetchedSeries> decoded;
+        auto start = std::chrono::steady_clock::now();
+        bool waited = false;
+        {
+            std::unique_lock lock(mutex);
+            // hand back the buffer of the series the caller is done with,
+            // keeping its capacity
+            if (current) {
+                current->samples.clear();
+                freeBuffers.push_back(std::move(current->samples));
+                current.reset();
+                cv.notify_all();
+            }
+            if (queue.empty() && !finished) {
+                waited = true;
+                cv.wait(lock, [this] { return !queue.empty() || finished; });
+            }
+            if (queue.empty()) {
+                if (error) {
+                    std::rethrow_exception(std::exchange(error, nullptr));
+                }
+                return false;
+            }
+            decoded = std::move(queue.front());
+            queue.pop_front();
+        }
+        // a slot is free, the producer may continue
+        cv.notify_all();
+
+        if (decoded.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            waited = true;
+            decoded.wait();
+        }
+        if (waited) {
+            ++stats.stalls;
+            stats.stallTime += std::chrono::steady_clock::now() - start;
+        }
+        try {
+            current = decoded.get();
+        } catch (...) {
+            // the buffer was lost with the failed decode, replace it
+            {
+                std::lock_guard lock(mutex);
+                freeBuffers.emplace_back();
+            }
+            cv.notify_all();
+            throw;
+        }
+        ++stats.series;
+        return true;
+    }
+
+    SeriesIterator source;
+    const size_t depth;
+    ThreadPool pool;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::future<PrefetchedSeries>> queue;
+    // sample buffers not in use by a queued or current series
+    std::vector<std::vector<Sample>> freeBuffers;
+    std::exception_ptr error;
+    bool finished = false;
+    bool stopping = false;
+
+    std::optional<PrefetchedSeries> current;
+    Stats stats;
+
+    // declared last, so everything it uses is constructed before it starts
+    std::thread producer;
+};
+
+PrefetchingSeriesIterator::PrefetchingSeriesIterator(SeriesIterator itr,
+                                                     PrefetchOptions options)
+    : state(std::make_shared<State>(std::move(itr), options)) {
+    state->next();
+}
+
+void PrefetchingSeriesIterator::increment() {
+    state->next();
+}
+
+const PrefetchedSeries& PrefetchingSeriesIterator::dereference() const {
+    return *state->current;
+}
+
+bool PrefetchingSeriesIterator::is_end() const {
+    return !state->current;
+}
+
+PrefetchingSeriesIterator::Stats PrefetchingSeriesIterator::getStats() const {
+    return state->stats;
+}
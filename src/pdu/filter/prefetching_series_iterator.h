@@ -0,0 +1,68 @@
+#pragma once
+
+#include "series_iterator.h"
+
+#include "pdu/block/sample.h"
+#include "pdu/util/iterator_facade.h"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+struct PrefetchOptions {
+    // maximum number of series resolved and decoded ahead of the caller
+    size_t depth = 16;
+    // threads decoding samples. A single background thread both resolves
+    // and decodes series; more decode on a pool while it resolves.
+    size_t threads = 1;
+};
+
+struct PrefetchedSeries {
+    CrossIndexSeries series;
+    // every sample of the series within its time range, in order
+    std::vector<Sample> samples;
+};
+
+/**
+ * Wraps a SeriesIterator, resolving and bulk decoding the samples of
+ * upcoming series in the background while the caller works on the current
+ * one.
+ *
+ * At most PrefetchOptions::depth series are held ahead of the caller.
+ * Samples are decoded into a fixed pool of depth + 1 buffers, which are
+ * reused rather than allocated per series. The buffer of the current
+ * series is handed back on increment, so the samples of a series must not
+ * be referred to after moving past it.
+ *
+ * Decoding in the background reads, and so faults in, the chunk pages of
+ * each series ahead of use; no separate pass touching them is needed.
+ *
+ * Copies share the same underlying progress, like any input iterator.
+ * Exceptions from reading series or samples are rethrown when the
+ * affected series is reached.
+ */
+class PrefetchingSeriesIterator
+    : public iterator_facade<PrefetchingSeriesIterator, PrefetchedSeries> {
+public:
+    struct Stats {
+        // series handed to the caller
+        size_t series = 0;
+        // times the caller had to wait for a series to be decoded
+        size_t stalls = 0;
+        // total time spent waiting
+        std::chrono::nanoseconds stallTime{0};
+    };
+
+    PrefetchingSeriesIterator(SeriesIterator itr, PrefetchOptions options = {});
+
+    void increment();
+    const PrefetchedSeries& dereference() const;
+    bool is_end() const;
+
+    Stats getStats() const;
+
+private:
+    struct State;
+    std::shared_ptr<State> state;
+};
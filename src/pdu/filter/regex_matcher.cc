@@ -0,0 +1,939 @@
+#include "regex_matcher.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+namespace pdu::filter {
+
+struct RegexMatcher::Node {
+    enum Type {
+        // one character from a set
+        Chars,
+        Concat,
+        Alternate,
+        Repeat,
+        AssertStart,
+        AssertEnd,
+    };
+
+    explicit Node(Type type) : type(type) {
+    }
+
+    Type type;
+    std::bitset<256> chars;
+    std::vector<Node> children;
+    // Repeat bounds, max of -1 is unbounded
+    int min = 0;
+    int max = -1;
+};
+
+namespace {
+
+using Node = RegexMatcher::Node;
+
+// the expression uses something not handled here, std::regex will be used
+// (and will report any actual syntax error).
+struct Unsupported {};
+
+// limits on expansion of alternations into globs and of counted repeats
+// into NFA instructions, beyond which the alternatives are not worth it.
+constexpr size_t MaxGlobs = 64;
+constexpr size_t MaxInstructions = 10000;
+// limits on DFA size; past these the NFA is simulated directly
+constexpr size_t MaxDfaStates = 4096;
+constexpr size_t MaxTransitions = 1 << 18;
+
+const std::array<char, 256> lowerTable = [] {
+    std::array<char, 256> table{};
+    for (int c = 0; c < 256; ++c) {
+        table[c] = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : char(c);
+    }
+    return table;
+}();
+
+char lower(char c) {
+    return lowerTable[uint8_t(c)];
+}
+
+// compare, with the pattern already lowercased if icase
+bool equal(std::string_view value, std::string_view pattern, bool icase) {
+    if (value.size() != pattern.size()) {
+        return false;
+    }
+    if (!icase) {
+        return value == pattern;
+    }
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (lower(value[i]) != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t find(std::string_view value,
+            std::string_view pattern,
+            size_t from,
+            bool icase) {
+    if (!icase) {
+        return value.find(pattern, from);
+    }
+    if (pattern.empty()) {
+        return from <= value.size() ? from : std::string_view::npos;
+    }
+    for (size_t i = from; i + pattern.size() <= value.size(); ++i) {
+        if (lower(value[i]) == pattern[0] &&
+            equal(value.substr(i, pattern.size()), pattern, icase)) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+std::bitset<256> charSet(std::string_view chars) {
+    std::bitset<256> set;
+    for (auto c : chars) {
+        set.set(uint8_t(c));
+    }
+    return set;
+}
+
+std::bitset<256> rangeSet(char from, char to) {
+    std::bitset<256> set;
+    for (int c = uint8_t(from); c <= uint8_t(to); ++c) {
+        set.set(c);
+    }
+    return set;
+}
+
+// ECMAScript `.` matches anything but line terminators
+std::bitset<256> dotSet() {
+    return ~charSet("\n\r");
+}
+
+std::bitset<256> digitSet() {
+    return rangeSet('0', '9');
+}
+
+std::bitset<256> wordSet() {
+    return rangeSet('a', 'z') | rangeSet('A', 'Z') | digitSet() | charSet("_");
+}
+
+std::bitset<256> spaceSet() {
+    return charSet(" \t\n\v\f\r");
+}
+
+class Parser {
+public:
+    Parser(std::string_view expr, bool icase) : expr(expr), icase(icase) {
+    }
+
+    Node parse() {
+        auto node = parseAlternate();
+        if (pos != expr.size()) {
+            // unbalanced ')'
+            throw Unsupported();
+        }
+        return node;
+    }
+
+private:
+    bool more() const {
+        return pos < expr.size();
+    }
+
+    char peek() const {
+        return expr[pos];
+    }
+
+    char next() {
+        if (!more()) {
+            throw Unsupported();
+        }
+        return expr[pos++];
+    }
+
+    // with icase, a set containing either case of a letter contains both
+    std::bitset<256> fold(std::bitset<256> set) const {
+        if (icase) {
+            for (int c = 'a'; c <= 'z'; ++c) {
+                if (set.test(c) || set.test(c - 'a' + 'A')) {
+                    set.set(c);
+                    set.set(c - 'a' + 'A');
+                }
+            }
+        }
+        return set;
+    }
+
+    Node chars(std::bitset<256> set) const {
+        Node node(Node::Chars);
+        node.chars = fold(set);
+        return node;
+    }
+
+    Node parseAlternate() {
+        Node node(Node::Alternate);
+        node.children.push_back(parseConcat());
+        while (more() && peek() == '|') {
+            ++pos;
+            node.children.push_back(parseConcat());
+        }
+        if (node.children.size() == 1) {
+            return std::move(node.children.front());
+        }
+        return node;
+    }
+
+    Node parseConcat() {
+        Node node(Node::Concat);
+        while (more() && peek() != '|' && peek() != ')') {
+            node.children.push_back(parseRepeat());
+        }
+        return node;
+    }
+
+    Node parseRepeat() {
+        auto atom = parseAtom();
+        while (more()) {
+            int min;
+            int max;
+            switch (peek()) {
+            case '*':
+                min = 0;
+                max = -1;
+                ++pos;
+                break;
+            case '+':
+                min = 1;
+                max = -1;
+                ++pos;
+                break;
+            case '?':
+                min = 0;
+                max = 1;
+                ++pos;
+                break;
+            case '{':
+                ++pos;
+                min = parseInt();
+                max = min;
+                if (next() == ',') {
+                    max = (more() && peek() == '}') ? -1 : parseInt();
+                    if (next() != '}') {
+                        throw Unsupported();
+                    }
+                } else if (expr[pos - 1] != '}') {
+                    throw Unsupported();
+                }
+                if (max != -1 && max < min) {
+                    throw Unsupported();
+                }
+                break;
+            default:
+                return atom;
+            }
+            if (atom.type == Node::AssertStart ||
+                atom.type == Node::AssertEnd) {
+                throw Unsupported();
+            }
+            // lazy quantifiers only affect which match is found, not
+            // whether the whole string matches
+            if (more() && peek() == '?') {
+                ++pos;
+            }
+            Node repeat(Node::Repeat);
+            repeat.min = min;
+            repeat.max = max;
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    int parseInt() {
+        if (!more() || !std::isdigit(uint8_t(peek()))) {
+            throw Unsupported();
+        }
+        int value = 0;
+        while (more() && std::isdigit(uint8_t(peek()))) {
+            value = value * 10 + (next() - '0');
+            if (value > 1000) {
+                throw Unsupported();
+            }
+        }
+        return value;
+    }
+
+    Node parseAtom() {
+        auto c = next();
+        switch (c) {
+        case '(': {
+            if (more() && peek() == '?') {
+                // only non-capturing groups, not lookahead
+                ++pos;
+                if (next() != ':') {
+                    throw Unsupported();
+                }
+            }
+            auto node = parseAlternate();
+            if (next() != ')') {
+                throw Unsupported();
+            }
+            return node;
+        }
+        case '[':
+            return chars(parseClass());
+        case '.':
+            return chars(dotSet());
+        case '^':
+            return Node(Node::AssertStart);
+        case '$':
+            return Node(Node::AssertEnd);
+        case '\\':
+            return chars(parseEscape(false));
+        case ')':
+        case ']':
+        case '{':
+        case '}':
+        case '*':
+        case '+':
+        case '?':
+            throw Unsupported();
+        default:
+            return chars(charSet(std::string_view(&c, 1)));
+        }
+    }
+
+    std::bitset<256> parseEscape(bool inClass) {
+        auto c = next();
+        switch (c) {
+        case 'd':
+            return digitSet();
+        case 'D':
+            return ~digitSet();
+        case 'w':
+            return wordSet();
+        case 'W':
+            return ~wordSet();
+        case 's':
+            return spaceSet();
+        case 'S':
+            return ~spaceSet();
+        case 'n':
+            return charSet("\n");
+        case 'r':
+            return charSet("\r");
+        case 't':
+            return charSet("\t");
+        case 'f':
+            return charSet("\f");
+        case 'v':
+            return charSet("\v");
+        case '0':
+            return charSet(std::string_view("\0", 1));
+        case 'b':
+            if (inClass) {
+                return charSet("\b");
+            }
+            // word boundary
+            throw Unsupported();
+        }
+        if (std::isalnum(uint8_t(c))) {
+            // backreferences, \B, \x, \u, \c...
+            throw Unsupported();
+        }
+        // identity escape
+        return charSet(std::string_view(&c, 1));
+    }
+
+    std::bitset<256> parseClass() {
+        bool negate = false;
+        if (more() && peek() == '^') {
+            negate = true;
+            ++pos;
+        }
+        if (more() && peek() == ']') {
+            // an empty class
+            throw Unsupported();
+        }
+        std::bitset<256> set;
+        while (next() != ']') {
+            --pos;
+            auto c = next();
+            if (c == '[' && more() && (peek() == ':' || peek() == '=' ||
+                                       peek() == '.')) {
+                // POSIX classes, equivalence classes, collating elements
+                throw Unsupported();
+            }
+            std::bitset<256> item;
+            if (c == '\\') {
+                item = parseEscape(true);
+                if (item.count() != 1) {
+                    set |= item;
+                    continue;
+                }
+            }
+            if (more() && peek() == '-' && pos + 1 < expr.size() &&
+                expr[pos + 1] != ']') {
+                // range; escaped endpoints are not worth handling here
+                ++pos;
+                auto to = next();
+                if (c == '\\' || to == '\\' || to == '[' ||
+                    uint8_t(to) < uint8_t(c)) {
+                    throw Unsupported();
+                }
+                set |= rangeSet(c, to);
+                continue;
+            }
+            set |= c == '\\' ? item : charSet(std::string_view(&c, 1));
+        }
+        // fold before negating, [^a] must not match A either
+        return negate ? ~fold(set) : set;
+    }
+
+    std::string_view expr;
+    size_t pos = 0;
+    bool icase;
+};
+
+// single literal character a Chars node matches, if it is one. With icase,
+// letters are represented lowercase.
+std::optional<char> literalChar(const Node& node, bool icase) {
+    if (node.type != Node::Chars) {
+        return {};
+    }
+    auto count = node.chars.count();
+    for (int c = 0; c < 256; ++c) {
+        if (!node.chars.test(c)) {
+            continue;
+        }
+        if (count == 1) {
+            return char(c);
+        }
+        bool letter = (c >= 'A' && c <= 'Z');
+        if (icase && count == 2 && letter && node.chars.test(c - 'A' + 'a')) {
+            return char(c - 'A' + 'a');
+        }
+        return {};
+    }
+    return {};
+}
+
+bool isDotStar(const Node& node) {
+    return node.type == Node::Repeat && node.min == 0 && node.max == -1 &&
+           node.children.front().type == Node::Chars &&
+           node.children.front().chars == dotSet();
+}
+
+// a sequence of literal strings and stars (empty strings)
+using Pieces = std::vector<std::optional<std::string>>;
+
+bool toPieces(const Node& node, bool icase, std::vector<Pieces>& out) {
+    if (auto c = literalChar(node, icase)) {
+        out = {{std::string(1, *c)}};
+        return true;
+    }
+    if (isDotStar(node)) {
+        out = {{std::nullopt}};
+        return true;
+    }
+    if (node.type == Node::Concat) {
+        out = {{}};
+        for (const auto& child : node.children) {
+            std::vector<Pieces> childPieces;
+            if (!toPieces(child, icase, childPieces) ||
+                out.size() * childPieces.size() > MaxGlobs) {
+                return false;
+            }
+            std::vector<Pieces> product;
+            for (const auto& prefix : out) {
+                for (const auto& suffix : childPieces) {
+                    auto& combined = product.emplace_back(prefix);
+                    combined.insert(
+                            combined.end(), suffix.begin(), suffix.end());
+                }
+            }
+            out = std::move(product);
+        }
+        return true;
+    }
+    if (node.type == Node::Alternate) {
+        out.clear();
+        for (const auto& child : node.children) {
+            std::vector<Pieces> childPieces;
+            if (!toPieces(child, icase, childPieces) ||
+                out.size() + childPieces.size() > MaxGlobs) {
+                return false;
+            }
+            out.insert(out.end(), childPieces.begin(), childPieces.end());
+        }
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+RegexMatcher::RegexMatcher(std::string_view expression, bool caseInsensitive)
+    : icase(caseInsensitive) {
+    try {
+        auto root = Parser(expression, icase).parse();
+        if (compileProgram(root)) {
+            kind = Kind::Automaton;
+            if (!compileGlobs(root)) {
+                buildDfa();
+            }
+            return;
+        }
+    } catch (const Unsupported&) {
+    }
+    auto flags = std::regex_constants::ECMAScript;
+    if (icase) {
+        flags |= std::regex_constants::icase;
+    }
+    kind = Kind::StdRegex;
+    fallback.emplace(std::string(expression), flags);
+}
+
+bool RegexMatcher::compileGlobs(const Node& root) {
+    // only patterns of literals and `.*` are handled without the automaton
+    std::vector<Pieces> alternatives;
+    if (!toPieces(root, icase, alternatives)) {
+        return false;
+    }
+
+    std::vector<Glob> result;
+    bool allLiteral = true;
+    for (const auto& pieces : alternatives) {
+        // merge adjacent literals, and adjacent stars
+        Pieces merged;
+        for (const auto& piece : pieces) {
+            if (!merged.empty() && bool(piece) == bool(merged.back())) {
+                if (piece) {
+                    *merged.back() += *piece;
+                }
+                continue;
+            }
+            merged.push_back(piece);
+        }
+
+        auto& glob = result.emplace_back();
+        glob.leadingStar = !merged.empty() && !merged.front();
+        glob.trailingStar = !merged.empty() && !merged.back();
+        for (const auto& piece : merged) {
+            if (piece) {
+                glob.literals.push_back(*piece);
+            }
+        }
+        if (glob.literals.empty()) {
+            // the empty string, or `.*`
+            glob.literals.emplace_back();
+        }
+        allLiteral &= !glob.leadingStar && !glob.trailingStar &&
+                      glob.literals.size() == 1;
+    }
+
+    if (allLiteral) {
+        kind = Kind::Literal;
+        for (const auto& glob : result) {
+            literals.push_back(glob.literals.front());
+        }
+        std::sort(literals.begin(), literals.end());
+        literals.erase(std::unique(literals.begin(), literals.end()),
+                       literals.end());
+        return true;
+    }
+
+    kind = Kind::Glob;
+    if (result.size() == 1 && result.front().literals.size() == 1) {
+        const auto& glob = result.front();
+        if (glob.leadingStar && glob.trailingStar) {
+            kind = Kind::Contains;
+        } else if (glob.leadingStar) {
+            kind = Kind::Suffix;
+        } else {
+            kind = Kind::Prefix;
+        }
+    }
+    globs = std::move(result);
+    return true;
+}
+
+bool RegexMatcher::Glob::matches(std::string_view value, bool icase) const {
+    size_t begin = 0;
+    size_t end = value.size();
+    size_t first = 0;
+    size_t last = literals.size();
+    if (!leadingStar) {
+        const auto& prefix = literals.front();
+        if (value.size() < prefix.size() ||
+            !equal(value.substr(0, prefix.size()), prefix, icase)) {
+            return false;
+        }
+        begin = prefix.size();
+        first = 1;
+        if (!trailingStar && last == 1) {
+            // a single literal, no stars
+            return begin == end;
+        }
+    }
+    if (!trailingStar && first < last) {
+        const auto& suffix = literals.back();
+        if (end - begin < suffix.size() ||
+            !equal(value.substr(end - suffix.size()), suffix, icase)) {
+            return false;
+        }
+        end -= suffix.size();
+        --last;
+    }
+    // anything between is found leftmost first, leaving as much room as
+    // possible for the following literals
+    auto middle = value.substr(0, end);
+    for (size_t i = first; i < last; ++i) {
+        auto found = find(middle, literals[i], begin, icase);
+        if (found == std::string_view::npos) {
+            return false;
+        }
+        begin = found + literals[i].size();
+    }
+    return true;
+}
+
+bool RegexMatcher::compileProgram(const Node& root) {
+    program.clear();
+    classes.clear();
+    emit(root);
+    program.push_back({Inst::Match});
+    return program.size() <= MaxInstructions;
+}
+
+void RegexMatcher::emit(const Node& node) {
+    if (program.size() > MaxInstructions) {
+        return;
+    }
+    switch (node.type) {
+    case Node::Chars: {
+        auto itr = std::find(classes.begin(), classes.end(), node.chars);
+        program.push_back(
+                {Inst::Char, uint32_t(std::distance(classes.begin(), itr))});
+        if (itr == classes.end()) {
+            classes.push_back(node.chars);
+        }
+        return;
+    }
+    case Node::Concat:
+        for (const auto& child : node.children) {
+            emit(child);
+        }
+        return;
+    case Node::Alternate: {
+        std::vector<size_t> jumps;
+        for (size_t i = 0; i < node.children.size(); ++i) {
+            size_t split = program.size();
+            bool last = i + 1 == node.children.size();
+            if (!last) {
+                program.push_back({Inst::Split, uint32_t(split + 1)});
+            }
+            emit(node.children[i]);
+            if (!last) {
+                jumps.push_back(program.size());
+                program.push_back({Inst::Jump});
+                program[split].y = program.size();
+            }
+        }
+        for (auto jump : jumps) {
+            program[jump].x = program.size();
+        }
+        return;
+    }
+    case Node::Repeat: {
+        const auto& child = node.children.front();
+        for (int i = 0; i < node.min; ++i) {
+            emit(child);
+        }
+        if (node.max == -1) {
+            size_t split = program.size();
+            program.push_back({Inst::Split, uint32_t(split + 1)});
+            emit(child);
+            program.push_back({Inst::Jump, uint32_t(split)});
+            program[split].y = program.size();
+            return;
+        }
+        // each optional repetition may skip straight past the rest
+        std::vector<size_t> splits;
+        for (int i = node.min; i < node.max; ++i) {
+            splits.push_back(program.size());
+            program.push_back({Inst::Split, uint32_t(program.size() + 1)});
+            emit(child);
+        }
+        for (auto split : splits) {
+            program[split].y = program.size();
+        }
+        return;
+    }
+    case Node::AssertStart:
+        program.push_back({Inst::AssertStart});
+        return;
+    case Node::AssertEnd:
+        program.push_back({Inst::AssertEnd});
+        return;
+    }
+}
+
+bool RegexMatcher::buildDfa() {
+    // bytes are equivalent if every character class either contains both
+    // or neither.
+    std::map<std::vector<bool>, uint8_t> classIds;
+    for (int c = 0; c < 256; ++c) {
+        std::vector<bool> membership;
+        membership.reserve(classes.size());
+        for (const auto& cls : classes) {
+            membership.push_back(cls.test(c));
+        }
+        auto [itr, added] = classIds.try_emplace(membership, classIds.size());
+        byteClasses[c] = itr->second;
+    }
+    byteClassCount = classIds.size();
+
+    // subset construction; each DFA state is the sorted set of Char, Match
+    // and AssertEnd instructions the NFA could be at. AssertEnd is only
+    // followed when deciding if a state accepts.
+    using StateSet = std::vector<uint32_t>;
+    auto closure = [this](StateSet& set, uint32_t start, bool atStart,
+                          bool atEnd) {
+        std::vector<uint32_t> stack{start};
+        std::vector<bool> seen(program.size());
+        for (auto pc : set) {
+            seen[pc] = true;
+        }
+        while (!stack.empty()) {
+            auto pc = stack.back();
+            stack.pop_back();
+            if (seen[pc]) {
+                continue;
+            }
+            seen[pc] = true;
+            const auto& inst = program[pc];
+            switch (inst.op) {
+            case Inst::Jump:
+                stack.push_back(inst.x);
+                break;
+            case Inst::Split:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            case Inst::AssertStart:
+                if (atStart) {
+                    stack.push_back(pc + 1);
+                }
+                break;
+            case Inst::AssertEnd:
+                if (atEnd) {
+                    stack.push_back(pc + 1);
+                } else {
+                    set.push_back(pc);
+                }
+                break;
+            case Inst::Char:
+            case Inst::Match:
+                set.push_back(pc);
+                break;
+            }
+        }
+    };
+    auto accepts = [&](const StateSet& set, bool atStart) {
+        for (auto pc : set) {
+            if (program[pc].op == Inst::Match) {
+                return true;
+            }
+            if (program[pc].op == Inst::AssertEnd) {
+                StateSet end;
+                closure(end, pc + 1, atStart, true);
+                for (auto endPc : end) {
+                    if (program[endPc].op == Inst::Match) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    };
+
+    std::map<StateSet, uint32_t> stateIds;
+    std::vector<StateSet> states;
+    auto addState = [&](StateSet set, bool atStart) {
+        std::sort(set.begin(), set.end());
+        auto [itr, added] = stateIds.try_emplace(set, states.size());
+        if (added) {
+            accepting.push_back(accepts(set, atStart));
+            states.push_back(std::move(set));
+        }
+        return itr->second;
+    };
+
+    // the start state is distinct from others even for the same set, as
+    // AssertStart may be followed there
+    addState({}, false);
+    StateSet start;
+    closure(start, 0, true, false);
+    startState = states.size();
+    states.push_back(start);
+    accepting.push_back(accepts(start, true));
+
+    for (uint32_t state = 0; state < states.size(); ++state) {
+        if (states.size() > MaxDfaStates ||
+            (state + 1) * byteClassCount > MaxTransitions) {
+            transitions.clear();
+            accepting.clear();
+            return false;
+        }
+        for (size_t cls = 0; cls < byteClassCount; ++cls) {
+            // any byte of the class will do
+            auto byte = std::find(byteClasses.begin(), byteClasses.end(), cls) -
+                        byteClasses.begin();
+            StateSet next;
+            for (auto pc : states[state]) {
+                const auto& inst = program[pc];
+                if (inst.op == Inst::Char && classes[inst.x].test(byte)) {
+                    closure(next, pc + 1, false, false);
+                }
+            }
+            transitions.push_back(addState(std::move(next), false));
+        }
+    }
+    return true;
+}
+
+bool RegexMatcher::runDfa(std::string_view value) const {
+    auto state = startState;
+    for (auto c : value) {
+        state = transitions[state * byteClassCount + byteClasses[uint8_t(c)]];
+        if (state == 0) {
+            return false;
+        }
+    }
+    return accepting[state];
+}
+
+bool RegexMatcher::runProgram(std::string_view value) const {
+    // scratch space reused across calls; matching is on the hot path of
+    // filtering every label value.
+    struct Scratch {
+        std::vector<uint32_t> current;
+        std::vector<uint32_t> next;
+        std::vector<uint32_t> stack;
+        std::vector<uint32_t> marks;
+        uint32_t generation = 0;
+    };
+    thread_local Scratch scratch;
+    auto& s = scratch;
+    if (s.marks.size() < program.size()) {
+        s.marks.assign(program.size(), 0);
+        s.generation = 0;
+    }
+    s.current.clear();
+
+    // add the thread at pc, following jumps, splits and assertions which
+    // hold at pos. Each instruction is added at most once per step.
+    auto add = [&](std::vector<uint32_t>& list, uint32_t start, size_t pos) {
+        s.stack.clear();
+        s.stack.push_back(start);
+        while (!s.stack.empty()) {
+            auto pc = s.stack.back();
+            s.stack.pop_back();
+            if (s.marks[pc] == s.generation) {
+                continue;
+            }
+            s.marks[pc] = s.generation;
+            const auto& inst = program[pc];
+            switch (inst.op) {
+            case Inst::Jump:
+                s.stack.push_back(inst.x);
+                break;
+            case Inst::Split:
+                s.stack.push_back(inst.y);
+                s.stack.push_back(inst.x);
+                break;
+            case Inst::AssertStart:
+                if (pos == 0) {
+                    s.stack.push_back(pc + 1);
+                }
+                break;
+            case Inst::AssertEnd:
+                if (pos == value.size()) {
+                    s.stack.push_back(pc + 1);
+                }
+                break;
+            case Inst::Char:
+            case Inst::Match:
+                list.push_back(pc);
+                break;
+            }
+        }
+    };
+    auto nextGeneration = [&] {
+        if (++s.generation == 0) {
+            std::fill(s.marks.begin(), s.marks.end(), 0);
+            s.generation = 1;
+        }
+    };
+
+    nextGeneration();
+    add(s.current, 0, 0);
+    for (size_t i = 0; i < value.size(); ++i) {
+        auto c = uint8_t(value[i]);
+        nextGeneration();
+        s.next.clear();
+        for (auto pc : s.current) {
+            const auto& inst = program[pc];
+            if (inst.op == Inst::Char && classes[inst.x].test(c)) {
+                add(s.next, pc + 1, i + 1);
+            }
+        }
+        std::swap(s.current, s.next);
+        if (s.current.empty()) {
+            return false;
+        }
+    }
+    return std::any_of(s.current.begin(), s.current.end(), [this](auto pc) {
+        return program[pc].op == Inst::Match;
+    });
+}
+
+bool RegexMatcher::operator()(std::string_view value) const {
+    switch (kind) {
+    case Kind::Literal: {
+        if (!icase) {
+            return std::binary_search(literals.begin(), literals.end(), value);
+        }
+        return std::any_of(
+                literals.begin(), literals.end(), [&](const auto& literal) {
+                    return equal(value, literal, true);
+                });
+    }
+    case Kind::Prefix:
+    case Kind::Suffix:
+    case Kind::Contains:
+    case Kind::Glob:
+        // stars stand for `.*`, which does not match line terminators.
+        // Rare in label values; leave those to the automaton.
+        if (std::memchr(value.data(), '\n', value.size()) ||
+            std::memchr(value.data(), '\r', value.size())) {
+            return runProgram(value);
+        }
+        return std::any_of(globs.begin(), globs.end(), [&](const auto& glob) {
+            return glob.matches(value, icase);
+        });
+    case Kind::Automaton:
+        return transitions.empty() ? runProgram(value) : runDfa(value);
+    case Kind::StdRegex:
+        return std::regex_match(value.begin(), value.end(), *fallback);
+    }
+    return false;
+}
+
+} // namespace pdu::filter
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pdu::filter {
+
+/**
+ * Matches whole strings (as std::regex_match) against an ECMAScript regex,
+ * without a backtracking regex engine where possible.
+ *
+ * Patterns made only of literals, alternations and `.*` (e.g., `foo`,
+ * `foo.*`, `.*(_bucket|_sum)`, `a|b|c`) are compiled to literal, prefix,
+ * suffix and substring comparisons. Other patterns are compiled to an NFA,
+ * and where the number of states allows, a DFA is built from it up front;
+ * either matches in time linear in the length of the input. Only patterns
+ * using features an NFA cannot express (backreferences, lookahead, word
+ * boundaries) fall back to std::regex.
+ *
+ * Case insensitivity applies to ASCII letters only.
+ */
+class RegexMatcher {
+public:
+    enum class Kind {
+        // every alternative is a literal string
+        Literal,
+        // a single literal followed by .*
+        Prefix,
+        // .* followed by a single literal
+        Suffix,
+        // a single literal with .* either side
+        Contains,
+        // alternatives of literals separated by .*
+        Glob,
+        Automaton,
+        StdRegex,
+    };
+
+    RegexMatcher(std::string_view expression, bool caseInsensitive = false);
+
+    bool operator()(std::string_view value) const;
+
+    Kind getKind() const {
+        return kind;
+    }
+
+    // node of the parsed expression
+    struct Node;
+
+private:
+    // literal segments, to be found in order, with arbitrary characters
+    // between them (and at the start/end, if leadingStar/trailingStar)
+    struct Glob {
+        std::vector<std::string> literals;
+        bool leadingStar = false;
+        bool trailingStar = false;
+
+        bool matches(std::string_view value, bool icase) const;
+    };
+
+    struct Inst {
+        enum Op : uint8_t { Char, Split, Jump, Match, AssertStart, AssertEnd };
+        Op op;
+        // next instructions for Split and Jump, or the character class
+        // for Char
+        uint32_t x = 0;
+        uint32_t y = 0;
+    };
+
+    bool compileGlobs(const Node& root);
+    bool compileProgram(const Node& root);
+    void emit(const Node& node);
+    bool buildDfa();
+    bool runProgram(std::string_view value) const;
+    bool runDfa(std::string_view value) const;
+
+    Kind kind = Kind::StdRegex;
+    bool icase;
+
+    // Literal: sorted, lowercased if icase
+    std::vector<std::string> literals;
+    // Prefix, Suffix, Contains, Glob
+    std::vector<Glob> globs;
+    // Automaton
+    std::vector<Inst> program;
+    std::vector<std::bitset<256>> classes;
+    // DFA over classes of bytes which no character class distinguishes,
+    // empty if it would have too many states. State 0 matches nothing.
+    std::array<uint8_t, 256> byteClasses{};
+    size_t byteClassCount = 0;
+    std::vector<uint32_t> transitions;
+    std::vector<bool> accepting;
+    uint32_t startState = 0;
+    // StdRegex
+    std::optional<std::regex> fallback;
+};
+
+} // namespace pdu::filter
@@ -1,8 +1,15 @@
 #include "sample_visitor.h"
 
+#include "pdu/block/chunk_file_cache.h"
+#include "pdu/block/chunk_view.h"
 #include "pdu/pdu.h"
 #include "series_iterator.h"
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+
 SeriesVisitor::~SeriesVisitor() = default;
 
 void SeriesVisitor::visit(const std::vector<std::shared_ptr<Index>>& indexes) {
@@ -36,6 +43,14 @@ void OrderedSeriesVisitor::visit(const PrometheusData& pd) {
     visit(pd.begin());
 }
 void OrderedSeriesVisitor::visit(const SeriesIterator& itr) {
+    if (readWindow) {
+        visitFileOrdered(itr);
+        return;
+    }
+    if (prefetch.depth) {
+        visitPrefetched(itr);
+        return;
+    }
     for (const auto& series : itr) {
         // same series across multiple indexes
         visit(series.getSeries());
@@ -43,4 +58,131 @@ void OrderedSeriesVisitor::visit(const SeriesIterator& itr) {
             visit(sample);
         }
     }
-}
\ No newline at end of file
+}
+void OrderedSeriesVisitor::visitPrefetched(SeriesIterator itr) {
+    PrefetchingSeriesIterator prefetched(std::move(itr), prefetch);
+    SampleInfo info;
+    for (const auto& [series, samples] : prefetched) {
+        visit(series.getSeries());
+        for (const auto& sample : samples) {
+            static_cast<Sample&>(info) = sample;
+            visit(info);
+        }
+    }
+    prefetchStats = prefetched.getStats();
+}
+
+void OrderedSeriesVisitor::visitFileOrdered(SeriesIterator itr) {
+    struct ChunkRead {
+        ChunkFileCache* cache;
+        const ChunkReference* ref;
+        // position of the decoded samples in chunkSamples
+        size_t seriesIdx;
+        size_t sourceIdx;
+        size_t chunkIdx;
+    };
+
+    std::vector<CrossIndexSeries> window;
+    // decoded samples for each chunk of each source of each series in the
+    // window
+    std::vector<std::vector<std::vector<std::vector<Sample>>>> chunkSamples;
+    // span of time covered by each source of each series in the window, as
+    // SeriesSampleIterator::getTimeBounds
+    std::vector<std::vector<TimeRange>> sourceBounds;
+    std::vector<ChunkRead> reads;
+
+    while (itr != end(itr)) {
+        window.clear();
+        chunkSamples.clear();
+        sourceBounds.clear();
+        reads.clear();
+
+        // gather series until there are enough chunks to fill the window.
+        // A single series may exceed it, but must be read.
+        while (itr != end(itr) &&
+               (window.empty() || reads.size() < readWindow)) {
+            const auto& cis = window.emplace_back(*itr);
+            auto& seriesChunks = chunkSamples.emplace_back();
+            auto& seriesBounds = sourceBounds.emplace_back();
+            for (const auto& [source, series] : cis.seriesCollection) {
+                auto& sourceChunks = seriesChunks.emplace_back();
+                auto& bounds = seriesBounds.emplace_back(
+                        TimeRange{std::numeric_limits<int64_t>::max(),
+                                  std::numeric_limits<int64_t>::min()});
+                for (const auto& cr : *series) {
+                    if (!cis.range.overlaps(cr)) {
+                        continue;
+                    }
+                    bounds.minTime = std::max(
+                            std::min(bounds.minTime, int64_t(cr.minTime)),
+                            cis.range.minTime);
+                    bounds.maxTime = std::min(
+                            std::max(bounds.maxTime, int64_t(cr.maxTime)),
+                            cis.range.maxTime);
+                    reads.push_back({&source->getCache(),
+                                     &cr,
+                                     window.size() - 1,
+                                     seriesChunks.size() - 1,
+                                     sourceChunks.size()});
+                    sourceChunks.emplace_back();
+                }
+            }
+            ++itr;
+        }
+
+        std::sort(reads.begin(),
+                  reads.end(),
+                  [](const ChunkRead& a, const ChunkRead& b) {
+                      if (a.cache != b.cache) {
+                          return std::less<>()(a.cache, b.cache);
+                      }
+                      return std::make_pair(a.ref->getSegmentFileId(),
+                                            a.ref->getOffset()) <
+                             std::make_pair(b.ref->getSegmentFileId(),
+                                            b.ref->getOffset());
+                  });
+
+        for (const auto& read : reads) {
+            ChunkView cv(*read.cache, *read.ref);
+            auto& samples = chunkSamples[read.seriesIdx][read.sourceIdx]
+                                        [read.chunkIdx];
+            samples.resize(cv.numSamples());
+            cv.decode(samples.data(), samples.size());
+        }
+
+        // now hand back samples in series order, combining sources as
+        // CrossIndexSampleIterator does
+        std::vector<std::vector<Sample>> sources;
+        std::vector<Sample> merged;
+        for (size_t i = 0; i < window.size(); ++i) {
+            const auto& cis = window[i];
+            visit(cis.getSeries());
+            sources.resize(chunkSamples[i].size());
+            for (size_t s = 0; s < sources.size(); ++s) {
+                sources[s].clear();
+                for (const auto& samples : chunkSamples[i][s]) {
+                    std::copy_if(samples.begin(),
+                                 samples.end(),
+                                 std::back_inserter(sources[s]),
+                                 [&cis](const Sample& sample) {
+                                     return cis.range.contains(
+                                             sample.timestamp);
+                                 });
+                }
+            }
+            merged.clear();
+            if (sourcesOverlap(sourceBounds[i])) {
+                mergeSources(sources, merged);
+            } else {
+                for (const auto& samples : sources) {
+                    merged.insert(merged.end(), samples.begin(), samples.end());
+                }
+            }
+            SampleInfo info;
+            for (const auto& sample : merged) {
+                static_cast<Sample&>(info) = sample;
+                visit(info);
+            }
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include "cross_index_sample_iterator.h"
 #include "filtered_index_iterator.h"
 #include "pdu/block/series_sample_iterator.h"
+#include "prefetching_series_iterator.h"
 #include "series_iterator.h"
 #include <list>
 #include <vector>
@@ -33,4 +34,41 @@ public:
     virtual void visit(std::vector<FilteredSeriesSourceIterator>& indexes);
     virtual void visit(const PrometheusData& pd);
     virtual void visit(const SeriesIterator& itr);
+
+    /**
+     * Read chunks in file order rather than series order.
+     *
+     * Series are still visited in label order, but chunks for a window of
+     * series are collected up and read sorted by (segment, offset), which
+     * avoids random I/O on slow storage. The window is the (approximate)
+     * maximum number of chunks decoded and held in memory at once.
+     *
+     * 0 (the default) reads chunks in series order as they are visited.
+     */
+    void setReadWindow(size_t chunks) {
+        readWindow = chunks;
+    }
+
+    /**
+     * Decode the samples of upcoming series on background threads while
+     * the current series is visited. Ignored if a read window is set.
+     *
+     * A depth of 0 (the default) decodes each series as it is visited.
+     */
+    void setPrefetch(PrefetchOptions options) {
+        prefetch = options;
+    }
+
+    // how long visiting waited on prefetched series, after a visit
+    PrefetchingSeriesIterator::Stats getPrefetchStats() const {
+        return prefetchStats;
+    }
+
+private:
+    void visitFileOrdered(SeriesIterator itr);
+    void visitPrefetched(SeriesIterator itr);
+
+    size_t readWindow = 0;
+    PrefetchOptions prefetch{0, 1};
+    PrefetchingSeriesIterator::Stats prefetchStats;
 };
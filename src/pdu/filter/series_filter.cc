@@ -1,6 +1,14 @@
 #include "series_filter.h"
 
-#include <regex>
+#include "regex_matcher.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
 
 namespace pdu::filter {
 
@@ -8,105 +16,288 @@ Filter exactly(std::string expected) {
     return [expected](std::string_view value) { return value == expected; };
 }
 Filter regex(std::string expression) {
-    std::regex expr(
-            expression,
-            std::regex_constants::ECMAScript | std::regex_constants::icase);
-    return [expr = std::move(expr)](std::string_view value) {
-        return std::regex_match(value.begin(), value.end(), expr);
+    auto matcher = std::make_shared<const RegexMatcher>(expression, true);
+    return [matcher = std::move(matcher)](std::string_view value) {
+        return (*matcher)(value);
     };
 }
 
 } // namespace pdu::filter
 
-std::set<size_t> SeriesFilter::operator()(const Index& index) const {
-    PerLabelRefs refs;
+/**
+ * Keyed by the value itself rather than a SymbolDictionary ID, so matching
+ * values from postings never interns them; that would take the dictionary
+ * lock per value and keep every value seen alive in the dictionary.
+ */
+struct SeriesFilter::MatchCache {
+    // must hold mutex
+    std::optional<bool> find(std::string_view value) const {
+        if (auto itr = results.find(value); itr != results.end()) {
+            return itr->second;
+        }
+        return {};
+    }
 
-    if (empty()) {
-        // no filters specified, collect all series IDs
-        std::set<size_t> res;
-        for (const auto& [k, v] : index.series) {
-            res.insert(k);
+    // must hold mutex exclusively
+    void insert(std::string_view value, bool result) {
+        if (results.count(value)) {
+            return;
         }
-        return res;
+        const auto& stored = values.emplace_back(value);
+        results.emplace(stored, result);
     }
 
-    // ensure that all filtered-on labels will have an empty set of references
-    // to start with. This ensures filters which match _nothing_ will lead
-    // to a set intersection with an empty set -> no matching refs.
-    for (const auto& matcher : matchers) {
-        refs[matcher.first] = {};
+    std::shared_mutex mutex;
+    // copies of each value cached, never moved once added
+    std::deque<std::string> values;
+    // keys view values
+    std::unordered_map<std::string_view, bool> results;
+};
+
+SeriesFilter::LabelMatcher::LabelMatcher(std::string key,
+                                         MatchType type,
+                                         ValueMatcher valueMatcher,
+                                         BatchMatcher batchMatcher,
+                                         bool memoise)
+    : key(std::move(key)),
+      type(type),
+      valueMatcher(std::move(valueMatcher)),
+      batchMatcher(std::move(batchMatcher)) {
+    if (memoise) {
+        cache = std::make_shared<MatchCache>();
     }
+}
 
-    // collect all series references by label key matching a provided
-    // matcher.
-    (*this)(index, refs);
+bool SeriesFilter::LabelMatcher::accepts(std::string_view value) const {
+    if (cache) {
+        std::shared_lock lock(cache->mutex);
+        if (auto result = cache->find(value)) {
+            return *result;
+        }
+    }
+    bool result;
+    if (batchMatcher) {
+        std::vector<bool> results;
+        batchMatcher({value}, results);
+        result = results.at(0);
+    } else {
+        result = valueMatcher(value);
+    }
+    if (cache) {
+        std::unique_lock lock(cache->mutex);
+        cache->insert(value, result);
+    }
+    return result;
+}
 
-    if (refs.empty()) {
-        return {};
+std::vector<bool> SeriesFilter::LabelMatcher::acceptsAll(
+        const std::vector<std::string_view>& values) const {
+    std::vector<bool> results;
+    results.reserve(values.size());
+    if (!cache) {
+        if (batchMatcher) {
+            batchMatcher(values, results);
+        } else {
+            for (auto value : values) {
+                results.push_back(valueMatcher(value));
+            }
+        }
+        return results;
     }
 
-    // find the intersection of the references for each label key
-    // e.g., to match
-    //     {__name__=~"foo.*", job="bar"}
-    // intersect all references to series which match the __name__ selector
-    // with those which match the job selector - the resulting set of
-    // references point to series matching the filter.
-    auto itr = refs.begin();
-    std::set<size_t> result = itr->second;
-    std::set<size_t> tmp;
-    ++itr;
-    for (; itr != refs.end(); ++itr) {
-        auto& perLabel = itr->second;
-        // intersect the series which matched on each label to find
-        // only the series which matched all label filters
-        std::set_intersection(result.begin(),
-                              result.end(),
-                              perLabel.begin(),
-                              perLabel.end(),
-                              std::inserter(tmp, tmp.begin()));
-        std::swap(result, tmp);
-        tmp.clear();
+    // find which values have not been seen in any earlier block
+    std::vector<std::string_view> unknown;
+    std::vector<size_t> unknownIdx;
+    {
+        std::shared_lock lock(cache->mutex);
+        for (size_t i = 0; i < values.size(); ++i) {
+            auto result = cache->find(values[i]);
+            results.push_back(result.value_or(false));
+            if (!result) {
+                unknown.push_back(values[i]);
+                unknownIdx.push_back(i);
+            }
+        }
+    }
+
+    if (!unknown.empty()) {
+        std::vector<bool> unknownResults;
+        unknownResults.reserve(unknown.size());
+        if (batchMatcher) {
+            batchMatcher(unknown, unknownResults);
+        } else {
+            for (auto value : unknown) {
+                unknownResults.push_back(valueMatcher(value));
+            }
+        }
+        std::unique_lock lock(cache->mutex);
+        for (size_t i = 0; i < unknown.size(); ++i) {
+            results[unknownIdx[i]] = unknownResults.at(i);
+            cache->insert(unknown[i], unknownResults.at(i));
+        }
+    }
+    return results;
+}
+
+namespace {
+// Decoding postings costs far less per ref than finding a series and
+// checking its labels, particularly for lazily loaded indexes. Postings up
+// to this many times larger than the current candidates are decoded; larger
+// ones are checked against the candidates' labels instead.
+constexpr size_t LabelCheckCost = 16;
+
+struct MatcherPlan {
+    const SeriesFilter::LabelMatcher* matcher = nullptr;
+    // postings of every label value the matcher selects (for Match) or
+    // excludes (for NotMatch and Absent)
+    std::vector<PostingOffset> postings;
+    // total series refs in those postings
+    size_t estimate = 0;
+
+    PostingList materialise(const Index& index) const {
+        std::vector<PostingList> lists;
+        lists.reserve(postings.size());
+        for (const auto& po : postings) {
+            lists.push_back(index.getSeriesRefs(po));
+        }
+        return unite(std::move(lists));
     }
+};
 
+MatcherPlan plan(const Index& index, const SeriesFilter::LabelMatcher& m) {
+    using MatchType = SeriesFilter::MatchType;
+    MatcherPlan result;
+    result.matcher = &m;
+    // only visit the entries of the postings offset table for this key
+    std::vector<PostingOffset> postings;
+    std::vector<std::string_view> values;
+    for (const auto& po : index.postings.forLabel(m.key)) {
+        postings.push_back(po);
+        values.push_back(po.labelValue);
+    }
+    // Absent excludes every series with the label. Otherwise, collect
+    // values accepted by the matcher, to be included for Match, or
+    // excluded for NotMatch. Values are evaluated together, so any not
+    // already seen in another block are handed to the matcher in one go.
+    std::vector<bool> accepted(values.size(), true);
+    if (m.type != MatchType::Absent) {
+        accepted = m.acceptsAll(values);
+    }
+    for (size_t i = 0; i < postings.size(); ++i) {
+        if (accepted[i]) {
+            result.postings.push_back(postings[i]);
+            result.estimate += index.getSeriesRefCount(postings[i]);
+        }
+    }
     return result;
 }
+} // namespace
 
-bool SeriesFilter::operator()(const Series& series) const {
-    for (const auto& [label, matcher] : matchers) {
-        auto itr = series.labels.find(label);
-        if (itr == series.labels.end()) {
-            // for now we have no way of filtering for "does not have label"
-            // if there is a matcher for this label, but it is absent,
-            // the series can be rejected.
-            return false;
+PostingList SeriesFilter::operator()(const Index& index) const {
+    const auto& allRefs = index.series.getRefs();
+    if (empty()) {
+        // no filters specified, collect all series IDs
+        return PostingList({allRefs.begin(), allRefs.end()});
+    }
+
+    std::vector<MatcherPlan> include;
+    std::vector<MatcherPlan> exclude;
+    for (const auto& m : matchers) {
+        (m.type == MatchType::Match ? include : exclude)
+                .push_back(plan(index, m));
+    }
+    auto bySelectivity = [](const MatcherPlan& a, const MatcherPlan& b) {
+        return a.estimate < b.estimate;
+    };
+    std::sort(include.begin(), include.end(), bySelectivity);
+    std::sort(exclude.begin(), exclude.end(), bySelectivity);
+
+    // start from the most selective matcher, e.g., to match
+    //     {__name__=~"foo.*", job="bar"}
+    // if few series have job="bar", start from those, rather than expanding
+    // every posting for __name__.
+    PostingList candidates;
+    auto next = include.begin();
+    if (next != include.end()) {
+        candidates = next->materialise(index);
+        ++next;
+    } else {
+        // only negative matchers, start from everything
+        candidates = PostingList({allRefs.begin(), allRefs.end()});
+    }
+
+    std::vector<const LabelMatcher*> deferred;
+    auto narrow = [&](const MatcherPlan& p) {
+        if (candidates.empty()) {
+            return;
         }
-        if (!matcher(itr->second)) {
-            // label exists, but is not accepted by the filter.
-            return false;
+        if (p.estimate > candidates.size() * LabelCheckCost) {
+            // cheaper to check the labels of the few remaining candidates
+            deferred.push_back(p.matcher);
+            return;
         }
+        auto refs = p.materialise(index);
+        candidates = p.matcher->type == MatchType::Match
+                             ? intersect(candidates, refs)
+                             : difference(candidates, refs);
+    };
+    std::for_each(next, include.end(), narrow);
+    std::for_each(exclude.begin(), exclude.end(), narrow);
+
+    if (deferred.empty() || candidates.empty()) {
+        return candidates;
     }
-    // if no matchers, or they all pass, accept the series.
-    return true;
+
+    PostingList result;
+    for (auto ref : candidates) {
+        // lazily loaded series are decoded only for the check, rather than
+        // being kept for the life of the index
+        std::optional<Series> decoded;
+        if (index.series.isLazy()) {
+            decoded = index.series.decode(ref);
+        }
+        const auto& series = decoded ? *decoded : index.series.at(ref);
+        if (std::all_of(deferred.begin(),
+                        deferred.end(),
+                        [&series](const auto* m) { return (*m)(series); })) {
+            result.push_back(ref);
+        }
+    }
+    return result;
 }
 
-void SeriesFilter::operator()(const Index& index,
-                              PerLabelRefs& seriesRefs) const {
-    for (const auto& postingOffset : index.postings) {
-        (*this)(postingOffset, index, seriesRefs);
+bool SeriesFilter::LabelMatcher::operator()(const Series& series) const {
+    auto itr = series.labels.find(key);
+    bool present = itr != series.labels.end();
+    auto check = [&] { return accepts(itr->second); };
+    switch (type) {
+    case MatchType::Match:
+        return present && check();
+    case MatchType::NotMatch:
+        return !present || !check();
+    case MatchType::Absent:
+        return !present;
     }
+    return false;
 }
 
-void SeriesFilter::operator()(PostingOffset po,
-                              const Index& index,
-                              PerLabelRefs& seriesRefs) const {
-    if (auto itr = matchers.find(po.labelKey); itr != matchers.end()) {
-        const auto& [labelKey, matcher] = *itr;
-        if (matcher(po.labelValue)) {
-            // collect up all references to series which match this
-            // specific label matcher
-            for (const auto& seriesRef : index.getSeriesRefs(po)) {
-                seriesRefs[labelKey].insert(seriesRef);
-            }
+bool SeriesFilter::operator()(const Series& series) const {
+    // if no matchers, or they all pass, accept the series.
+    return std::all_of(matchers.begin(),
+                       matchers.end(),
+                       [&series](const auto& m) { return m(series); });
+}
+
+bool SeriesFilter::mayMatch(const LabelSummary& summary) const {
+    // only positive matchers require a label to be present; negative and
+    // absent matchers may match series without it.
+    return std::all_of(matchers.begin(), matchers.end(), [&](const auto& m) {
+        if (m.type != MatchType::Match) {
+            return true;
         }
-    }
+        if (!summary.mayContainLabel(m.key)) {
+            return false;
+        }
+        return !m.exactValue || summary.mayContainValue(m.key, *m.exactValue);
+    });
 }
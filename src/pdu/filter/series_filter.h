@@ -3,10 +3,12 @@
 #include "pdu/block/index.h"
 
 #include <functional>
-#include <map>
-#include <set>
+#include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 namespace pdu::filter {
 using Filter = std::function<bool(std::string_view)>;
@@ -19,31 +21,129 @@ Filter regex(std::string expression);
 class SeriesFilter {
 public:
     using ValueMatcher = std::function<bool(std::string_view)>;
-    using PerLabelRefs = std::map<std::string_view, std::set<size_t>>;
+    /**
+     * Evaluates many values in one call, appending whether each is
+     * accepted to results. Allows expensive matchers (e.g., Python
+     * callbacks needing the GIL) to pay their overhead once per batch.
+     */
+    using BatchMatcher = std::function<void(
+            const std::vector<std::string_view>& values,
+            std::vector<bool>& results)>;
+
+    // results of a matcher by label value
+    struct MatchCache;
+
+    enum class MatchType {
+        // the label is present, and the value is accepted (= and =~)
+        Match,
+        // the label is absent, or the value is not accepted (!= and !~)
+        NotMatch,
+        // the label is absent
+        Absent,
+    };
+
+    struct LabelMatcher {
+        LabelMatcher(std::string key,
+                     MatchType type,
+                     ValueMatcher valueMatcher = {},
+                     BatchMatcher batchMatcher = {},
+                     bool memoise = true);
+
+        std::string key;
+        MatchType type;
+        // unused for Absent. If batchMatcher is set, it is used instead.
+        ValueMatcher valueMatcher;
+        BatchMatcher batchMatcher;
+        // each distinct value is only evaluated once, across every block
+        // and the head. Shared by copies of the filter; null for matchers
+        // cheaper than the lookup (e.g., exact matches).
+        std::shared_ptr<MatchCache> cache;
+        // set if only this exact value is accepted, allowing blocks
+        // without it to be skipped
+        std::optional<std::string> exactValue;
+
+        bool operator()(const Series& series) const;
+
+        // whether the value is accepted, ignoring the MatchType
+        bool accepts(std::string_view value) const;
+
+        // as accepts(), for many values at once
+        std::vector<bool> acceptsAll(
+                const std::vector<std::string_view>& values) const;
+    };
 
     void addFilter(std::string_view key, ValueMatcher valueMatcher) {
-        matchers.try_emplace(std::string(key), std::move(valueMatcher));
+        matchers.emplace_back(
+                std::string(key), MatchType::Match, std::move(valueMatcher));
     }
 
     void addFilter(std::string_view key, std::string value) {
         using namespace pdu::filter;
-        addFilter(key, exactly(std::move(value)));
+        matchers.emplace_back(std::string(key),
+                              MatchType::Match,
+                              exactly(value),
+                              BatchMatcher{},
+                              false);
+        matchers.back().exactValue = std::move(value);
     }
 
-    std::set<size_t> operator()(const Index& index) const;
+    void addBatchFilter(std::string_view key, BatchMatcher batchMatcher) {
+        matchers.emplace_back(std::string(key),
+                              MatchType::Match,
+                              ValueMatcher{},
+                              std::move(batchMatcher));
+    }
+
+    /**
+     * Exclude series where the label is present and the value accepted by
+     * @p valueMatcher. Series without the label are kept, as in PromQL.
+     */
+    void addNegativeFilter(std::string_view key, ValueMatcher valueMatcher) {
+        matchers.emplace_back(
+                std::string(key), MatchType::NotMatch, std::move(valueMatcher));
+    }
+
+    void addNegativeFilter(std::string_view key, std::string value) {
+        using namespace pdu::filter;
+        matchers.emplace_back(std::string(key),
+                              MatchType::NotMatch,
+                              exactly(std::move(value)),
+                              BatchMatcher{},
+                              false);
+    }
+
+    // only accept series which do not have the label at all
+    void addAbsentFilter(std::string_view key) {
+        matchers.emplace_back(std::string(key),
+                              MatchType::Absent,
+                              ValueMatcher{},
+                              BatchMatcher{},
+                              false);
+    }
+
+    /**
+     * Find the refs of series in the index accepted by every matcher.
+     *
+     * The number of series each matcher selects is estimated from the
+     * lengths of its postings lists, and the most selective postings are
+     * decoded first. Matchers whose postings are large compared to the
+     * remaining candidates are checked against the labels of those
+     * candidates instead.
+     */
+    PostingList operator()(const Index& index) const;
 
     bool operator()(const Series& series) const;
 
+    /**
+     * Whether any series in a block with the given summary could match.
+     * If false, the block can be skipped without reading its postings.
+     */
+    bool mayMatch(const LabelSummary& summary) const;
+
     bool empty() const {
         return matchers.empty();
     }
 
 private:
-    void operator()(const Index& index, PerLabelRefs& seriesRefs) const;
-
-    void operator()(PostingOffset po,
-                    const Index& index,
-                    PerLabelRefs& seriesRefs) const;
-
-    std::map<std::string, ValueMatcher, std::less<>> matchers;
-};
\ No newline at end of file
+    std::vector<LabelMatcher> matchers;
+};
@@ -1,12 +1,13 @@
 #include "series_iterator.h"
 
+#include <algorithm>
 #include <utility>
 
 CrossIndexSampleIterator CrossIndexSeries::getSamples() const {
     std::list<SeriesSampleIterator> sampleIterators;
 
     for (const auto& [source, series] : seriesCollection) {
-        sampleIterators.emplace_back(series, source->getCachePtr());
+        sampleIterators.emplace_back(series, source->getCachePtr(), range);
     }
 
     return {std::move(sampleIterators)};
@@ -17,48 +18,66 @@ ChunkIterator CrossIndexSeries::getChunks() const {
 }
 
 SeriesIterator::SeriesIterator(
-        std::vector<FilteredSeriesSourceIterator> indexes)
-    : indexes(std::move(indexes)) {
+        std::vector<FilteredSeriesSourceIterator> indexes, TimeRange range)
+    : indexes(std::move(indexes)), range(range) {
+    heap.reserve(this->indexes.size());
+    matching.reserve(this->indexes.size());
+    for (size_t i = 0; i < this->indexes.size(); ++i) {
+        if (this->indexes[i] != end(this->indexes[i])) {
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) {
+        return laterSeries(a, b);
+    });
     increment();
 }
 
-void SeriesIterator::increment() {
-    std::list<FilteredSeriesSourceIterator*> indexesWithSeries;
-
-    for (auto& fi : indexes) {
-        if (fi == end(fi)) {
-            continue;
-        }
-        if (indexesWithSeries.empty()) {
-            indexesWithSeries.push_back(&fi);
-            continue;
-        }
-        const auto& currSeries = (*indexesWithSeries.front())->getSeries();
+bool SeriesIterator::laterSeries(size_t a, size_t b) const {
+    return compare(indexes[a]->getSeries(), indexes[b]->getSeries()) > 0;
+}
 
-        auto res = compare(fi->getSeries(), currSeries);
-        if (res > 0) {
-            continue;
-        }
-        if (res < 0) {
-            indexesWithSeries.clear();
-        }
-        indexesWithSeries.push_back(&fi);
-    }
+void SeriesIterator::increment() {
+    auto cmp = [this](size_t a, size_t b) { return laterSeries(a, b); };
 
-    if (indexesWithSeries.empty()) {
+    if (heap.empty()) {
         value = {};
         return;
     }
 
+    // pop every source whose current series matches the lowest series
+    matching.clear();
+    std::pop_heap(heap.begin(), heap.end(), cmp);
+    matching.push_back(heap.back());
+    heap.pop_back();
+
+    const auto& lowest = indexes[matching.front()]->getSeries();
+    while (!heap.empty() &&
+           compare(indexes[heap.front()]->getSeries(), lowest) == 0) {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        matching.push_back(heap.back());
+        heap.pop_back();
+    }
+
+    // keep the sources in their original order (i.e., blocks by time, then
+    // the head) regardless of where they were in the heap
+    std::sort(matching.begin(), matching.end());
+
     std::vector<std::pair<std::shared_ptr<SeriesSource>,
                           std::shared_ptr<const Series>>>
             seriesCollection;
+    seriesCollection.reserve(matching.size());
 
-    for (auto* index : indexesWithSeries) {
-        seriesCollection.emplace_back(index->getSource(),
-                                      (**index).getSeriesPtr());
-        ++(*index);
+    for (auto idx : matching) {
+        auto& index = indexes[idx];
+        seriesCollection.emplace_back(index.getSource(),
+                                      index->getSeriesPtr());
+        ++index;
+        if (index != end(index)) {
+            heap.push_back(idx);
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        }
     }
 
-    value = {std::move(seriesCollection)};
+    value = {std::move(seriesCollection), range};
 }
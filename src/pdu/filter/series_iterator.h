@@ -16,6 +16,9 @@ struct CrossIndexSeries {
                           std::shared_ptr<const Series>>>
             seriesCollection;
 
+    // samples outside of this range will not be iterated
+    TimeRange range;
+
     const Series& getSeries() const {
         if (seriesCollection.empty()) {
             throw std::logic_error(
@@ -45,7 +48,8 @@ class SeriesIterator
     : public iterator_facade<SeriesIterator, CrossIndexSeries> {
 public:
     SeriesIterator() = default;
-    SeriesIterator(std::vector<FilteredSeriesSourceIterator> indexes);
+    SeriesIterator(std::vector<FilteredSeriesSourceIterator> indexes,
+                   TimeRange range = {});
 
     void increment();
     const CrossIndexSeries& dereference() const {
@@ -57,6 +61,17 @@ public:
     }
 
 private:
+    // heap comparator, orders sources so the one with the lowest current
+    // series is at the front
+    bool laterSeries(size_t a, size_t b) const;
+
     std::vector<FilteredSeriesSourceIterator> indexes;
+    // min-heap of indexes (positions in the above vector) which have not yet
+    // reached their end, ordered by their current series
+    std::vector<size_t> heap;
+    // scratch space for the sources found to share the lowest series; kept
+    // to avoid reallocating on every increment
+    std::vector<size_t> matching;
+    TimeRange range;
     CrossIndexSeries value;
 };
\ No newline at end of file
@@ -47,7 +47,7 @@ std::optional<HistogramTimeSpan> HistogramAccumulator::addSeries(
         const CrossIndexSeries& series) {
     const auto& labels = series.getSeries().labels;
 
-    auto canonLabels = canonicalise(labels);
+    auto canonLabels = canonicalise({labels.begin(), labels.end()});
 
     auto res = partialHistograms.try_emplace(canonLabels);
     auto itr = res.first;
@@ -106,8 +106,8 @@ bool isSameHistogram(const Series& a, const Series& b) {
         return false;
     }
 
-    auto aLabels = stripHistogramLabels(a.labels);
-    auto bLabels = stripHistogramLabels(b.labels);
+    auto aLabels = stripHistogramLabels({a.labels.begin(), a.labels.end()});
+    auto bLabels = stripHistogramLabels({b.labels.begin(), b.labels.end()});
 
     return aLabels == bLabels;
 }
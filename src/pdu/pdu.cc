@@ -1,19 +1,93 @@
 #include "pdu.h"
 
+#include "pdu/block/block_registry.h"
+#include "pdu/block/chunk_file_cache.h"
 #include "pdu/block/head_chunks.h"
 #include "pdu/block/index_iterator.h"
 #include "pdu/filter/filtered_index_iterator.h"
 #include "pdu/filter/series_filter.h"
+#include "pdu/util/thread_pool.h"
 
 #include <algorithm>
+#include <deque>
+#include <future>
+#include <map>
+#include <set>
+
+PrometheusData::PrometheusData(const boost::filesystem::path& dataDir,
+                               SeriesLoadMode mode,
+                               size_t threads,
+                               ChunkType walChunkType,
+                               bool populate)
+    : dataDir(dataDir),
+      mode(mode),
+      threads(threads),
+      walChunkType(walChunkType),
+      populate(populate) {
+    load();
+}
+
+void PrometheusData::refresh() {
+    *this = refreshed();
+}
+
+PrometheusData PrometheusData::refreshed() const {
+    auto result = *this;
+    result.load();
+    return result;
+}
+
+void PrometheusData::load() {
+    // blocks are independent of each other and of the head, so may be
+    // loaded concurrently. With no worker threads, the pool runs each
+    // task immediately on this thread.
+    ThreadPool pool(threads > 1 ? threads : 0);
+
+    // start on the head first; replaying the WAL is likely to be the
+    // single most expensive task. If already loaded, only data written
+    // since needs reading, unless the head has been truncated. The head
+    // already loaded is left as is, it may still be in use.
+    auto headFuture = pool.submit([this]() -> std::shared_ptr<HeadChunks> {
+        if (headChunks) {
+            if (auto head = headChunks->refreshed()) {
+                return head;
+            }
+        }
+        return std::make_shared<HeadChunks>(dataDir, threads, walChunkType);
+    });
+
+    // blocks are immutable, those already loaded need not be read again.
+    // Blocks loaded by another PrometheusData over the same directory are
+    // shared through the BlockRegistry.
+    std::map<std::string, std::shared_ptr<Index>> loaded;
+    for (const auto& indexPtr : indexes) {
+        loaded.emplace(indexPtr->meta.ulid, indexPtr);
+    }
+    indexes.clear();
+
+    std::vector<std::future<std::shared_ptr<Index>>> indexFutures;
+    for (const auto& indexFile : findIndexFiles(dataDir)) {
+        // block directories are named by ulid
+        auto itr = loaded.find(indexFile.parent_path().filename().string());
+        if (itr != loaded.end()) {
+            indexes.push_back(itr->second);
+            continue;
+        }
+        indexFutures.push_back(
+                pool.submit([indexFile, mode = mode, populate = populate] {
+                    return BlockRegistry::instance().load(
+                            indexFile, mode, populate);
+                }));
+    }
+
+    for (auto& future : indexFutures) {
+        indexes.push_back(future.get());
+    }
 
-PrometheusData::PrometheusData(const boost::filesystem::path& dataDir) {
-    std::set<std::string> obsoleteHeads;
     std::set<std::string> obsoleteBlocks;
-    for (auto indexPtr : IndexIterator(dataDir)) {
+    for (const auto& indexPtr : indexes) {
         const auto& parents = indexPtr->meta.compaction.parentULIDs;
         obsoleteBlocks.insert(parents.begin(), parents.end());
-        indexes.push_back(indexPtr);
     }
 
     // remove blocks which have already been superseded by a compacted block
@@ -25,7 +99,7 @@ PrometheusData::PrometheusData(const boost::filesystem::path& dataDir) {
                                  }),
                   indexes.end());
 
-    headChunks = std::make_shared<HeadChunks>(dataDir);
+    headChunks = headFuture.get();
 
     std::sort(indexes.begin(), indexes.end(), [](const auto& a, const auto& b) {
         return a->meta.minTime < b->meta.minTime;
@@ -38,15 +112,99 @@ SeriesIterator PrometheusData::begin() const {
 }
 
 SeriesIterator PrometheusData::filtered(const SeriesFilter& filter) const {
+    TimeRange range;
+    return filtered(filter, range.minTime, range.maxTime);
+}
+
+SeriesIterator PrometheusData::filtered(const SeriesFilter& filter,
+                                        int64_t minTime,
+                                        int64_t maxTime) const {
+    TimeRange range{minTime, maxTime};
     std::vector<FilteredSeriesSourceIterator> filteredIndexes;
 
     for (auto indexPtr : indexes) {
-        filteredIndexes.emplace_back(indexPtr, filter);
+        if (!range.overlaps(indexPtr->meta.minTime, indexPtr->meta.maxTime)) {
+            continue;
+        }
+        // skip blocks lacking a label the filter requires, without
+        // decoding any postings
+        if (!filter.mayMatch(indexPtr->labelSummary)) {
+            continue;
+        }
+        filteredIndexes.emplace_back(indexPtr, filter, range);
     }
 
-    filteredIndexes.emplace_back(headChunks, filter);
+    filteredIndexes.emplace_back(headChunks, filter, range);
 
-    return SeriesIterator(std::move(filteredIndexes));
+    return SeriesIterator(std::move(filteredIndexes), range);
+}
+
+void PrometheusData::forEachShard(const SeriesFilter& filter,
+                                  const ShardFn& fn,
+                                  size_t threads,
+                                  size_t shardSize) const {
+    ThreadPool pool(threads > 1 ? threads : 0);
+    // bound the shards waiting or in progress, so memory use does not grow
+    // with the number of series if fn is slower than the merge.
+    const size_t maxInFlight = std::max(size_t(1), pool.size() * 4);
+    std::deque<std::future<void>> inFlight;
+
+    size_t shardIdx = 0;
+    auto submit = [&](std::vector<CrossIndexSeries> shard) {
+        if (inFlight.size() >= maxInFlight) {
+            inFlight.front().get();
+            inFlight.pop_front();
+        }
+        inFlight.push_back(pool.submit(
+                [&fn, idx = shardIdx++, shard = std::move(shard)] {
+                    fn(idx, shard);
+                }));
+    };
+
+    std::vector<CrossIndexSeries> shard;
+    shard.reserve(shardSize);
+    for (const auto& series : filtered(filter)) {
+        shard.push_back(series);
+        if (shard.size() >= shardSize) {
+            submit(std::move(shard));
+            shard.clear();
+            shard.reserve(shardSize);
+        }
+    }
+    if (!shard.empty()) {
+        submit(std::move(shard));
+    }
+
+    for (auto& future : inFlight) {
+        future.get();
+    }
+}
+
+void PrometheusData::parallelForEach(
+        const SeriesFilter& filter,
+        const std::function<void(const CrossIndexSeries&)>& fn,
+        size_t threads) const {
+    forEachShard(
+            filter,
+            [&fn](size_t, const std::vector<CrossIndexSeries>& series) {
+                for (const auto& s : series) {
+                    fn(s);
+                }
+            },
+            threads);
+}
+
+void PrometheusData::setChunkAccessPattern(AccessPattern pattern) const {
+    for (const auto& indexPtr : indexes) {
+        indexPtr->getCache().setAccessPattern(pattern);
+    }
+    headChunks->getCache().setAccessPattern(pattern);
+}
+
+void PrometheusData::saveLabelSummaries() const {
+    for (const auto& indexPtr : indexes) {
+        indexPtr->saveLabelSummary();
+    }
 }
 
 HistogramIterator PrometheusData::getHistograms() const {
@@ -56,10 +214,18 @@ HistogramIterator PrometheusData::getHistograms() const {
 }
 
 namespace pdu {
-PrometheusData load(const boost::filesystem::path& path) {
-    return {path};
+PrometheusData load(const boost::filesystem::path& path,
+                    SeriesLoadMode mode,
+                    size_t threads,
+                    ChunkType walChunkType,
+                    bool populate) {
+    return {path, mode, threads, walChunkType, populate};
 }
-PrometheusData load(const std::string& path) {
-    return {path};
+PrometheusData load(const std::string& path,
+                    SeriesLoadMode mode,
+                    size_t threads,
+                    ChunkType walChunkType,
+                    bool populate) {
+    return {path, mode, threads, walChunkType, populate};
 }
 } // namespace pdu
\ No newline at end of file
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "histogram/histogram_iterator.h"
+#include "pdu/block/chunk_reference.h"
 #include "pdu/filter/series_iterator.h"
 
 #include <boost/filesystem.hpp>
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 
 class SeriesFilter;
@@ -13,7 +18,29 @@ class HeadChunks;
 
 class PrometheusData {
 public:
-    PrometheusData(const boost::filesystem::path& dataDir);
+    /**
+     * Load all blocks and the head from a Prometheus data directory.
+     *
+     * If @p threads is greater than 1, block indexes and the head/WAL are
+     * loaded concurrently on a pool of that many threads, and the WAL is
+     * itself replayed on that many threads.
+     *
+     * Samples read from the WAL are held in memory as chunks of
+     * @p walChunkType; ChunkType::XORData is far more compact than the
+     * default ChunkType::Raw, but costs more CPU to load.
+     *
+     * Blocks already loaded elsewhere in the process (e.g., by an earlier
+     * load of the same directory still in use) are shared rather than
+     * parsed again; see BlockRegistry.
+     *
+     * If @p populate is true, index files are pre-faulted when mapped
+     * (MAP_POPULATE) rather than read in on demand.
+     */
+    PrometheusData(const boost::filesystem::path& dataDir,
+                   SeriesLoadMode mode = SeriesLoadMode::Eager,
+                   size_t threads = 1,
+                   ChunkType walChunkType = ChunkType::Raw,
+                   bool populate = false);
 
     SeriesIterator begin() const;
     EndSentinel end() const {
@@ -22,14 +49,136 @@ public:
 
     SeriesIterator filtered(const SeriesFilter& filter) const;
 
+    /**
+     * Iterate series matching the filter which have samples within
+     * [minTime, maxTime] (inclusive, in milliseconds), and only the samples
+     * within that range.
+     *
+     * Blocks which do not overlap the range are not visited at all.
+     */
+    SeriesIterator filtered(const SeriesFilter& filter,
+                            int64_t minTime,
+                            int64_t maxTime) const;
+
     HistogramIterator getHistograms() const;
 
+    using ShardFn = std::function<void(
+            size_t shard, const std::vector<CrossIndexSeries>& series)>;
+
+    /**
+     * Split the series matching @p filter into contiguous shards, in label
+     * order, and call @p fn for each shard on a pool of @p threads.
+     *
+     * Shards are numbered in order from 0, but may be processed in any
+     * order and concurrently; fn must be safe to call from multiple
+     * threads. Series are merged across sources on the calling thread, the
+     * (typically far more expensive) reading of samples is left to fn.
+     *
+     * Exceptions thrown by fn are rethrown from here.
+     */
+    void forEachShard(const SeriesFilter& filter,
+                      const ShardFn& fn,
+                      size_t threads,
+                      size_t shardSize = DefaultShardSize) const;
+
+    /**
+     * Call @p fn for every series matching @p filter, concurrently on a
+     * pool of @p threads, in no particular order.
+     */
+    void parallelForEach(const SeriesFilter& filter,
+                         const std::function<void(const CrossIndexSeries&)>& fn,
+                         size_t threads) const;
+
+    /**
+     * Call @p fn for every series matching @p filter, concurrently on a
+     * pool of @p threads, and collect the results in label order.
+     */
+    template <class Fn>
+    auto parallelTransform(const SeriesFilter& filter,
+                           Fn&& fn,
+                           size_t threads) const {
+        using Result = std::invoke_result_t<Fn&, const CrossIndexSeries&>;
+        std::mutex mutex;
+        std::map<size_t, std::vector<Result>> shardResults;
+        forEachShard(
+                filter,
+                [&](size_t shard, const std::vector<CrossIndexSeries>& series) {
+                    std::vector<Result> results;
+                    results.reserve(series.size());
+                    for (const auto& s : series) {
+                        results.push_back(fn(s));
+                    }
+                    std::lock_guard lock(mutex);
+                    shardResults.emplace(shard, std::move(results));
+                },
+                threads);
+
+        std::vector<Result> results;
+        for (auto& [shard, shardResult] : shardResults) {
+            std::move(shardResult.begin(),
+                      shardResult.end(),
+                      std::back_inserter(results));
+        }
+        return results;
+    }
+
+    /**
+     * Pick up data written since loading, or the last refresh.
+     *
+     * New blocks are loaded, and blocks which have been deleted or
+     * compacted into another are dropped. Only head chunks and WAL records
+     * written since are read, unless the head has been truncated, in which
+     * case it is reloaded.
+     *
+     * Iterators and series obtained before are unaffected, and continue to
+     * see the data as it was. Copies of this PrometheusData are also left
+     * as they were.
+     */
+    void refresh();
+
+    /**
+     * Get a refreshed copy of this data, see refresh(). This is not
+     * modified, so may be read concurrently.
+     */
+    PrometheusData refreshed() const;
+
+    /**
+     * Hint how chunk files of every block and the head will be read, e.g.,
+     * Sequential when dumping all data.
+     */
+    void setChunkAccessPattern(AccessPattern pattern) const;
+
+    /**
+     * Save the label summary of every block to a sidecar file in the block
+     * directory, so later loads need not build them. Blocks are
+     * immutable, so a summary remains valid for the life of the block.
+     */
+    void saveLabelSummaries() const;
+
 private:
+    void load();
+
+    static constexpr size_t DefaultShardSize = 256;
+
+    boost::filesystem::path dataDir;
+    SeriesLoadMode mode;
+    size_t threads;
+    ChunkType walChunkType;
+    bool populate;
+
     std::vector<std::shared_ptr<Index>> indexes;
     std::shared_ptr<HeadChunks> headChunks;
 };
 
 namespace pdu {
-PrometheusData load(const boost::filesystem::path& path);
-PrometheusData load(const std::string& path);
+PrometheusData load(const boost::filesystem::path& path,
+                    SeriesLoadMode mode = SeriesLoadMode::Eager,
+                    size_t threads = 1,
+                    ChunkType walChunkType = ChunkType::Raw,
+                    bool populate = false);
+PrometheusData load(const std::string& path,
+                    SeriesLoadMode mode = SeriesLoadMode::Eager,
+                    size_t threads = 1,
+                    ChunkType walChunkType = ChunkType::Raw,
+                    bool populate = false);
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <boost/io/ios_state.hpp>
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <optional>
 #include <type_traits>
 
 namespace pdu {
@@ -24,20 +26,28 @@ void serialise_impl(Encoder& e, const ChunkReference& cr) {
 
     e.write_int(uint8_t(cr.type));
 }
-void serialise_impl(Encoder& e, const ChunkView& cv) {
-    // find the length of the full chunk including data and header info
+std::string_view chunk_data(const ChunkView& cv) {
     auto end = cv.dataOffset + cv.dataLen;
     size_t length = end - cv.chunkOffset;
+    return cv.res->getView().substr(cv.chunkOffset, length);
+}
 
-    // get a view to the full chunk
-    auto data = cv.res->getView().substr(cv.chunkOffset, length);
-
+void serialise_chunk_data(Encoder& e, std::string_view data) {
     // write length + data
     e.write_varuint(data.size());
     e.write(data);
 }
+
+void serialise_impl(Encoder& e, const ChunkView& cv) {
+    serialise_chunk_data(e, chunk_data(cv));
+}
 void serialise_impl(Encoder& e, const SeriesSampleIterator& ssi) {
+    // chunks are written whole, so may include samples either side of a
+    // time range, but chunks entirely outside it are dropped.
     for (const auto& chunkRef : *ssi.series) {
+        if (!ssi.range.overlaps(chunkRef)) {
+            continue;
+        }
         serialise_impl(e, chunkRef);
         serialise_impl(e, ChunkView(*ssi.cfc, chunkRef));
     }
@@ -51,7 +61,10 @@ void serialise_impl(Encoder& e, const SeriesSampleIterator& ssi) {
 void serialise_impl(Encoder& e, const CrossIndexSampleIterator& cisi) {
     size_t chunkCount = 0;
     for (const auto& itr : cisi.subiterators) {
-        chunkCount += itr.series->chunks.size();
+        chunkCount += std::count_if(
+                itr.series->begin(),
+                itr.series->end(),
+                [&itr](const auto& cr) { return itr.range.overlaps(cr); });
     }
 
     e.write_varuint(chunkCount);
@@ -60,11 +73,29 @@ void serialise_impl(Encoder& e, const CrossIndexSampleIterator& cisi) {
     }
 }
 
+// a chunk to be serialised, and the cache to read it from
+struct PendingChunk {
+    ChunkFileCache* cache;
+    const ChunkReference* ref;
+};
+
 /**
- * Serialise a CrossIndexSeries, writing all data required to fully
- * reconstruct the series.
+ * Collect the chunks serialise_impl would write for the series, in order.
+ *
+ * Taken from the chunk references, no chunks are read.
  */
-void serialise_impl(Encoder& e, const CrossIndexSeries& cis) {
+void collect_chunks(const CrossIndexSeries& cis,
+                    std::vector<PendingChunk>& chunks) {
+    for (const auto& [source, series] : cis.seriesCollection) {
+        for (const auto& chunkRef : *series) {
+            if (cis.range.overlaps(chunkRef)) {
+                chunks.push_back({source->getCachePtr().get(), &chunkRef});
+            }
+        }
+    }
+}
+
+void serialise_labels(Encoder& e, const CrossIndexSeries& cis) {
     const auto& labels = cis.getSeries().labels;
     e.write_varuint(labels.size());
     for (const auto& [key, value] : labels) {
@@ -73,6 +104,14 @@ void serialise_impl(Encoder& e, const CrossIndexSeries& cis) {
         e.write_varuint(value.size());
         e.write(value);
     }
+}
+
+/**
+ * Serialise a CrossIndexSeries, writing all data required to fully
+ * reconstruct the series.
+ */
+void serialise_impl(Encoder& e, const CrossIndexSeries& cis) {
+    serialise_labels(e, cis);
     serialise_impl(e, cis.getSamples());
 }
 
@@ -105,19 +144,105 @@ size_t getNumSeries(const PrometheusData& pd) {
     return getNumSeries(pd.begin());
 }
 
+/**
+ * Serialise series, reading the chunks of a window of series in file order
+ * rather than series order, to avoid random I/O on slow storage. The
+ * output is identical to serialising each series in turn.
+ *
+ * @p readWindow is the (approximate) number of chunks copied and held in
+ * memory at once.
+ */
 template <class SeriesIterable>
-void serialise_impl(Encoder& e, const SeriesIterable& series) {
+void serialise_windowed(Encoder& e,
+                        const SeriesIterable& series,
+                        size_t readWindow) {
+    struct ChunkRead {
+        const PendingChunk* chunk;
+        // position of the chunk data in chunkData
+        size_t seriesIdx;
+        size_t chunkIdx;
+    };
+
+    // copies hold the series and chunk caches referenced by chunks
+    std::vector<CrossIndexSeries> window;
+    std::vector<std::vector<PendingChunk>> chunks;
+    std::vector<std::vector<std::string>> chunkData;
+    std::vector<ChunkRead> reads;
+
+    auto flush = [&] {
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            for (size_t j = 0; j < chunks[i].size(); ++j) {
+                reads.push_back({&chunks[i][j], i, j});
+            }
+        }
+        std::sort(reads.begin(),
+                  reads.end(),
+                  [](const ChunkRead& a, const ChunkRead& b) {
+                      if (a.chunk->cache != b.chunk->cache) {
+                          return std::less<>()(a.chunk->cache,
+                                               b.chunk->cache);
+                      }
+                      return std::make_pair(a.chunk->ref->getSegmentFileId(),
+                                            a.chunk->ref->getOffset()) <
+                             std::make_pair(b.chunk->ref->getSegmentFileId(),
+                                            b.chunk->ref->getOffset());
+                  });
+        for (const auto& read : reads) {
+            ChunkView cv(*read.chunk->cache, *read.chunk->ref);
+            chunkData[read.seriesIdx][read.chunkIdx] = chunk_data(cv);
+        }
+
+        // now write series in order
+        for (size_t i = 0; i < window.size(); ++i) {
+            serialise_labels(e, window[i]);
+            e.write_varuint(chunks[i].size());
+            for (size_t j = 0; j < chunks[i].size(); ++j) {
+                serialise_impl(e, *chunks[i][j].ref);
+                serialise_chunk_data(e, chunkData[i][j]);
+            }
+        }
+
+        window.clear();
+        chunks.clear();
+        chunkData.clear();
+        reads.clear();
+    };
+
+    size_t pending = 0;
+    for (const auto& item : series) {
+        const CrossIndexSeries& cis = item;
+        window.push_back(cis);
+        collect_chunks(cis, chunks.emplace_back());
+        chunkData.emplace_back(chunks.back().size());
+        pending += chunks.back().size();
+        if (pending >= readWindow) {
+            flush();
+            pending = 0;
+        }
+    }
+    flush();
+}
+
+template <class SeriesIterable>
+void serialise_impl(Encoder& e,
+                    const SeriesIterable& series,
+                    size_t readWindow) {
     e.write_varuint(getNumSeries(series));
 
+    if (readWindow) {
+        serialise_windowed(e, series, readWindow);
+        return;
+    }
+
     for (const auto& cis : series) {
         serialise_impl(e, cis);
     }
 }
 
-template void serialise_impl(Encoder&, const SeriesVector&);
-template void serialise_impl(Encoder&, const SeriesRefVector&);
-template void serialise_impl(Encoder&, const SeriesIterator&);
-template void serialise_impl(Encoder&, const PrometheusData&);
+template void serialise_impl(Encoder&, const SeriesVector&, size_t);
+template void serialise_impl(Encoder&, const SeriesRefVector&, size_t);
+template void serialise_impl(Encoder&, const SeriesIterator&, size_t);
+template void serialise_impl(Encoder&, const PrometheusData&, size_t);
 
 template <typename T, typename = void>
 constexpr bool is_iterable_v = false;
@@ -129,6 +254,27 @@ constexpr bool is_iterable_v<T,
                                          decltype(end(std::declval<T>()))>> =
         true;
 
+/**
+ * Every chunk of a full dump is read once. Read chunk files ahead
+ * aggressively while dumping, and drop their pages once done rather than
+ * leaving every chunk file resident.
+ */
+class FullScanHint {
+public:
+    FullScanHint(const PrometheusData& pd) : pd(pd) {
+        pd.setChunkAccessPattern(AccessPattern::Sequential);
+    }
+    FullScanHint(const FullScanHint&) = delete;
+    FullScanHint& operator=(const FullScanHint&) = delete;
+    ~FullScanHint() {
+        pd.setChunkAccessPattern(AccessPattern::DontNeed);
+        pd.setChunkAccessPattern(AccessPattern::Normal);
+    }
+
+private:
+    const PrometheusData& pd;
+};
+
 } // namespace detail
 
 void serialise(Encoder& e, const CrossIndexSeries& series) {
@@ -137,16 +283,20 @@ void serialise(Encoder& e, const CrossIndexSeries& series) {
 }
 
 template <class SeriesIterable>
-void serialise(Encoder& e, const SeriesIterable& series) {
+void serialise(Encoder& e, const SeriesIterable& series, size_t readWindow) {
     static_assert(pdu::detail::is_iterable_v<SeriesIterable>);
+    std::optional<detail::FullScanHint> hint;
+    if constexpr (std::is_same_v<SeriesIterable, PrometheusData>) {
+        hint.emplace(series);
+    }
     e.write_int(uint8_t(Magic::SeriesGroup));
-    detail::serialise_impl(e, series);
+    detail::serialise_impl(e, series, readWindow);
 }
 
-template void serialise(Encoder&, const SeriesVector&);
-template void serialise(Encoder&, const SeriesRefVector&);
-template void serialise(Encoder&, const SeriesIterator&);
-template void serialise(Encoder&, const PrometheusData&);
+template void serialise(Encoder&, const SeriesVector&, size_t);
+template void serialise(Encoder&, const SeriesRefVector&, size_t);
+template void serialise(Encoder&, const SeriesIterator&, size_t);
+template void serialise(Encoder&, const PrometheusData&, size_t);
 
 /// Deserialisation
 
@@ -186,65 +336,28 @@ std::shared_ptr<Resource> deserialise_labels(Decoder& d, Series& series) {
     // read labels
     auto numLabels = d.read_varuint();
     for (int i = 0; i < numLabels; ++i) {
-        // no need to copy the label values, decoding from in-memory
-        // (or mmapped) data already
+        // no need to copy the label values here, the series interns them
+        // in the symbol dictionary
         auto keySize = d.read_varuint();
         auto key = d.read_view(keySize);
 
         auto valSize = d.read_varuint();
         auto val = d.read_view(valSize);
-        series.labels.emplace(key, val);
+        series.addLabel(key, val);
     }
     return {};
 }
 
 std::shared_ptr<Resource> deserialise_labels(StreamDecoder& d, Series& series) {
-    std::string labelStorage;
-
-    struct StringRef {
-        uint64_t offset;
-        uint64_t length;
-
-        std::string_view getFrom(std::string_view data) const {
-            return data.substr(offset, length);
-        }
-    };
-
-    struct KVRef {
-        StringRef key;
-        StringRef value;
-    };
-    // the string will be reallocated as it is extended; collect up offsets
-    // into it rather than pointers.
-    std::list<KVRef> refs;
-
-    auto readStr = [&] {
-        auto size = d.read_varuint();
-        StringRef ref = {labelStorage.size(), size};
-        labelStorage += d.read(size);
-        return ref;
-    };
-
-    // read labels
+    // read labels. The series copies each label into the symbol dictionary,
+    // so the strings need not be kept.
     auto numLabels = d.read_varuint();
     for (int i = 0; i < numLabels; ++i) {
-        KVRef ref;
-
-        ref.key = readStr();
-        ref.value = readStr();
-
-        refs.emplace_back(std::move(ref));
-    }
-
-    auto res = std::make_shared<OwningMemResource>(std::move(labelStorage));
-
-    auto resView = res->getView();
-
-    for (const auto& [key, val] : refs) {
-        series.labels.emplace(key.getFrom(resView), val.getFrom(resView));
+        auto key = d.read(d.read_varuint());
+        auto val = d.read(d.read_varuint());
+        series.addLabel(key, val);
     }
-
-    return res;
+    return {};
 }
 
 template <class Dec>
@@ -283,7 +396,7 @@ DeserialisedSeries deserialise_series(Dec& d) {
         DeserialisedSource(std::shared_ptr<ChunkFileCache> cache)
             : cache(cache) {
         }
-        std::set<SeriesRef> getFilteredSeriesRefs(
+        PostingList getFilteredSeriesRefs(
                 const SeriesFilter& filter) const override {
             throw std::runtime_error(
                     "DeserialisedSource::getFilteredSeriesRefs not "
@@ -45,14 +45,22 @@ void serialise(Encoder& e, const CrossIndexSeries& series);
 /**
  * Serialise a Range of series, writing a magic value allowing a reader to
  * determine that multiple series were written, and how many.
+ *
+ * When serialising a whole PrometheusData, chunk files are advised
+ * Sequential while being read and DontNeed once done, leaving them with
+ * the Normal access pattern.
+ *
+ * If @p readWindow is non-zero, chunks are read in file order rather than
+ * series order, about that many at a time, avoiding random I/O on slow
+ * storage. The output is the same either way.
  */
 template <class SeriesIterable>
-void serialise(Encoder& e, const SeriesIterable& series);
+void serialise(Encoder& e, const SeriesIterable& series, size_t readWindow = 0);
 
-extern template void serialise(Encoder&, const SeriesVector&);
-extern template void serialise(Encoder&, const SeriesRefVector&);
-extern template void serialise(Encoder&, const SeriesIterator&);
-extern template void serialise(Encoder&, const PrometheusData&);
+extern template void serialise(Encoder&, const SeriesVector&, size_t);
+extern template void serialise(Encoder&, const SeriesRefVector&, size_t);
+extern template void serialise(Encoder&, const SeriesIterator&, size_t);
+extern template void serialise(Encoder&, const PrometheusData&, size_t);
 
 // Deserialisation
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string_view>
+
 class Encoder;
 class CrossIndexSampleIterator;
 class SeriesSampleIterator;
@@ -8,4 +10,7 @@ namespace pdu::detail {
 void serialise_impl(Encoder& e, const SeriesSampleIterator& ssi);
 void serialise_impl(Encoder& e, const CrossIndexSampleIterator& cisi);
 void serialise_impl(Encoder& e, const ChunkView& cv);
+
+// view of the full chunk including data and header info
+std::string_view chunk_data(const ChunkView& cv);
 } // namespace pdu::detail
\ No newline at end of file
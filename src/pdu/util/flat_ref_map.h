@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map from a series ref to T, using open addressing with linear
+ * probing.
+ *
+ * Values are held in insertion order in a deque, so references to them
+ * remain valid as the map grows; the probed table only holds the key and
+ * the index of the value. Entries cannot be removed.
+ *
+ * Iteration is in insertion order. Callers needing refs in sorted order
+ * should collect and sort them once, rather than paying for an ordered
+ * map on every lookup.
+ */
+template <class T>
+class FlatRefMap {
+public:
+    using key_type = uint64_t;
+    using value_type = std::pair<const key_type, T>;
+    using iterator = typename std::deque<value_type>::iterator;
+    using const_iterator = typename std::deque<value_type>::const_iterator;
+
+    iterator find(key_type key) {
+        auto index = slots.empty() ? Empty : slots[probe(key)].index;
+        return index == Empty ? entries.end() : entries.begin() + index;
+    }
+
+    const_iterator find(key_type key) const {
+        auto index = slots.empty() ? Empty : slots[probe(key)].index;
+        return index == Empty ? entries.end() : entries.begin() + index;
+    }
+
+    /**
+     * Insert a value constructed from @p args if @p key is not present.
+     *
+     * Returns an iterator to the value for key, and whether it was
+     * inserted.
+     */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(key_type key, Args&&... args) {
+        if (slots.empty()) {
+            rehash(MinSlots);
+        }
+        auto pos = probe(key);
+        if (slots[pos].index != Empty) {
+            return {entries.begin() + slots[pos].index, false};
+        }
+        // keep the load factor at or below 1/2, probes stay short even
+        // for the sequential refs Prometheus assigns.
+        if ((entries.size() + 1) * 2 > slots.size()) {
+            rehash(slots.size() * 2);
+            pos = probe(key);
+        }
+        slots[pos] = {key, uint32_t(entries.size())};
+        entries.emplace_back(
+                std::piecewise_construct,
+                std::forward_as_tuple(key),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+        return {std::prev(entries.end()), true};
+    }
+
+    T& operator[](key_type key) {
+        return try_emplace(key).first->second;
+    }
+
+    T& at(key_type key) {
+        auto itr = find(key);
+        if (itr == entries.end()) {
+            throw std::out_of_range("FlatRefMap::at: unknown key " +
+                                    std::to_string(key));
+        }
+        return itr->second;
+    }
+
+    const T& at(key_type key) const {
+        return const_cast<FlatRefMap&>(*this).at(key);
+    }
+
+    size_t count(key_type key) const {
+        return find(key) == entries.end() ? 0 : 1;
+    }
+
+    /**
+     * Size the table to hold @p count entries without rehashing.
+     */
+    void reserve(size_t count) {
+        auto wanted = std::max(MinSlots, slots.size());
+        while (wanted < count * 2) {
+            wanted *= 2;
+        }
+        if (wanted != slots.size()) {
+            rehash(wanted);
+        }
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    bool empty() const {
+        return entries.empty();
+    }
+
+    iterator begin() {
+        return entries.begin();
+    }
+    iterator end() {
+        return entries.end();
+    }
+    const_iterator begin() const {
+        return entries.begin();
+    }
+    const_iterator end() const {
+        return entries.end();
+    }
+
+private:
+    static constexpr uint32_t Empty = ~uint32_t(0);
+    static constexpr size_t MinSlots = 16;
+
+    struct Slot {
+        key_type key = 0;
+        uint32_t index = Empty;
+    };
+
+    size_t probe(key_type key) const {
+        // fibonacci hashing; takes the high bits of the product, so
+        // consecutive refs are spread across the table.
+        size_t mask = slots.size() - 1;
+        size_t pos = (key * 0x9E3779B97F4A7C15ull) >> shift;
+        while (slots[pos].index != Empty && slots[pos].key != key) {
+            pos = (pos + 1) & mask;
+        }
+        return pos;
+    }
+
+    void rehash(size_t slotCount) {
+        slots.assign(slotCount, {});
+        shift = 64;
+        for (size_t n = slotCount; n > 1; n >>= 1) {
+            --shift;
+        }
+        for (size_t i = 0; i < entries.size(); ++i) {
+            slots[probe(entries[i].first)] = {entries[i].first, uint32_t(i)};
+        }
+    }
+
+    std::vector<Slot> slots;
+    // 64 - log2(slots.size())
+    uint8_t shift = 64;
+    std::deque<value_type> entries;
+};
+
+/**
+ * FlatRefMap holding each value through a shared_ptr, so copies of the map
+ * share values rather than copying them.
+ *
+ * Values are copied on write: modifying a value still shared with another
+ * copy of the map first replaces it with a copy of its own, so the change
+ * is never seen through other copies. Other copies may therefore be read
+ * concurrently while this map is modified.
+ *
+ * Keys of values inserted or copied since the map was copied are recorded,
+ * so a caller may update whatever depends on just the values which changed.
+ */
+template <class T>
+class SharedRefMap {
+public:
+    using key_type = uint64_t;
+    using Map = FlatRefMap<std::shared_ptr<T>>;
+    using const_iterator = typename Map::const_iterator;
+
+    SharedRefMap() = default;
+
+    SharedRefMap(const SharedRefMap& other) : map(other.map) {
+    }
+
+    SharedRefMap& operator=(const SharedRefMap& other) {
+        map = other.map;
+        modified.clear();
+        return *this;
+    }
+
+    SharedRefMap(SharedRefMap&&) = default;
+    SharedRefMap& operator=(SharedRefMap&&) = default;
+
+    const_iterator find(key_type key) const {
+        return map.find(key);
+    }
+
+    const T& at(key_type key) const {
+        return *map.at(key);
+    }
+
+    /**
+     * Get the value for @p key to modify, inserting one constructed from
+     * @p args if not present.
+     *
+     * Returns the value, and whether it was inserted.
+     */
+    template <class... Args>
+    std::pair<T*, bool> try_emplace(key_type key, Args&&... args) {
+        auto [itr, inserted] = map.try_emplace(key);
+        auto& value = itr->second;
+        if (inserted) {
+            value = std::make_shared<T>(std::forward<Args>(args)...);
+            modified.push_back(key);
+        } else if (value.use_count() != 1) {
+            // values only become shared by copying the map, which may
+            // not happen while it is modified, so a unique value is safe
+            // to modify in place.
+            value = std::make_shared<T>(*value);
+            modified.push_back(key);
+        }
+        return {value.get(), inserted};
+    }
+
+    /**
+     * Get the value for @p key to modify, or nullptr if not present.
+     */
+    T* modify(key_type key) {
+        if (map.find(key) == map.end()) {
+            return nullptr;
+        }
+        return try_emplace(key).first;
+    }
+
+    T& operator[](key_type key) {
+        return *try_emplace(key).first;
+    }
+
+    /**
+     * Get the keys of values inserted or copied since this map was copied,
+     * or since the keys were last taken, in the order first modified.
+     */
+    std::vector<key_type> takeModified() {
+        return std::exchange(modified, {});
+    }
+
+    size_t count(key_type key) const {
+        return map.count(key);
+    }
+
+    void reserve(size_t count) {
+        map.reserve(count);
+    }
+
+    size_t size() const {
+        return map.size();
+    }
+
+    bool empty() const {
+        return map.empty();
+    }
+
+    const_iterator begin() const {
+        return map.begin();
+    }
+    const_iterator end() const {
+        return map.end();
+    }
+
+private:
+    Map map;
+    std::vector<key_type> modified;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal fixed size pool of worker threads.
+ *
+ * Tasks are run in submission order by whichever worker is free. A pool
+ * of zero threads runs each task on the submitting thread, so callers can
+ * use the same code path whether or not concurrency was requested.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Run @p fn on a worker thread.
+     *
+     * Any exception thrown by fn is rethrown from the returned future.
+     */
+    template <class Fn>
+    auto submit(Fn&& fn) {
+        using Result = std::invoke_result_t<std::decay_t<Fn>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(
+                std::forward<Fn>(fn));
+        auto future = task->get_future();
+        if (workers.empty()) {
+            (*task)();
+        } else {
+            enqueue([task] { (*task)(); });
+        }
+        return future;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+private:
+    void enqueue(std::function<void()> job);
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
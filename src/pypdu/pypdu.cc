@@ -20,6 +20,7 @@
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 
+#include <limits>
 #include <optional>
 #include <typeindex>
 
@@ -32,14 +33,35 @@ struct WrappedFilter {
     pdu::filter::Filter filter;
 };
 
+/**
+ * Wrap a python callable to evaluate a batch of label values while holding
+ * the GIL once, rather than acquiring it for every value.
+ */
+SeriesFilter::BatchMatcher makeBatchMatcher(py::function fn) {
+    // the function may be destroyed on a thread not holding the GIL
+    auto held = std::shared_ptr<py::function>(
+            new py::function(std::move(fn)), [](py::function* f) {
+                py::gil_scoped_acquire gil;
+                delete f;
+            });
+    return [held](const std::vector<std::string_view>& values,
+                  std::vector<bool>& results) {
+        py::gil_scoped_acquire gil;
+        for (auto value : values) {
+            results.push_back(
+                    (*held)(py::str(value.data(), value.size())).cast<bool>());
+        }
+    };
+}
+
 SeriesFilter makeFilter(const py::dict& dict) {
     SeriesFilter f;
     for (const auto& [kobj, vobj] : dict) {
         std::string k = py::str(kobj);
         if (py::isinstance<py::function>(vobj)) {
-            // arbitrary python callback. Convert it to a Filter, which will
-            // call back into Python on every evaluation (probably slow)
-            f.addFilter(k, vobj.cast<pdu::filter::Filter>());
+            // arbitrary python callback. Each distinct label value is only
+            // passed to it once, with values from each block in one batch.
+            f.addBatchFilter(k, makeBatchMatcher(vobj.cast<py::function>()));
         } else if (py::isinstance<WrappedFilter>(vobj)) {
             // is a filter created in C++, get a reference to the real type
             f.addFilter(k, vobj.cast<WrappedFilter&>().filter);
@@ -170,10 +192,35 @@ PYBIND11_MODULE(pypdu, m) {
     init_expression(m);
     init_json(m);
 
-    m.def("load",
-          py::overload_cast<const std::string&>(&pdu::load),
-          "Load data from a Prometheus data directory",
-          py::call_guard<py::gil_scoped_release>());
+    m.def(
+            "load",
+            [](const std::string& path,
+               bool lazy,
+               size_t threads,
+               bool compact_wal,
+               bool populate) {
+                return pdu::load(path,
+                                 lazy ? SeriesLoadMode::Lazy
+                                      : SeriesLoadMode::Eager,
+                                 threads,
+                                 compact_wal ? ChunkType::XORData
+                                             : ChunkType::Raw,
+                                 populate);
+            },
+            "Load data from a Prometheus data directory. If lazy, series "
+            "are decoded from the index when needed rather than all "
+            "being decoded up front. Blocks and the WAL are loaded "
+            "concurrently if threads > 1. If compact_wal, samples read "
+            "from the WAL are XOR encoded in memory, using far less "
+            "memory at some cost in load time. If populate, index files "
+            "are read into memory up front (MAP_POPULATE) rather than on "
+            "demand",
+            py::arg("path"),
+            py::arg("lazy") = false,
+            py::arg("threads") = 1,
+            py::arg("compact_wal") = false,
+            py::arg("populate") = false,
+            py::call_guard<py::gil_scoped_release>());
 
     m.def(
             "regex",
@@ -205,6 +252,28 @@ PYBIND11_MODULE(pypdu, m) {
                     },
                     "Add a label filter which matches values against an "
                     "ECMAScript regex")
+            .def(
+                    "addNot",
+                    [](SeriesFilter& f,
+                       const std::string& labelKey,
+                       const std::string& labelValue) {
+                        f.addNegativeFilter(labelKey, labelValue);
+                    },
+                    "Add a label filter which excludes series with exactly "
+                    "this value (PromQL !=)")
+            .def(
+                    "addNotRegex",
+                    [](SeriesFilter& f,
+                       const std::string& labelKey,
+                       const std::string& labelValue) {
+                        f.addNegativeFilter(labelKey,
+                                            pdu::filter::regex(labelValue));
+                    },
+                    "Add a label filter which excludes series with values "
+                    "matching an ECMAScript regex (PromQL !~)")
+            .def("addAbsent",
+                 &SeriesFilter::addAbsentFilter,
+                 "Add a filter which only accepts series without this label")
             .def("is_empty", [](const SeriesFilter& f) { return f.empty(); });
 
     py::class_<Sample>(m, "Sample")
@@ -481,7 +550,8 @@ PYBIND11_MODULE(pypdu, m) {
                                             "Can't get labels, series is "
                                             "invalid");
                                 }
-                                return cis.getLabels();
+                                const auto& labels = cis.getLabels();
+                                return Labels(labels.begin(), labels.end());
                             },
                             py::keep_alive<0, 1>())
                     .def_property_readonly(
@@ -515,8 +585,11 @@ PYBIND11_MODULE(pypdu, m) {
                              case 0:
                                  return py::cast(
                                          cis.getLabels().at("__name__"));
-                             case 1:
-                                 return py::cast(cis.getLabels());
+                             case 1: {
+                                 const auto& labels = cis.getLabels();
+                                 return py::cast(
+                                         Labels(labels.begin(), labels.end()));
+                             }
                              case 2:
                                  auto ret = py::cast(
                                          SeriesSamples(cis.getSamples()));
@@ -547,6 +620,19 @@ PYBIND11_MODULE(pypdu, m) {
 
     py::class_<PrometheusData>(m, "PrometheusData")
                     .def(py::init<std::string>())
+    .def("refresh",
+         [](PrometheusData& pd) {
+             // read new data without the GIL, but only replace pd with
+             // it while holding the GIL, as other threads may be using pd.
+             auto refreshed = [&pd] {
+                 py::gil_scoped_release release;
+                 return pd.refreshed();
+             }();
+             pd = std::move(refreshed);
+         },
+         "Load data written since loading or the last refresh. Iterators "
+         "and series already obtained are unaffected, and continue to see "
+         "the data as it was")
     // Allow iteration, default to unfiltered (all time series will be listed)
     .def(
         "__iter__",
@@ -560,36 +646,66 @@ PYBIND11_MODULE(pypdu, m) {
         // Allow iteration, default to unfiltered (all time series will be listed)
     .def(
         "filter",
-        [](const PrometheusData& pd, const SeriesFilter& f) {
-            return pd.filtered(f);
+        [](const PrometheusData& pd,
+           const SeriesFilter& f,
+           int64_t minTime,
+           int64_t maxTime) {
+            return pd.filtered(f, minTime, maxTime);
         },
+        py::arg("filter"),
+        py::arg("min_time") = std::numeric_limits<int64_t>::min(),
+        py::arg("max_time") = std::numeric_limits<int64_t>::max(),
         py::keep_alive<0, 1>() /* Essential: keep object alive while iterator exists */)
     .def(
         "filter",
-        [](const PrometheusData& pd, const py::dict& dict) {
-            return pd.filtered(makeFilter(dict));
+        [](const PrometheusData& pd,
+           const py::dict& dict,
+           int64_t minTime,
+           int64_t maxTime) {
+            return pd.filtered(makeFilter(dict), minTime, maxTime);
         },
+        py::arg("filter"),
+        py::arg("min_time") = std::numeric_limits<int64_t>::min(),
+        py::arg("max_time") = std::numeric_limits<int64_t>::max(),
         py::keep_alive<0, 1>())
     .def(
         "filter",
-        [](const PrometheusData& pd, const py::str& s) {
-            return pd.filtered(makeFilter(s));
+        [](const PrometheusData& pd,
+           const py::str& s,
+           int64_t minTime,
+           int64_t maxTime) {
+            return pd.filtered(makeFilter(s), minTime, maxTime);
         },
+        py::arg("filter"),
+        py::arg("min_time") = std::numeric_limits<int64_t>::min(),
+        py::arg("max_time") = std::numeric_limits<int64_t>::max(),
         py::keep_alive<0, 1>())
     // support an arbitrary python callback as a __name__ filter
     .def(
         "filter",
-        [](const PrometheusData& pd, const pdu::filter::Filter& f) {
-            return pd.filtered(makeFilter(f));
+        [](const PrometheusData& pd,
+           const pdu::filter::Filter& f,
+           int64_t minTime,
+           int64_t maxTime) {
+            return pd.filtered(makeFilter(f), minTime, maxTime);
         },
+        py::arg("filter"),
+        py::arg("min_time") = std::numeric_limits<int64_t>::min(),
+        py::arg("max_time") = std::numeric_limits<int64_t>::max(),
         py::keep_alive<0, 1>())
     // support a C++ constructed filter (avoiding it being treated as a
     // python callback)
     .def(
         "filter",
-        [](const PrometheusData& pd, const WrappedFilter& f) {
-            return pd.filtered(makeFilter(f));
+        [](const PrometheusData& pd,
+           const WrappedFilter& f,
+           int64_t minTime,
+           int64_t maxTime) {
+            return pd.filtered(makeFilter(f), minTime, maxTime);
         },
+        py::arg("filter"),
+        py::arg("min_time") = std::numeric_limits<int64_t>::min(),
+        py::arg("max_time") = std::numeric_limits<int64_t>::max(),
         py::keep_alive<0, 1>())
     .def("__getitem__", [](const PrometheusData& pd, const SeriesFilter& f) {
         return getFirstMatching(pd, f);
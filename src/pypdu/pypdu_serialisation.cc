@@ -78,11 +78,33 @@ void dump(int fd, const T& value) {
     pdu::serialise(e, value);
 }
 
+/**
+ * Dump many series, reading chunks in file order, readWindow chunks at a
+ * time, if readWindow is non-zero.
+ */
+template <class T>
+void dumpWindowed(int fd, const T& value, size_t readWindow) {
+    py::gil_scoped_release release;
+    namespace io = boost::iostreams;
+    io::stream_buffer<io::file_descriptor_sink> fpstream(
+            fd, boost::iostreams::never_close_handle);
+    std::ostream os(&fpstream);
+    Encoder e(os);
+    pdu::serialise(e, value, readWindow);
+}
+
 template <class T>
 void dumpToObj(py::object fileLike, const T& value) {
     dump(fdFromObj(fileLike), value);
 }
 
+template <class T>
+void dumpWindowedToObj(py::object fileLike,
+                       const T& value,
+                       size_t readWindow) {
+    dumpWindowed(fdFromObj(fileLike), value, readWindow);
+}
+
 template <class T>
 py::bytes dumps(const T& value) {
     std::stringstream ss;
@@ -135,6 +157,8 @@ public:
 };
 
 void def_serial(py::module m) {
+    using namespace pybind11::literals;
+
     m.def("dump",
           &dump<CrossIndexSeries>,
           "Write a serialised representation of a Series to a file descriptor");
@@ -144,13 +168,23 @@ void def_serial(py::module m) {
             "Write a serialised representation of a list of Series to a file "
             "descriptor");
     m.def("dump",
-          &dump<PrometheusData>,
+          &dumpWindowed<PrometheusData>,
           "Write a serialised representation of all Series contained in a "
-          "PrometheusData instance to a file descriptor");
+          "PrometheusData instance to a file descriptor. If read_window is "
+          "non-zero, chunks are read in file order, about that many at a "
+          "time, which is much faster on slow storage",
+          "file_descriptor"_a,
+          "data"_a,
+          "read_window"_a = 0);
     m.def("dump",
-          &dump<SeriesIterator>,
+          &dumpWindowed<SeriesIterator>,
           "Write a serialised representation of all Series in a (potentially "
-          "filtered) iterator to a file descriptor");
+          "filtered) iterator to a file descriptor. If read_window is "
+          "non-zero, chunks are read in file order, about that many at a "
+          "time",
+          "file_descriptor"_a,
+          "series"_a,
+          "read_window"_a = 0);
 
     // dump to file-like object with .fileno()
     m.def("dump",
@@ -166,16 +200,24 @@ void def_serial(py::module m) {
             "file-like object supporting .fileno(), returning a file "
             "descriptor");
     m.def("dump",
-          &dumpToObj<PrometheusData>,
+          &dumpWindowedToObj<PrometheusData>,
           "Write a serialised representation of all Series contained in a "
           "PrometheusData instance to a file-like object supporting .fileno(), "
           "returning a file "
-          "descriptor");
+          "descriptor. If read_window is non-zero, chunks are read in file "
+          "order, about that many at a time",
+          "file"_a,
+          "data"_a,
+          "read_window"_a = 0);
     m.def("dump",
-          &dumpToObj<SeriesIterator>,
+          &dumpWindowedToObj<SeriesIterator>,
           "Write a serialised representation of all Series in a (potentially "
           "filtered) iterator to a file-like object supporting .fileno(), "
-          "returning a file descriptor");
+          "returning a file descriptor. If read_window is non-zero, chunks "
+          "are read in file order, about that many at a time",
+          "file"_a,
+          "series"_a,
+          "read_window"_a = 0);
 
     m.def("dumps",
           &dumps<CrossIndexSeries>,
@@ -209,8 +251,6 @@ void def_serial(py::module m) {
                     },
                     py::keep_alive<0, 1>());
 
-    using namespace pybind11::literals;
-
     m.def("load",
           py::overload_cast<int, bool>(&load),
           "Load a Series from a serialised representation read from a file "
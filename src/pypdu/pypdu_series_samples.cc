@@ -22,8 +22,6 @@ const std::vector<Sample>& SeriesSamples::getSamples() const {
     auto& samples = *loadedSamples;
     auto itr = iterator;
     samples.reserve(itr.getNumSamples());
-    for (const auto& sample : itr) {
-        samples.emplace_back(sample);
-    }
+    itr.readAll(samples);
     return samples;
 }
@@ -1,17 +1,38 @@
 #include <gtest/gtest.h>
 
+#include <pdu/block/block_registry.h>
+#include <pdu/block/chunk_file_cache.h>
 #include <pdu/block/chunk_view.h>
 #include <pdu/block/chunk_writer.h>
 #include <pdu/block/head_chunks.h>
+#include <pdu/block/index.h>
+#include <pdu/block/mapped_file.h>
+#include <pdu/block/posting_list.h>
+#include <pdu/block/series_sample_iterator.h>
 #include <pdu/block/wal.h>
+#include <pdu/encode/bit_encoder.h>
 #include <pdu/encode/decoder.h>
+#include <pdu/encode/encoder.h>
 #include <pdu/exceptions.h>
+#include <pdu/filter/sample_visitor.h>
+#include <pdu/filter/regex_matcher.h>
+#include <pdu/filter/series_filter.h>
+#include <pdu/pdu.h>
+#include <pdu/serialisation/serialisation.h>
+#include <pdu/util/flat_ref_map.h>
 
 #include <boost/filesystem.hpp>
 // note, included here to work around a boost issue with env.hpp, fixed in 1.80
 #include <boost/process/detail/traits/wchar_t.hpp>
 #include <boost/process/env.hpp>
 
+#include <fstream>
+#include <future>
+#include <map>
+#include <optional>
+#include <random>
+#include <regex>
+#include <set>
 #include <sstream>
 
 auto datadir() {
@@ -26,6 +47,11 @@ class FakeHeadChunks : public HeadChunks {
 public:
     using HeadChunks::HeadChunks;
     using HeadChunks::loadChunkFile;
+
+    // the WAL chunks of any HeadChunks, e.g., one from refreshed()
+    static const WalChunkMap& getWalChunks(const HeadChunks& head) {
+        return head.*(&FakeHeadChunks::walChunks);
+    }
 };
 
 class HeadChunkTest : public ::testing::Test {
@@ -94,9 +120,9 @@ TEST_F(WALTest, PartialFragment) {
     // clang-format on
     Decoder dec(testChunk.data(), testChunk.size());
 
-    std::map<size_t, Series> series;
-    std::set<std::string, std::less<>> symbols;
-    std::map<size_t, InMemWalChunk> walChunks;
+    WalSeriesMap series;
+    SymbolRefs symbols;
+    WalChunkMap walChunks;
 
     FakeWalLoader walLoader(series, symbols, walChunks);
 
@@ -136,9 +162,9 @@ TEST_F(WALTest, MiddleFragment) {
     // clang-format on
     Decoder dec(testChunk.data(), testChunk.size());
 
-    std::map<size_t, Series> series;
-    std::set<std::string, std::less<>> symbols;
-    std::map<size_t, InMemWalChunk> walChunks;
+    WalSeriesMap series;
+    SymbolRefs symbols;
+    WalChunkMap walChunks;
 
     FakeWalLoader walLoader(series, symbols, walChunks);
 
@@ -169,9 +195,9 @@ TEST_F(WALTest, MisorderedFragmentThrows) {
     // clang-format on
     Decoder dec(testChunk.data(), testChunk.size());
 
-    std::map<size_t, Series> series;
-    std::set<std::string, std::less<>> symbols;
-    std::map<size_t, InMemWalChunk> walChunks;
+    WalSeriesMap series;
+    SymbolRefs symbols;
+    WalChunkMap walChunks;
 
     FakeWalLoader walLoader(series, symbols, walChunks);
 
@@ -205,9 +231,9 @@ TEST_F(WALTest, ZeroSizeRecordStartAllowed) {
     // clang-format on
     Decoder dec(testChunk.data(), testChunk.size());
 
-    std::map<size_t, Series> series;
-    std::set<std::string, std::less<>> symbols;
-    std::map<size_t, InMemWalChunk> walChunks;
+    WalSeriesMap series;
+    SymbolRefs symbols;
+    WalChunkMap walChunks;
 
     FakeWalLoader walLoader(series, symbols, walChunks);
 
@@ -215,6 +241,340 @@ TEST_F(WALTest, ZeroSizeRecordStartAllowed) {
             walLoader.loadFragment(dec, false /* not last file in wal */));
 }
 
+/**
+ * Write WAL records to a segment file, splitting them into fragments at
+ * page boundaries as Prometheus does.
+ */
+class TestWalSegment {
+public:
+    void addRecord(std::string_view record) {
+        bool first = true;
+        do {
+            auto pageRemaining = PageSize - data.size() % PageSize;
+            if (pageRemaining < 7) {
+                data.append(pageRemaining, '\0');
+                continue;
+            }
+            auto len = std::min(record.size(), pageRemaining - 7);
+            bool last = len == record.size();
+            auto type = first ? (last ? RecordFull : RecordStart)
+                              : (last ? RecordEnd : RecordMid);
+            writeFragment(type, record.substr(0, len));
+            record.remove_prefix(len);
+            first = false;
+        } while (!record.empty());
+    }
+
+    void addSeries(uint64_t ref,
+                   const std::map<std::string, std::string>& labels) {
+        std::stringstream ss;
+        Encoder e(ss);
+        e.write_int(uint8_t(1));
+        e.write_int(ref);
+        e.write_varuint(labels.size());
+        for (const auto& [key, value] : labels) {
+            e.write_varuint(key.size());
+            e.write(key);
+            e.write_varuint(value.size());
+            e.write(value);
+        }
+        addRecord(ss.str());
+    }
+
+    void addSamples(const std::vector<WalSample>& samples) {
+        std::stringstream ss;
+        Encoder e(ss);
+        e.write_int(uint8_t(2));
+        e.write_int(samples.front().ref);
+        e.write_int(uint64_t(samples.front().ts));
+        for (const auto& sample : samples) {
+            e.write_varint(sample.ref - samples.front().ref);
+            e.write_varint(sample.ts - samples.front().ts);
+            e.write_int(reinterpret_cast<const uint64_t&>(sample.value));
+        }
+        addRecord(ss.str());
+    }
+
+    void writeFragment(RecordType type, std::string_view body) {
+        std::stringstream ss;
+        Encoder e(ss);
+        e.write_int(uint8_t(type));
+        e.write_int(uint16_t(body.size()));
+        e.write_int(uint32_t(0)); // crc, not checked
+        e.write(body);
+        data += ss.str();
+    }
+
+    std::string data;
+};
+
+TEST_F(WALTest, ParallelReplayMatchesSerial) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+
+    std::vector<TestWalSegment> segments(3);
+    // samples for a series before its definition are dropped
+    segments[0].addSamples({{99, 0, 1.0}});
+    for (uint64_t ref = 1; ref <= 20; ++ref) {
+        segments[0].addSeries(
+                ref, {{"__name__", "foo"}, {"ref", std::to_string(ref)}});
+    }
+    for (int scrape = 0; scrape < 900; ++scrape) {
+        auto& segment = segments[scrape / 300];
+        std::vector<WalSample> samples;
+        for (uint64_t ref = 1; ref <= 20; ++ref) {
+            samples.push_back({ref, scrape * 10, scrape * 1.5 + ref});
+        }
+        // out of order refs within a record
+        std::reverse(samples.begin(), samples.end() - 10);
+        segment.addSamples(samples);
+        if (scrape == 400) {
+            samples.push_back({99, scrape * 10, 0.0});
+            segment.addSamples(samples);
+            // large enough to be fragmented across several pages
+            std::string big(70000, 'x');
+            segment.addSeries(99, {{"__name__", "bar"}, {"big", big}});
+        }
+    }
+    // a truncated record at the end of the last segment is ignored
+    segments.back().writeFragment(RecordStart, "abc");
+    segments.back().data.resize(segments.back().data.size() - 2);
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::ofstream(dir / "wal" / fmt::format("{:0>8}", i), std::ios::binary)
+                << segments[i].data;
+    }
+
+    struct Replayed {
+        WalSeriesMap series;
+        SymbolRefs symbols;
+        WalChunkMap walChunks;
+    };
+
+    auto replay = [&](size_t threads) {
+        auto result = std::make_unique<Replayed>();
+        // head chunks for a series make the WAL skip samples they cover
+        ChunkReference headChunk;
+        headChunk.maxTime = 500;
+        result->series[3].chunks.push_back(headChunk);
+
+        WalLoader loader(result->series, result->symbols, result->walChunks);
+        loader.load(dir, threads);
+        return result;
+    };
+
+    auto serial = replay(1);
+    ASSERT_EQ(21, serial->series.size());
+    EXPECT_EQ(20, serial->walChunks.size());
+    EXPECT_EQ(0, serial->walChunks.count(99));
+    // scrape 400 was written twice
+    auto samplesFor = [&](size_t ref) {
+        auto resources = serial->walChunks[ref].makeResources();
+        return resources.front().first->getView().size() / 16;
+    };
+    EXPECT_EQ(901, samplesFor(1));
+    EXPECT_EQ(901 - 51, samplesFor(3));
+    EXPECT_EQ(501,
+              serial->walChunks[3].makeResources().front().second.minTime);
+
+    for (size_t threads : {2, 4, 16}) {
+        auto parallel = replay(threads);
+        ASSERT_EQ(serial->series.size(), parallel->series.size());
+        for (const auto& [ref, series] : serial->series) {
+            EXPECT_EQ(series->labels, parallel->series.at(ref).labels);
+        }
+        ASSERT_EQ(serial->walChunks.size(), parallel->walChunks.size());
+        for (auto& [ref, chunk] : serial->walChunks) {
+            auto [expected, expectedRef] = chunk->makeResources().front();
+            auto [actual, actualRef] =
+                    parallel->walChunks.at(ref).makeResources().front();
+            EXPECT_EQ(expected->getView(), actual->getView()) << ref;
+            EXPECT_EQ(expectedRef.minTime, actualRef.minTime);
+            EXPECT_EQ(expectedRef.maxTime, actualRef.maxTime);
+        }
+    }
+
+    fs::remove_all(dir);
+}
+
+TEST_F(WALTest, XORChunksMatchRaw) {
+    constexpr size_t XORChunkSamples = InMemWalChunk::XORChunkSamples;
+    InMemWalChunk raw(ChunkType::Raw);
+    InMemWalChunk xorChunk(ChunkType::XORData);
+    EXPECT_TRUE(xorChunk.empty());
+
+    // enough samples to cut several XOR chunks
+    size_t count = 1000;
+    for (auto* chunk : {&raw, &xorChunk}) {
+        chunk->setMinTime(1000);
+        for (size_t i = 0; i < count; ++i) {
+            chunk->addSample(i * 15, i % 7 ? 1.5 * i : 0.0);
+        }
+    }
+    EXPECT_FALSE(xorChunk.empty());
+
+    auto decodeAll = [](InMemWalChunk& chunk, size_t expectedChunks) {
+        std::vector<Sample> samples;
+        auto resources = chunk.makeResources();
+        EXPECT_EQ(expectedChunks, resources.size());
+        for (const auto& [resource, ref] : resources) {
+            ChunkView cv(resource, 0, ref.type);
+            auto offset = samples.size();
+            samples.resize(offset + cv.numSamples());
+            cv.decode(samples.data() + offset, cv.numSamples());
+            EXPECT_EQ(ref.maxTime, samples.back().timestamp);
+        }
+        return samples;
+    };
+
+    auto expected = decodeAll(raw, 1);
+    // samples before the min time are skipped
+    EXPECT_EQ(count - 67, expected.size());
+    EXPECT_EQ(1005, expected.front().timestamp);
+
+    auto actual = decodeAll(xorChunk,
+                            (expected.size() + XORChunkSamples - 1) /
+                                    XORChunkSamples);
+    EXPECT_EQ(expected, actual);
+
+    // XOR encoding should be far smaller than 16 bytes per sample
+    size_t size = 0;
+    for (const auto& [resource, ref] : xorChunk.makeResources()) {
+        size += resource->getView().size();
+    }
+    EXPECT_LT(size, expected.size() * 8);
+}
+
+TEST_F(WALTest, ChunkCopiesShareSamples) {
+    auto decodeAll = [](const InMemWalChunk& chunk) {
+        std::vector<Sample> samples;
+        for (const auto& [resource, ref] : chunk.makeResources()) {
+            ChunkView cv(resource, 0, ref.type);
+            auto offset = samples.size();
+            samples.resize(offset + cv.numSamples());
+            cv.decode(samples.data() + offset, cv.numSamples());
+        }
+        return samples;
+    };
+
+    for (auto type : {ChunkType::Raw, ChunkType::XORData}) {
+        InMemWalChunk chunk(type);
+        std::vector<Sample> expected;
+        for (int64_t ts = 0; ts < 2000; ts += 10) {
+            chunk.addSample(ts, ts * 0.5);
+            expected.push_back({ts, ts * 0.5});
+        }
+
+        // copies may each add samples, without affecting one another
+        auto copy = chunk;
+        auto other = chunk;
+        copy.addSample(2000, 1.0);
+        other.addSample(2000, 2.0);
+        other.addSample(2010, 2.0);
+        chunk.addSample(2000, 3.0);
+
+        auto withAdded = [&](std::vector<Sample> added) {
+            auto samples = expected;
+            samples.insert(samples.end(), added.begin(), added.end());
+            return samples;
+        };
+        EXPECT_EQ(withAdded({{2000, 3.0}}), decodeAll(chunk));
+        EXPECT_EQ(withAdded({{2000, 1.0}}), decodeAll(copy));
+        EXPECT_EQ(withAdded({{2000, 2.0}, {2010, 2.0}}), decodeAll(other));
+
+        // dropping samples from a copy leaves the original intact
+        copy.setMinTime(1000);
+        EXPECT_EQ(1000, decodeAll(copy).front().timestamp);
+        EXPECT_EQ(withAdded({{2000, 3.0}}), decodeAll(chunk));
+    }
+}
+
+TEST(FlatRefMapTest, InsertFindGrow) {
+    FlatRefMap<std::string> map;
+    EXPECT_EQ(map.end(), map.find(0));
+    EXPECT_THROW(map.at(0), std::out_of_range);
+
+    // refs are usually sequential, but need not be
+    std::vector<uint64_t> refs;
+    for (uint64_t i = 0; i < 10000; ++i) {
+        refs.push_back(i % 2 ? i : i << 40);
+    }
+    const auto& first = map[refs.front()] = "first";
+    for (auto ref : refs) {
+        auto [itr, inserted] = map.try_emplace(ref, std::to_string(ref));
+        EXPECT_EQ(ref != refs.front(), inserted);
+        EXPECT_EQ(ref, itr->first);
+    }
+    // values never move as the table grows
+    EXPECT_EQ("first", first);
+    EXPECT_EQ(&first, &map.at(refs.front()));
+
+    ASSERT_EQ(refs.size(), map.size());
+    for (auto ref : refs) {
+        EXPECT_EQ(1, map.count(ref));
+    }
+    EXPECT_EQ(0, map.count(3 << 20));
+    EXPECT_EQ("9999", map.at(9999));
+
+    // iteration is in insertion order
+    auto refItr = refs.begin();
+    for (const auto& [ref, value] : map) {
+        EXPECT_EQ(*refItr++, ref);
+    }
+}
+
+TEST(SymbolDictionaryTest, FreesUnusedSymbols) {
+    auto& dict = SymbolDictionary::instance();
+    auto initialSize = dict.size();
+    std::set<SymbolDictionary::Id> freed;
+    {
+        SymbolRefs refs;
+        std::string big(100000, 'x');
+        std::vector<SymbolDictionary::Id> ids;
+        for (int i = 0; i < 10000; ++i) {
+            ids.push_back(refs.acquire("symbol" + std::to_string(i)));
+        }
+        auto bigId = refs.acquire(big);
+        EXPECT_EQ(10001, refs.size());
+        EXPECT_EQ(initialSize + 10001, dict.size());
+
+        // acquiring again gives the same ID, without another reference
+        for (int i = 0; i < 10000; ++i) {
+            auto symbol = "symbol" + std::to_string(i);
+            EXPECT_EQ(ids[i], refs.acquire(symbol));
+            EXPECT_EQ(symbol, dict.lookup(ids[i]));
+        }
+        EXPECT_EQ(bigId, refs.acquire(big));
+        EXPECT_EQ(big, dict.lookup(bigId));
+        EXPECT_EQ(10001, refs.size());
+        freed.insert(ids.begin(), ids.end());
+        freed.insert(bigId);
+    }
+    // every symbol is freed with the refs
+    EXPECT_EQ(initialSize, dict.size());
+
+    // freed IDs are reused
+    auto id = dict.acquire("reused");
+    EXPECT_TRUE(freed.count(id));
+    EXPECT_EQ("reused", dict.lookup(id));
+
+    // labels added by value hold their own references, which are copied
+    // along with the labels
+    std::optional<Series> copy;
+    {
+        Series s;
+        s.addLabel("__name__", std::string("reused"));
+        s.addLabel("job", std::string("owned"));
+        dict.release(id);
+        copy = s;
+    }
+    EXPECT_EQ("owned", copy->labels.at("job"));
+    EXPECT_EQ("reused", copy->labels.at("__name__"));
+    copy.reset();
+    EXPECT_EQ(initialSize, dict.size());
+}
+
 class EncoderTest : public ::testing::Test {
 public:
 };
@@ -318,4 +678,1835 @@ TEST_F(XORChunkTest, RoundTripSyntheticSamples) {
                 << decodedSamples[i].timestamp << " "
                 << decodedSamples[i].value;
     }
+
+    // bulk decoding should produce exactly the same samples
+    std::vector<Sample> bulkSamples(view.numSamples());
+    EXPECT_EQ(view.numSamples(),
+              view.decode(bulkSamples.data(), bulkSamples.size()));
+    EXPECT_EQ(expectedSamples, bulkSamples);
+
+    std::vector<int64_t> timestamps(view.numSamples());
+    std::vector<double> values(view.numSamples());
+    EXPECT_EQ(view.numSamples(),
+              view.decode(timestamps.data(), values.data(), values.size()));
+    for (int i = 0; i < expectedSamples.size(); i++) {
+        ASSERT_EQ(expectedSamples[i], (Sample{timestamps[i], values[i]}))
+                << "Failed at sample " << i;
+    }
+
+    // instrumented iteration decodes the same samples, and also records
+    // bit widths, which the default iterator does not.
+    auto plain = view.samples();
+    auto instrumented = view.instrumentedSamples();
+    EXPECT_EQ(64, instrumented->meta.valueBitWidth);
+    EXPECT_EQ(0, plain->meta.valueBitWidth);
+    for (; instrumented != end(instrumented); ++instrumented, ++plain) {
+        ASSERT_NE(plain, end(plain));
+        ASSERT_EQ(Sample(*plain), Sample(*instrumented));
+        EXPECT_NE(0, instrumented->meta.timestampBitWidth);
+        EXPECT_EQ(SampleInfo::noBitWidth, plain->meta.minTimestampBitWidth);
+    }
+
+    // only decode a prefix of the chunk
+    std::vector<Sample> prefix(10);
+    EXPECT_EQ(10, view.decode(prefix.data(), prefix.size()));
+    EXPECT_TRUE(std::equal(prefix.begin(), prefix.end(), bulkSamples.begin()));
+}
+
+class SeriesSampleIteratorTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        series = std::make_shared<Series>();
+        // 4 raw chunks, each in its own segment, of 10 samples 10ms apart:
+        // [0, 90], [100, 190], [200, 290], [300, 390]
+        for (uint32_t chunk = 0; chunk < 4; ++chunk) {
+            std::string data;
+            for (int64_t ts = chunk * 100; ts < (chunk + 1) * 100; ts += 10) {
+                double value = ts;
+                data.append(reinterpret_cast<const char*>(&ts), sizeof(ts));
+                data.append(reinterpret_cast<const char*>(&value),
+                            sizeof(value));
+            }
+            uint32_t segment = chunk + 1;
+            // the first chunk is deliberately not available, reading it
+            // would throw.
+            if (chunk != 0) {
+                cfc->store(segment,
+                           std::make_shared<OwningMemResource>(data));
+            }
+            ChunkReference ref;
+            ref.minTime = chunk * 100;
+            ref.maxTime = chunk * 100 + 90;
+            ref.fileReference = makeFileReference(segment, 0);
+            ref.type = ChunkType::Raw;
+            series->chunks.push_back(ref);
+        }
+    }
+
+    std::vector<int64_t> timestamps(TimeRange range) {
+        std::vector<int64_t> result;
+        for (const auto& sample : SeriesSampleIterator(series, cfc, range)) {
+            result.push_back(sample.timestamp);
+        }
+        return result;
+    }
+
+    std::shared_ptr<Series> series;
+    std::shared_ptr<ChunkFileCache> cfc = std::make_shared<ChunkFileCache>();
+};
+
+TEST_F(SeriesSampleIteratorTest, TimeRangeTrimsSamples) {
+    EXPECT_EQ((std::vector<int64_t>{150, 160, 170, 180, 190, 200, 210, 220}),
+              timestamps({145, 225}));
+    EXPECT_EQ(8, SeriesSampleIterator(series, cfc, {145, 225}).getNumSamples());
+
+    // a range falling between samples, or after all chunks
+    EXPECT_TRUE(timestamps({151, 159}).empty());
+    EXPECT_TRUE(timestamps({1000, 2000}).empty());
+
+    // whole chunks, including the edges
+    EXPECT_EQ(20, timestamps({100, 290}).size());
+    EXPECT_EQ(30,
+              SeriesSampleIterator(series, cfc, {100, 1000}).getNumSamples());
+
+    // reading all samples at once, bulk decoding whole chunks
+    std::vector<Sample> samples;
+    SeriesSampleIterator(series, cfc, {145, 300}).readAll(samples);
+    ASSERT_EQ(16, samples.size());
+    EXPECT_EQ(150, samples.front().timestamp);
+    EXPECT_EQ(300, samples.back().timestamp);
+    EXPECT_EQ(200, samples[5].timestamp);
+    EXPECT_EQ(200.0, samples[5].value);
+
+    // unbounded ranges need to read the unavailable first chunk
+    EXPECT_THROW(timestamps({}), std::runtime_error);
+}
+
+TEST(CrossIndexSampleIteratorTest, MergesOverlappingSources) {
+    auto cfc = std::make_shared<ChunkFileCache>();
+    // a series of one raw chunk of samples every 10ms in [from, to], as if
+    // from a separate block
+    auto makeSource = [&](uint32_t segment,
+                          int64_t from,
+                          int64_t to,
+                          double offset) {
+        std::string data;
+        for (int64_t ts = from; ts <= to; ts += 10) {
+            double value = ts + offset;
+            data.append(reinterpret_cast<const char*>(&ts), sizeof(ts));
+            data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+        cfc->store(segment, std::make_shared<OwningMemResource>(data));
+        ChunkReference ref;
+        ref.minTime = from;
+        ref.maxTime = to;
+        ref.fileReference = makeFileReference(segment, 0);
+        ref.type = ChunkType::Raw;
+        auto series = std::make_shared<Series>();
+        series->chunks.push_back(ref);
+        return SeriesSampleIterator(series, cfc);
+    };
+    auto a = makeSource(1, 0, 90, 0);
+    auto b = makeSource(2, 50, 150, 1000);
+    auto c = makeSource(3, 200, 290, 0);
+
+    std::vector<Sample> expected;
+    for (int64_t ts = 0; ts <= 290; ts += 10) {
+        if (ts <= 150 || ts >= 200) {
+            // where a and b overlap, the earlier source wins
+            expected.push_back({ts, ts > 90 && ts <= 150 ? ts + 1000.0 : ts});
+        }
+    }
+
+    // disjoint sources are read one after another
+    CrossIndexSampleIterator disjoint({a, c});
+    EXPECT_FALSE(disjoint.isMerging());
+    EXPECT_EQ(20, disjoint.getNumSamples());
+
+    CrossIndexSampleIterator merged({a, b, c});
+    EXPECT_TRUE(merged.isMerging());
+    EXPECT_EQ(expected.size(), merged.getNumSamples());
+
+    std::vector<Sample> actual;
+    for (const auto& sample : merged) {
+        actual.push_back(sample);
+    }
+    EXPECT_EQ(expected, actual);
+
+    // bulk reading, after some samples have been consumed
+    auto partial = CrossIndexSampleIterator({a, b, c});
+    actual.clear();
+    for (int i = 0; i < 7; ++i, ++partial) {
+        actual.push_back(*partial);
+    }
+    partial.readAll(actual);
+    EXPECT_EQ(expected, actual);
+}
+
+TEST(ChunkFileCacheTest, EvictsUnusedSegments) {
+    auto dir = boost::filesystem::temp_directory_path() /
+               boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir);
+    for (int segment = 1; segment <= 4; ++segment) {
+        std::ofstream(dir / fmt::format("{:0>6}", segment)) << "chunkdata";
+    }
+
+    ChunkFileCache cache(dir, {/* maxSegments */ 2});
+    cache.get(1);
+    cache.get(2);
+    cache.get(1); // 1 is now more recently used than 2
+    EXPECT_EQ(1, cache.getStats().hits);
+    EXPECT_EQ(2, cache.getStats().misses);
+
+    // unused, least recently used segment is evicted
+    auto three = cache.get(3);
+    EXPECT_EQ(1, cache.getStats().evictions);
+    EXPECT_EQ(2, cache.getStats().segments);
+    auto one = cache.get(1);
+    EXPECT_EQ(2, cache.getStats().hits);
+
+    // segments in use are never evicted, limits are exceeded instead
+    auto four = cache.get(4);
+    EXPECT_EQ(3, cache.getStats().segments);
+    EXPECT_EQ(3 * 9, cache.getStats().bytes);
+    EXPECT_EQ(one, cache.get(1));
+
+    one.reset();
+    three.reset();
+    cache.setLimits({/* maxSegments */ 0, /* maxBytes */ 9});
+    EXPECT_EQ(1, cache.getStats().segments);
+    EXPECT_EQ(3, cache.getStats().evictions);
+
+    // concurrent users all get the same mapping
+    std::vector<std::future<std::shared_ptr<Resource>>> results;
+    for (int i = 0; i < 8; ++i) {
+        results.push_back(std::async(std::launch::async,
+                                     [&cache] { return cache.get(2); }));
+    }
+    auto first = results.front().get();
+    for (size_t i = 1; i < results.size(); ++i) {
+        EXPECT_EQ(first, results[i].get());
+    }
+
+    boost::filesystem::remove_all(dir);
+}
+
+TEST(MappedFileTest, PopulateAndAdvise) {
+    auto path = boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path();
+    std::string contents(10000, 'x');
+    std::ofstream(path.string()) << contents;
+
+    for (bool populate : {false, true}) {
+        auto resource = map_file(path, populate);
+        EXPECT_EQ(contents, resource->getView());
+        // hints must not affect the mapped data
+        for (auto pattern : {AccessPattern::Sequential,
+                             AccessPattern::Random,
+                             AccessPattern::WillNeed,
+                             AccessPattern::DontNeed,
+                             AccessPattern::Normal}) {
+            resource->advise(pattern);
+            EXPECT_EQ(contents, resource->getView());
+        }
+    }
+
+    // in-memory resources ignore hints
+    OwningMemResource mem(contents);
+    mem.advise(AccessPattern::DontNeed);
+    EXPECT_EQ(contents, mem.getView());
+
+    boost::filesystem::remove(path);
+}
+
+/**
+ * Series source holding in-memory series, with raw chunks stored in a
+ * ChunkFileCache. Records the order chunk segments are read in.
+ */
+class InMemorySource : public SeriesSource {
+public:
+    struct LoggingResource : public OwningMemResource {
+        LoggingResource(std::string data, uint32_t id, InMemorySource& source)
+            : OwningMemResource(std::move(data)), id(id), source(source) {
+        }
+        Decoder getDecoder() const override {
+            // a chunk may be decoded from more than once when read
+            if (source.reads.empty() || source.reads.back() != id) {
+                source.reads.push_back(id);
+            }
+            return OwningMemResource::getDecoder();
+        }
+        uint32_t id;
+        InMemorySource& source;
+    };
+
+    // add a series with a chunk per provided vector of timestamps, stored
+    // in the given segments
+    void addSeries(std::string_view name,
+                   const std::vector<std::vector<int64_t>>& chunks,
+                   const std::vector<uint32_t>& segments,
+                   double valueOffset = 0) {
+        auto& s = series.emplace_back();
+        s.addLabel("__name__", name);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            std::string data;
+            for (int64_t ts : chunks[i]) {
+                double value = ts + valueOffset;
+                data.append(reinterpret_cast<const char*>(&ts), sizeof(ts));
+                data.append(reinterpret_cast<const char*>(&value),
+                            sizeof(value));
+            }
+            cache->store(segments[i],
+                         std::make_shared<LoggingResource>(
+                                 std::move(data), segments[i], *this));
+            ChunkReference ref;
+            ref.minTime = chunks[i].front();
+            ref.maxTime = chunks[i].back();
+            ref.fileReference = makeFileReference(segments[i], 0);
+            ref.type = ChunkType::Raw;
+            s.chunks.push_back(ref);
+        }
+    }
+
+    PostingList getFilteredSeriesRefs(
+            const SeriesFilter& filter) const override {
+        PostingList refs;
+        for (size_t i = 0; i < series.size(); ++i) {
+            refs.push_back(i);
+        }
+        return refs;
+    }
+
+    const Series& getSeries(SeriesRef ref) const override {
+        return series.at(ref);
+    }
+
+    const std::shared_ptr<ChunkFileCache>& getCachePtr() const override {
+        return cache;
+    }
+
+    // series must be added in label order
+    std::deque<Series> series;
+    std::shared_ptr<ChunkFileCache> cache = std::make_shared<ChunkFileCache>();
+    std::vector<uint32_t> reads;
+};
+
+class RecordingVisitor : public OrderedSeriesVisitor {
+public:
+    using OrderedSeriesVisitor::visit;
+    void visit(const Series& series) override {
+        visited.emplace_back(series.labels.at("__name__"), 0);
+    }
+    void visit(const SampleInfo& sample) override {
+        visited.emplace_back("", sample.timestamp);
+    }
+    std::vector<std::pair<std::string, int64_t>> visited;
+};
+
+TEST(SeriesVisitorTest, FileOrderedReads) {
+    auto source = std::make_shared<InMemorySource>();
+    // series order does not match segment order
+    source->addSeries("a", {{1, 2}, {3, 4}}, {6, 3});
+    source->addSeries("b", {{1, 2, 3}, {10}}, {5, 1});
+    source->addSeries("c", {{5}}, {4});
+    source->addSeries("d", {{7, 8}}, {2});
+
+    auto visitAll = [&](size_t window, TimeRange range = {}) {
+        source->reads.clear();
+        RecordingVisitor visitor;
+        visitor.setReadWindow(window);
+        std::vector<FilteredSeriesSourceIterator> sources;
+        sources.emplace_back(source, SeriesFilter(), range);
+        visitor.visit(SeriesIterator(std::move(sources), range));
+        return visitor.visited;
+    };
+
+    auto expected = visitAll(0);
+    EXPECT_EQ(std::vector<uint32_t>({6, 3, 5, 1, 4, 2}), source->reads);
+    EXPECT_EQ(15, expected.size());
+
+    // everything in one window
+    EXPECT_EQ(expected, visitAll(100));
+    EXPECT_EQ(std::vector<uint32_t>({1, 2, 3, 4, 5, 6}), source->reads);
+
+    // windows of (at least) 3 chunks; a+b, then c+d
+    EXPECT_EQ(expected, visitAll(3));
+    EXPECT_EQ(std::vector<uint32_t>({1, 3, 5, 6, 2, 4}), source->reads);
+
+    // time range is respected
+    auto inRange = visitAll(0, {2, 7});
+    EXPECT_EQ(inRange, visitAll(3, {2, 7}));
+    EXPECT_EQ(std::vector<uint32_t>({3, 5, 6, 2, 4}), source->reads);
+}
+
+TEST(SeriesVisitorTest, FileOrderedMergesOverlappingSources) {
+    // as if the same series were in two overlapping blocks
+    auto first = std::make_shared<InMemorySource>();
+    first->addSeries("a", {{1, 2, 3}, {5, 6}}, {2, 1});
+    first->addSeries("c", {{1, 2}}, {3});
+    auto second = std::make_shared<InMemorySource>();
+    second->addSeries("a", {{3, 4, 5}, {7}}, {1, 2}, 100);
+    second->addSeries("b", {{1}}, {3}, 100);
+
+    struct SampleRecorder : public OrderedSeriesVisitor {
+        using OrderedSeriesVisitor::visit;
+        void visit(const Series& series) override {
+            visited.emplace_back(std::string(series.labels.at("__name__")),
+                                 std::vector<Sample>{});
+        }
+        void visit(const SampleInfo& sample) override {
+            visited.back().second.push_back(sample);
+        }
+        std::vector<std::pair<std::string, std::vector<Sample>>> visited;
+    };
+
+    auto visitAll = [&](size_t window, TimeRange range = {}) {
+        SampleRecorder visitor;
+        visitor.setReadWindow(window);
+        std::vector<FilteredSeriesSourceIterator> sources;
+        sources.emplace_back(first, SeriesFilter(), range);
+        sources.emplace_back(second, SeriesFilter(), range);
+        visitor.visit(SeriesIterator(std::move(sources), range));
+        return visitor.visited;
+    };
+
+    auto expected = visitAll(0);
+    ASSERT_EQ(3, expected.size());
+    // duplicate timestamps are dropped, the first source winning
+    EXPECT_EQ("a", expected[0].first);
+    EXPECT_EQ((std::vector<Sample>{{1, 1},
+                                   {2, 2},
+                                   {3, 3},
+                                   {4, 104},
+                                   {5, 5},
+                                   {6, 6},
+                                   {7, 107}}),
+              expected[0].second);
+
+    for (size_t window : {1, 2, 100}) {
+        EXPECT_EQ(expected, visitAll(window)) << window;
+    }
+    EXPECT_EQ(visitAll(0, {3, 5}), visitAll(100, {3, 5}));
+}
+
+TEST(SerialisationTest, FileOrderedMatchesSeriesOrder) {
+    auto source = std::make_shared<InMemorySource>();
+    // series order does not match segment order
+    source->addSeries("a", {{1, 2}, {3, 4}}, {6, 3});
+    source->addSeries("b", {{1, 2, 3}, {10}}, {5, 1});
+    source->addSeries("c", {{5}}, {4});
+    source->addSeries("d", {{7, 8}}, {2});
+
+    auto serialise = [&](size_t window, TimeRange range = {}) {
+        source->reads.clear();
+        std::vector<FilteredSeriesSourceIterator> sources;
+        sources.emplace_back(source, SeriesFilter(), range);
+        std::stringstream ss;
+        Encoder e(ss);
+        pdu::serialise(e, SeriesIterator(std::move(sources), range), window);
+        return ss.str();
+    };
+
+    auto expected = serialise(0);
+    // the output does not depend on the order chunks are read in
+    EXPECT_EQ(expected, serialise(100));
+    EXPECT_EQ(std::vector<uint32_t>({1, 2, 3, 4, 5, 6}), source->reads);
+    EXPECT_EQ(expected, serialise(3));
+    EXPECT_EQ(std::vector<uint32_t>({1, 3, 5, 6, 2, 4}), source->reads);
+    EXPECT_EQ(serialise(0, {2, 7}), serialise(3, {2, 7}));
+
+    Decoder d(expected);
+    auto group = boost::get<std::vector<DeserialisedSeries>>(
+            pdu::deserialise(d));
+    ASSERT_EQ(4, group.size());
+    std::vector<int64_t> timestamps;
+    for (const auto& sample : group[1].getSamples()) {
+        timestamps.push_back(sample.timestamp);
+    }
+    EXPECT_EQ("b", group[1].getLabels().at("__name__"));
+    EXPECT_EQ(std::vector<int64_t>({1, 2, 3, 10}), timestamps);
+}
+
+TEST(SeriesVisitorTest, FileOrderedMatchesDefaultOverOverlappingBlocks) {
+    // three blocks: the second partially overlaps the first, the third
+    // duplicates part of the first and extends past the second. Series
+    // appear in different subsets of blocks, and chunks are stored out of
+    // series order.
+    std::vector<std::shared_ptr<InMemorySource>> blocks;
+    for (int i = 0; i < 3; ++i) {
+        blocks.push_back(std::make_shared<InMemorySource>());
+    }
+    blocks[0]->addSeries("a", {{1, 2, 3}, {4, 5, 6}}, {3, 1});
+    blocks[0]->addSeries("b", {{1, 3, 5}}, {2});
+    blocks[0]->addSeries("d", {{2, 4}}, {4});
+    blocks[1]->addSeries("a", {{5, 6, 7}, {8, 9}}, {2, 1}, 100);
+    blocks[1]->addSeries("c", {{10, 11}}, {3}, 100);
+    blocks[1]->addSeries("d", {{4, 5, 6}}, {4}, 100);
+    blocks[2]->addSeries("a", {{2, 3}, {9, 10, 11}}, {1, 2}, 200);
+    blocks[2]->addSeries("b", {{3, 4}}, {4}, 200);
+    blocks[2]->addSeries("c", {{11, 12}}, {3}, 200);
+
+    auto makeIterator = [&](TimeRange range) {
+        std::vector<FilteredSeriesSourceIterator> sources;
+        for (const auto& block : blocks) {
+            sources.emplace_back(block, SeriesFilter(), range);
+        }
+        return SeriesIterator(std::move(sources), range);
+    };
+
+    struct SampleRecorder : public OrderedSeriesVisitor {
+        using OrderedSeriesVisitor::visit;
+        void visit(const Series& series) override {
+            visited.emplace_back(std::string(series.labels.at("__name__")),
+                                 std::vector<Sample>{});
+        }
+        void visit(const SampleInfo& sample) override {
+            visited.back().second.push_back(sample);
+        }
+        std::vector<std::pair<std::string, std::vector<Sample>>> visited;
+    };
+
+    auto visitAll = [&](size_t window, TimeRange range) {
+        SampleRecorder visitor;
+        visitor.setReadWindow(window);
+        visitor.visit(makeIterator(range));
+        return visitor.visited;
+    };
+
+    auto serialise = [&](size_t window, TimeRange range) {
+        std::stringstream ss;
+        Encoder e(ss);
+        pdu::serialise(e, makeIterator(range), window);
+        return ss.str();
+    };
+
+    for (auto range : {TimeRange{}, TimeRange{3, 9}, TimeRange{5, 5}}) {
+        auto expected = visitAll(0, range);
+        // the default visitor reads each series through
+        // CrossIndexSampleIterator
+        std::vector<std::pair<std::string, std::vector<Sample>>> iterated;
+        for (const auto& series : makeIterator(range)) {
+            auto& [name, samples] = iterated.emplace_back(
+                    std::string(series.getLabels().at("__name__")),
+                    std::vector<Sample>{});
+            for (const auto& sample : series.getSamples()) {
+                samples.push_back(sample);
+            }
+        }
+        EXPECT_EQ(iterated, expected);
+
+        auto dumped = serialise(0, range);
+        for (size_t window : {1, 2, 3, 5, 100}) {
+            EXPECT_EQ(expected, visitAll(window, range))
+                    << window << " [" << range.minTime << ", "
+                    << range.maxTime << "]";
+            EXPECT_EQ(dumped, serialise(window, range))
+                    << window << " [" << range.minTime << ", "
+                    << range.maxTime << "]";
+        }
+    }
+
+    // sanity check the fixture does overlap: of duplicate timestamps, the
+    // earliest block wins
+    auto all = visitAll(100, {});
+    ASSERT_EQ(4, all.size());
+    EXPECT_EQ("a", all[0].first);
+    EXPECT_EQ((std::vector<Sample>{{1, 1},
+                                   {2, 2},
+                                   {3, 3},
+                                   {4, 4},
+                                   {5, 5},
+                                   {6, 6},
+                                   {7, 107},
+                                   {8, 108},
+                                   {9, 109},
+                                   {10, 210},
+                                   {11, 211}}),
+              all[0].second);
+}
+
+using TestLabels = std::map<std::string, std::string>;
+
+/**
+ * Write a minimal Prometheus index file and meta.json into @p dir, containing
+ * the provided series. Each series gets a single chunk reference; no chunk
+ * files are written.
+ */
+void writeTestIndex(const boost::filesystem::path& dir,
+                    std::vector<TestLabels> seriesLabels,
+                    const std::string& ulid = "01TESTBLOCK") {
+    boost::filesystem::create_directories(dir);
+    std::sort(seriesLabels.begin(), seriesLabels.end());
+
+    std::stringstream ss;
+    Encoder e(ss);
+    auto pad = [&](size_t alignment) {
+        while (ss.tellp() % alignment) {
+            e.write_int(uint8_t(0));
+        }
+    };
+    auto lengthPrefixed = [&](const std::string& body) {
+        e.write_int(uint32_t(body.size()));
+        e.write(body);
+        e.write_int(uint32_t(0)); // CRC, not checked
+    };
+
+    // magic, version, padding
+    e.write_int(uint32_t(0xBAAAD700));
+    e.write_int(uint8_t(2));
+
+    std::set<std::string> symbolSet;
+    for (const auto& labels : seriesLabels) {
+        for (const auto& [k, v] : labels) {
+            symbolSet.insert(k);
+            symbolSet.insert(v);
+        }
+    }
+    std::vector<std::string> symbols(symbolSet.begin(), symbolSet.end());
+    auto symbolId = [&](const std::string& sym) {
+        return std::lower_bound(symbols.begin(), symbols.end(), sym) -
+               symbols.begin();
+    };
+
+    uint64_t symbolOffset = ss.tellp();
+    {
+        std::stringstream body;
+        Encoder b(body);
+        b.write_int(uint32_t(symbols.size()));
+        for (const auto& sym : symbols) {
+            b.write_varuint(sym.size());
+            b.write(sym);
+        }
+        lengthPrefixed(body.str());
+    }
+
+    pad(16);
+    uint64_t seriesOffset = ss.tellp();
+    std::map<std::pair<std::string, std::string>, std::vector<uint32_t>>
+            postings;
+    int64_t ts = 1000;
+    for (const auto& labels : seriesLabels) {
+        pad(16);
+        uint32_t ref = uint32_t(ss.tellp() / 16);
+        std::stringstream body;
+        Encoder b(body);
+        b.write_varuint(labels.size());
+        for (const auto& [k, v] : labels) {
+            b.write_varuint(symbolId(k));
+            b.write_varuint(symbolId(v));
+            postings[{k, v}].push_back(ref);
+        }
+        b.write_varuint(1); // chunk count
+        b.write_varint(ts); // minTime
+        b.write_varuint(1000); // maxTime - minTime
+        b.write_varuint(ref * 8); // chunk file reference, never read
+        ts += 1000;
+        auto str = body.str();
+        e.write_varuint(str.size());
+        e.write(str);
+        e.write_int(uint32_t(0)); // CRC
+    }
+
+    pad(16);
+    uint64_t labelIndicesOffset = ss.tellp();
+
+    std::map<std::pair<std::string, std::string>, uint64_t> postingOffsets;
+    uint64_t postingsOffset = ss.tellp();
+    for (const auto& [kv, refs] : postings) {
+        pad(4);
+        postingOffsets[kv] = ss.tellp();
+        std::stringstream body;
+        Encoder b(body);
+        b.write_int(uint32_t(refs.size()));
+        for (auto ref : refs) {
+            b.write_int(ref);
+        }
+        lengthPrefixed(body.str());
+    }
+
+    uint64_t postingsOffsetTableOffset = ss.tellp();
+    {
+        std::stringstream body;
+        Encoder b(body);
+        b.write_int(uint32_t(postingOffsets.size()));
+        for (const auto& [kv, offset] : postingOffsets) {
+            b.write_int(uint8_t(2));
+            b.write_varuint(kv.first.size());
+            b.write(kv.first);
+            b.write_varuint(kv.second.size());
+            b.write(kv.second);
+            b.write_varuint(offset);
+        }
+        lengthPrefixed(body.str());
+    }
+
+    // TOC
+    e.write_int(symbolOffset);
+    e.write_int(seriesOffset);
+    e.write_int(labelIndicesOffset);
+    e.write_int(uint64_t(0)); // label offset table
+    e.write_int(postingsOffset);
+    e.write_int(postingsOffsetTableOffset);
+    e.write_int(uint32_t(0)); // CRC
+
+    std::ofstream(dir / "index", std::ios::binary) << ss.str();
+    std::ofstream(dir / "meta.json")
+            << R"({"ulid": ")" << ulid
+            << R"(", "minTime": 0, "maxTime": 100000,)"
+            << R"("stats": {"numSamples": 0, "numSeries": )"
+            << seriesLabels.size() << R"(, "numChunks": 0}, "version": 1})";
+}
+
+class IndexTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        dir = boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path();
+        std::vector<TestLabels> series;
+        for (auto job : {"a", "b", "c"}) {
+            for (int instance = 0; instance < 10; ++instance) {
+                series.push_back({{"__name__", "foo"},
+                                  {"job", job},
+                                  {"instance", std::to_string(instance)}});
+                series.push_back({{"__name__", "bar"},
+                                  {"job", job},
+                                  {"instance", std::to_string(instance)}});
+            }
+        }
+        writeTestIndex(dir, series);
+    }
+
+    void TearDown() override {
+        boost::filesystem::remove_all(dir);
+    }
+
+    boost::filesystem::path dir;
+};
+
+TEST_F(IndexTest, LazySeriesTableMatchesEager) {
+    auto eager = loadIndex((dir / "index").string(), SeriesLoadMode::Eager);
+    auto lazy = loadIndex((dir / "index").string(), SeriesLoadMode::Lazy);
+
+    ASSERT_EQ(60, eager->series.size());
+    EXPECT_EQ(eager->series.getRefs(), lazy->series.getRefs());
+
+    auto lazyItr = lazy->series.begin();
+    for (const auto& [ref, series] : eager->series) {
+        ASSERT_NE(lazyItr, end(lazyItr));
+        EXPECT_EQ(ref, lazyItr->first);
+        EXPECT_EQ(0, compare(series, lazyItr->second));
+        EXPECT_EQ(0, compare(series, *lazy->getSeriesPtr(ref)));
+        EXPECT_EQ(0, compare(series, lazy->getSeries(ref)));
+        ++lazyItr;
+    }
+    EXPECT_EQ(lazyItr, end(lazyItr));
+
+    SeriesFilter filter;
+    filter.addFilter("job", "b");
+    filter.addFilter("__name__", "foo");
+    EXPECT_EQ(10, eager->getFilteredSeriesRefs(filter).size());
+    EXPECT_EQ(eager->getFilteredSeriesRefs(filter),
+              lazy->getFilteredSeriesRefs(filter));
+    EXPECT_EQ(60, lazy->getFilteredSeriesRefs(SeriesFilter()).size());
+
+    EXPECT_THROW(lazy->getSeries(1), std::out_of_range);
+}
+
+TEST_F(IndexTest, ParallelLoadMatchesSerial) {
+    auto dataDir = dir / "data";
+    for (int i = 0; i < 8; ++i) {
+        auto ulid = "01BLOCK" + std::to_string(i);
+        writeTestIndex(dataDir / ulid,
+                       {{{"__name__", "foo"}, {"block", ulid}},
+                        {{"__name__", "bar"}, {"block", ulid}}},
+                       ulid);
+    }
+
+    auto getLabels = [](const PrometheusData& data) {
+        std::vector<TestLabels> labels;
+        for (const auto& series : data) {
+            auto& copy = labels.emplace_back();
+            for (const auto& [k, v] : series.getLabels()) {
+                copy.emplace(k, v);
+            }
+        }
+        return labels;
+    };
+
+    auto serial = getLabels(pdu::load(dataDir));
+    auto parallel = getLabels(pdu::load(dataDir, SeriesLoadMode::Eager, 4));
+    EXPECT_EQ(16, serial.size());
+    EXPECT_EQ(serial, parallel);
+
+    // pre-faulting the index files does not change what is read
+    auto populated = getLabels(pdu::load(
+            dataDir, SeriesLoadMode::Eager, 4, ChunkType::Raw, true));
+    EXPECT_EQ(serial, populated);
+}
+
+TEST_F(IndexTest, SymbolLookup) {
+    auto index = loadIndex((dir / "index").string());
+    const auto& symbols = index->symbols;
+
+    ASSERT_EQ(18, symbols.size());
+    EXPECT_EQ("0", symbols.lookup(0));
+    EXPECT_EQ("9", symbols.lookup(9));
+    EXPECT_EQ("__name__", symbols.lookup(10));
+    EXPECT_EQ("job", symbols.lookup(17));
+    EXPECT_THROW(symbols.lookup(18), std::domain_error);
+}
+
+TEST_F(IndexTest, InternedLabelsCompareAcrossBlocks) {
+    // same labels, but a different set of symbols (and so symbol indexes)
+    writeTestIndex(dir / "other",
+                   {{{"__name__", "foo"}, {"job", "b"}, {"instance", "3"}},
+                    {{"__name__", "foo"}, {"job", "d"}, {"instance", "3"}},
+                    {{"__name__", "baz"}, {"job", "a"}}});
+    auto a = loadIndex((dir / "index").string());
+    auto b = loadIndex((dir / "other" / "index").string());
+
+    using StringLabels = std::vector<std::pair<std::string, std::string>>;
+    auto asStrings = [](const Series& s) {
+        return StringLabels(s.labels.begin(), s.labels.end());
+    };
+    auto sign = [](auto value) { return (value > 0) - (value < 0); };
+
+    for (const auto& [refA, seriesA] : a->series) {
+        for (const auto& [refB, seriesB] : b->series) {
+            // compare via IDs must agree with plain string comparison
+            auto stringsA = asStrings(seriesA);
+            auto stringsB = asStrings(seriesB);
+            int expected = stringsA < stringsB ? -1 : stringsB < stringsA;
+            EXPECT_EQ(expected, sign(compare(seriesA, seriesB)));
+            if (compare(seriesA, seriesB) == 0) {
+                EXPECT_EQ(seriesA.labels.ids(), seriesB.labels.ids());
+            }
+        }
+    }
+
+    auto& dict = SymbolDictionary::instance();
+    auto id = dict.acquire("instance");
+    EXPECT_EQ(id, dict.acquire(std::string("instance")));
+    EXPECT_EQ("instance", dict.lookup(id));
+    dict.release(id);
+    dict.release(id);
+    EXPECT_THROW(dict.lookup(SymbolDictionary::Invalid), std::domain_error);
+
+    // out of order labels are kept in name order
+    Series s;
+    s.addLabel("job", "a");
+    s.addLabel("__name__", "foo");
+    ASSERT_EQ(2, s.labels.size());
+    EXPECT_EQ("__name__", dict.lookup(s.labels.ids()[0].first));
+    EXPECT_EQ("a", dict.lookup(s.labels.ids()[1].second));
+    EXPECT_EQ("foo", s.labels.at("__name__"));
+    EXPECT_EQ(0, s.labels.count("instance"));
+    EXPECT_THROW(s.labels.at("instance"), std::out_of_range);
+
+    // symbols only used by a dropped block are freed
+    auto size = dict.size();
+    b.reset();
+    EXPECT_EQ(size - 2, dict.size()); // "baz" and "d"
+}
+
+TEST_F(IndexTest, SeriesLabelsLookupCost) {
+    // Dictionary IDs are assigned in first-seen order, not label order, so
+    // series which differ still string compare the first differing label,
+    // and find()/at() look up names in the dictionary. Check the cost of
+    // doing so stays comparable to the std::map of views series used to
+    // hold, for series merged across two blocks sharing most labels.
+    auto dataDir = dir / "cost";
+    for (int block = 0; block < 2; ++block) {
+        std::vector<TestLabels> series;
+        for (int i = 0; i < 2000; ++i) {
+            series.push_back({{"__name__", "metric_" + std::to_string(i % 20)},
+                              {"instance", fmt::format("host{:04}", i / 20)},
+                              {"job", "node"},
+                              {"mode", std::to_string(block + i % 3)},
+                              {"region", "eu"}});
+        }
+        writeTestIndex(dataDir / std::to_string(block), series);
+    }
+    auto a = loadIndex((dataDir / "0" / "index").string());
+    auto b = loadIndex((dataDir / "1" / "index").string());
+
+    using LabelMap = std::map<std::string_view, std::string_view>;
+    std::vector<const Series*> seriesA;
+    std::vector<const Series*> seriesB;
+    std::vector<LabelMap> mapsA;
+    std::vector<LabelMap> mapsB;
+    for (const auto& [ref, s] : a->series) {
+        seriesA.push_back(&s);
+        mapsA.emplace_back(s.labels.begin(), s.labels.end());
+    }
+    for (const auto& [ref, s] : b->series) {
+        seriesB.push_back(&s);
+        mapsB.emplace_back(s.labels.begin(), s.labels.end());
+    }
+    ASSERT_EQ(seriesA.size(), seriesB.size());
+
+    auto time = [](auto&& fn) {
+        auto best = std::chrono::nanoseconds::max();
+        for (int rep = 0; rep < 5; ++rep) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            best = std::min(best, std::chrono::steady_clock::now() - start);
+        }
+        return best;
+    };
+
+    int64_t idResult = 0;
+    auto idCompare = time([&] {
+        for (size_t i = 0; i < seriesA.size(); ++i) {
+            auto next = (i + 1) % seriesA.size();
+            idResult += compare(*seriesA[i], *seriesB[i]);
+            idResult += compare(*seriesA[i], *seriesA[next]);
+        }
+    });
+    int64_t mapResult = 0;
+    auto mapCompare = time([&] {
+        for (size_t i = 0; i < mapsA.size(); ++i) {
+            auto cmp = [](const LabelMap& x, const LabelMap& y) {
+                return x < y ? -1 : y < x ? 1 : 0;
+            };
+            auto next = (i + 1) % mapsA.size();
+            mapResult += cmp(mapsA[i], mapsB[i]);
+            mapResult += cmp(mapsA[i], mapsA[next]);
+        }
+    });
+    EXPECT_EQ(mapResult, idResult);
+
+    size_t idFound = 0;
+    auto idFind = time([&] {
+        for (const auto* s : seriesA) {
+            idFound += s->labels.at("job").size();
+            idFound += s->labels.count("absent");
+        }
+    });
+    size_t mapFound = 0;
+    auto mapFind = time([&] {
+        for (const auto& labels : mapsA) {
+            mapFound += labels.at("job").size();
+            mapFound += labels.count("absent");
+        }
+    });
+    EXPECT_EQ(mapFound, idFound);
+
+    RecordProperty("compare_ids_ns", std::to_string(idCompare.count()));
+    RecordProperty("compare_map_ns", std::to_string(mapCompare.count()));
+    RecordProperty("find_ids_ns", std::to_string(idFind.count()));
+    RecordProperty("find_map_ns", std::to_string(mapFind.count()));
+    // generous bounds, timing is noisy
+    EXPECT_LT(idCompare, mapCompare * 3);
+    EXPECT_LT(idFind, mapFind * 3);
+}
+
+TEST_F(IndexTest, SeriesIteratorMergesBlocks) {
+    // block i contains series with values which are multiples of (i + 1), so
+    // each series appears in a different subset of blocks
+    auto dataDir = dir / "data";
+    std::map<std::string, size_t> expected;
+    for (int i = 0; i < 5; ++i) {
+        std::vector<TestLabels> series;
+        for (int v = 0; v < 30; v += i + 1) {
+            auto value = fmt::format("{:02}", v);
+            series.push_back({{"__name__", "foo"}, {"v", value}});
+            ++expected[value];
+        }
+        auto ulid = "01BLOCK" + std::to_string(i);
+        writeTestIndex(dataDir / ulid, series, ulid);
+    }
+
+    std::map<std::string, size_t> actual;
+    std::vector<std::string> order;
+    for (const auto& series : pdu::load(dataDir)) {
+        auto value = std::string(series.getLabels().at("v"));
+        order.push_back(value);
+        actual[value] = series.seriesCollection.size();
+    }
+    EXPECT_EQ(expected, actual);
+    EXPECT_EQ(expected.size(), order.size());
+    EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+}
+
+TEST_F(IndexTest, NegativeAndAbsentMatchers) {
+    std::vector<TestLabels> series;
+    for (int i = 0; i < 100; ++i) {
+        TestLabels labels{{"__name__", i % 2 ? "foo" : "bar"},
+                          {"instance", std::to_string(i)}};
+        // only some series have a job, or env
+        if (i % 3) {
+            labels["job"] = i % 3 == 1 ? "a" : "b";
+        }
+        if (i % 25 == 0) {
+            labels["env"] = "prod";
+        }
+        series.push_back(labels);
+    }
+    writeTestIndex(dir / "matchers", series);
+    auto eager = loadIndex((dir / "matchers" / "index").string());
+    auto lazy = loadIndex((dir / "matchers" / "index").string(),
+                          SeriesLoadMode::Lazy);
+
+    // check the planned result against testing every series' labels
+    auto check = [&](const SeriesFilter& filter, size_t expectedCount) {
+        PostingList expected;
+        for (const auto& [ref, s] : eager->series) {
+            if (filter(s)) {
+                expected.push_back(ref);
+            }
+        }
+        EXPECT_EQ(expectedCount, expected.size());
+        EXPECT_EQ(expected, eager->getFilteredSeriesRefs(filter));
+        EXPECT_EQ(expected, lazy->getFilteredSeriesRefs(filter));
+    };
+
+    using namespace pdu::filter;
+    {
+        // job!="a" includes series without a job
+        SeriesFilter filter;
+        filter.addNegativeFilter("job", "a");
+        check(filter, 67);
+    }
+    {
+        SeriesFilter filter;
+        filter.addAbsentFilter("job");
+        check(filter, 34);
+    }
+    {
+        // a selective matcher with an unselective one, the latter checked
+        // against labels rather than decoding every posting for instance
+        SeriesFilter filter;
+        filter.addFilter("env", "prod");
+        filter.addFilter("instance", regex(".*"));
+        filter.addNegativeFilter("__name__", regex("f.*"));
+        check(filter, 2);
+    }
+    {
+        // several matchers on the same label
+        SeriesFilter filter;
+        filter.addFilter("instance", regex("1.*"));
+        filter.addNegativeFilter("instance", "1");
+        filter.addFilter("__name__", "foo");
+        filter.addAbsentFilter("env");
+        check(filter, 5);
+    }
+    {
+        // a label no series has
+        SeriesFilter filter;
+        filter.addFilter("missing", regex(".*"));
+        check(filter, 0);
+    }
+}
+
+TEST_F(IndexTest, MemoisesMatcherResultsAcrossBlocks) {
+    // two blocks sharing most label values
+    for (int block = 0; block < 2; ++block) {
+        std::vector<TestLabels> series;
+        for (int i = 0; i < 50; ++i) {
+            series.push_back({{"__name__", "foo"},
+                              {"instance", std::to_string(i + block * 10)}});
+        }
+        writeTestIndex(dir / ("memo" + std::to_string(block)), series);
+    }
+    auto a = loadIndex((dir / "memo0" / "index").string());
+    auto b = loadIndex((dir / "memo1" / "index").string(),
+                       SeriesLoadMode::Lazy);
+
+    auto even = [](std::string_view value) {
+        return (value.back() - '0') % 2 == 0;
+    };
+
+    std::map<std::string, int> calls;
+    SeriesFilter filter;
+    filter.addFilter("instance", [&](std::string_view value) {
+        ++calls[std::string(value)];
+        return even(value);
+    });
+
+    std::vector<size_t> batches;
+    SeriesFilter batchFilter;
+    batchFilter.addBatchFilter(
+            "instance",
+            [&](const std::vector<std::string_view>& values,
+                std::vector<bool>& results) {
+                batches.push_back(values.size());
+                for (auto value : values) {
+                    results.push_back(even(value));
+                }
+            });
+
+    SeriesFilter uncached;
+    uncached.addFilter("instance", even);
+
+    // matching values from postings never interns them; the lazy block
+    // has not interned its symbols yet
+    auto symbols = SymbolDictionary::instance().size();
+
+    for (const auto& index : {a, b}) {
+        auto expected = index->getFilteredSeriesRefs(uncached);
+        EXPECT_EQ(25, expected.size());
+        EXPECT_EQ(expected, index->getFilteredSeriesRefs(filter));
+        EXPECT_EQ(expected, index->getFilteredSeriesRefs(batchFilter));
+        // copies of the filter share results
+        EXPECT_EQ(expected, index->getFilteredSeriesRefs(SeriesFilter(filter)));
+    }
+
+    EXPECT_EQ(symbols, SymbolDictionary::instance().size());
+
+    // 60 distinct values, each evaluated once
+    EXPECT_EQ(60, calls.size());
+    for (const auto& [value, count] : calls) {
+        EXPECT_EQ(1, count) << value;
+    }
+    // one batch per block, the second only holding values not yet seen
+    EXPECT_EQ((std::vector<size_t>{50, 10}), batches);
+
+    // checking labels directly also uses the cached results
+    for (const auto& [ref, s] : a->series) {
+        EXPECT_EQ(uncached(s), filter(s));
+    }
+    EXPECT_EQ(60, calls.size());
+}
+
+TEST_F(IndexTest, LabelSummarySkipsBlocks) {
+    namespace fs = boost::filesystem;
+    std::vector<TestLabels> series;
+    for (int i = 0; i < 100; ++i) {
+        series.push_back({{"__name__", "metric_" + std::to_string(i % 10)},
+                          {"instance", std::to_string(i)}});
+    }
+    writeTestIndex(dir / "summary", series);
+    auto indexFile = (dir / "summary" / "index").string();
+    auto index = loadIndex(indexFile);
+
+    // the summary has no false negatives
+    const auto& summary = index->labelSummary;
+    EXPECT_FALSE(summary.empty());
+    EXPECT_TRUE(summary.mayContainLabel("__name__"));
+    EXPECT_TRUE(summary.mayContainLabel("instance"));
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(summary.mayContainValue("__name__",
+                                            "metric_" + std::to_string(i)));
+    }
+    // only __name__ values are summarised, others may always be present
+    EXPECT_TRUE(summary.mayContainValue("instance", "missing"));
+    // and few false positives
+    size_t falsePositives = 0;
+    for (int i = 0; i < 1000; ++i) {
+        falsePositives += summary.mayContainLabel("missing" +
+                                                  std::to_string(i));
+        falsePositives += summary.mayContainValue(
+                "__name__", "missing" + std::to_string(i));
+    }
+    EXPECT_LT(falsePositives, 100);
+
+    {
+        SeriesFilter filter;
+        filter.addFilter("__name__", "metric_3");
+        filter.addNegativeFilter("job", "a");
+        filter.addAbsentFilter("env");
+        EXPECT_TRUE(filter.mayMatch(summary));
+    }
+    {
+        SeriesFilter filter;
+        filter.addFilter("__name__", "other");
+        EXPECT_FALSE(filter.mayMatch(summary));
+    }
+    {
+        SeriesFilter filter;
+        filter.addFilter("job", pdu::filter::regex(".*"));
+        EXPECT_FALSE(filter.mayMatch(summary));
+    }
+
+    // saved summaries are used when next loaded
+    auto sidecar = dir / "summary" / LabelSummary::FileName;
+    EXPECT_FALSE(fs::exists(sidecar));
+    index->saveLabelSummary();
+    ASSERT_TRUE(fs::exists(sidecar));
+    auto indexSize = fs::file_size(indexFile);
+    auto saved = LabelSummary::load(sidecar, indexSize);
+    ASSERT_TRUE(saved);
+    for (int i = 0; i < 1000; ++i) {
+        auto value = "metric_" + std::to_string(i);
+        EXPECT_EQ(summary.mayContainValue("__name__", value),
+                  saved->mayContainValue("__name__", value));
+    }
+    auto reloaded = loadIndex(indexFile);
+    EXPECT_FALSE(reloaded->labelSummary.empty());
+    EXPECT_TRUE(reloaded->labelSummary.mayContainLabel("instance"));
+
+    // but not if saved for a different index, or damaged
+    EXPECT_FALSE(LabelSummary::load(sidecar, indexSize + 1));
+    fs::resize_file(sidecar, fs::file_size(sidecar) - 1);
+    EXPECT_FALSE(LabelSummary::load(sidecar, indexSize));
+}
+
+TEST(RegexMatcherTest, MatchesStdRegex) {
+    using pdu::filter::RegexMatcher;
+    using Kind = RegexMatcher::Kind;
+    std::vector<std::pair<std::string, Kind>> patterns{
+            {"foo", Kind::Literal},
+            {"foo|bar|Baz", Kind::Literal},
+            {"(?:foo|bar)_total", Kind::Literal},
+            {"", Kind::Literal},
+            {"foo.*", Kind::Prefix},
+            {".*_total", Kind::Suffix},
+            {".*oo.*", Kind::Contains},
+            {".*", Kind::Contains},
+            {".*(_bucket|_sum)", Kind::Glob},
+            {"f.*o.*_total|x", Kind::Glob},
+            {"f\\.o", Kind::Literal},
+            {"fo+", Kind::Automaton},
+            {"[a-c]+_[^x]?\\d{2,3}", Kind::Automaton},
+            {"^foo$", Kind::Automaton},
+            {"(ab|a)(bc|c)?", Kind::Automaton},
+            {"\\w+\\s\\W", Kind::Automaton},
+            {"f.o", Kind::Automaton},
+            {"(a)\\1", Kind::StdRegex},
+            {"foo(?=bar)bar", Kind::StdRegex},
+            {"\\bfoo", Kind::StdRegex},
+    };
+    std::vector<std::string> values{
+            "",          "foo",      "FOO",        "fooo",       "bar",
+            "baz",       "bar_total", "foo_total", "foo_bucket", "x_sum",
+            "f.o",       "fxo",      "ab_y12",     "abc_x123",   "abc",
+            "ac",        "foo\nbar", "hi x",      "fo\no",      "aa",
+            "foobar",    "a",        "ABC_Y999",   "f\ro_total",
+    };
+
+    for (bool icase : {false, true}) {
+        for (const auto& [pattern, kind] : patterns) {
+            RegexMatcher matcher(pattern, icase);
+            EXPECT_EQ(kind, matcher.getKind()) << pattern;
+            auto flags = std::regex_constants::ECMAScript;
+            if (icase) {
+                flags |= std::regex_constants::icase;
+            }
+            std::regex expected(pattern, flags);
+            for (const auto& value : values) {
+                EXPECT_EQ(std::regex_match(value, expected), matcher(value))
+                        << "pattern: " << pattern << " value: " << value
+                        << " icase: " << icase;
+            }
+        }
+    }
+
+    // too many states for a DFA, the NFA is simulated instead
+    std::string pattern = "(a|b)*a(a|b){12}";
+    RegexMatcher matcher(pattern);
+    EXPECT_EQ(Kind::Automaton, matcher.getKind());
+    std::regex expected(pattern);
+    std::mt19937 gen(1234);
+    for (int i = 0; i < 100; ++i) {
+        std::string value;
+        for (int j = gen() % 20; j > 0; --j) {
+            value += "ab"[gen() % 2];
+        }
+        EXPECT_EQ(std::regex_match(value, expected), matcher(value)) << value;
+    }
+
+    // invalid expressions are still reported
+    EXPECT_THROW(RegexMatcher("(foo"), std::regex_error);
+}
+
+class PostingListTest : public ::testing::Test {
+public:
+    // make a list of roughly count refs, spread over [0, range)
+    PostingList makeList(size_t count, size_t range) {
+        std::uniform_int_distribution<size_t> dist(0, range - 1);
+        std::set<size_t> refs;
+        for (size_t i = 0; i < count; ++i) {
+            refs.insert(dist(rng));
+        }
+        return PostingList({refs.begin(), refs.end()});
+    }
+
+    std::mt19937 rng{12345};
+};
+
+TEST_F(PostingListTest, Unite) {
+    // sparse and dense unions take different paths, cover both
+    for (auto [count, range] : {std::pair<size_t, size_t>{10, 1000000},
+                                {1000, 2000},
+                                {0, 10}}) {
+        for (size_t numLists : {1, 2, 5, 20}) {
+            std::vector<PostingList> lists;
+            std::set<size_t> expected;
+            for (size_t i = 0; i < numLists; ++i) {
+                auto list = makeList(count, range);
+                expected.insert(list.begin(), list.end());
+                lists.push_back(std::move(list));
+            }
+            auto result = unite(lists);
+            EXPECT_EQ(std::vector<size_t>(expected.begin(), expected.end()),
+                      result.values())
+                    << "count:" << count << " range:" << range
+                    << " lists:" << numLists;
+        }
+    }
+}
+
+TEST_F(PostingListTest, Intersect) {
+    // similar and very different sizes take different paths, cover both
+    for (auto [smallCount, largeCount] : {std::pair<size_t, size_t>{500, 500},
+                                          {10, 5000},
+                                          {0, 100}}) {
+        auto small = makeList(smallCount, 10000);
+        auto large = makeList(largeCount, 10000);
+        std::vector<size_t> expected;
+        std::set_intersection(small.begin(),
+                              small.end(),
+                              large.begin(),
+                              large.end(),
+                              std::back_inserter(expected));
+
+        EXPECT_EQ(expected, intersect(small, large).values());
+        EXPECT_EQ(expected, intersect(large, small).values());
+        EXPECT_EQ(expected, intersect({large, small, large}).values());
+    }
+    EXPECT_TRUE(intersect(std::vector<PostingList>{}).empty());
+}
+
+TEST_F(PostingListTest, Decode) {
+    std::stringstream ss;
+    Encoder e(ss);
+    e.write_int(uint32_t(4 + 3 * 4)); // len
+    e.write_int(uint32_t(3)); // entries
+    for (uint32_t ref : {1u, 0x100u, 0xFFFFFFFFu}) {
+        e.write_int(ref);
+    }
+    auto data = ss.str();
+
+    auto list = PostingList::decode(Decoder(data));
+    EXPECT_EQ((std::vector<size_t>{1, 0x100, 0xFFFFFFFF}), list.values());
+}
+
+TEST_F(IndexTest, PostingOffsetsForLabel) {
+    // enough label values to span several sampled entries of the postings
+    // offset table
+    std::vector<TestLabels> series;
+    for (int i = 0; i < 100; ++i) {
+        series.push_back({{"__name__", "foo"},
+                          {"a", std::to_string(i)},
+                          {"m", std::to_string(i % 7)},
+                          {"z", std::to_string(i % 40)}});
+    }
+    writeTestIndex(dir / "many", series);
+    auto index = loadIndex((dir / "many" / "index").string());
+
+    std::map<std::string_view, std::vector<std::string_view>> expected;
+    for (const auto& po : index->postings) {
+        expected[po.labelKey].push_back(po.labelValue);
+    }
+    ASSERT_EQ(4, expected.size());
+
+    for (const auto& [key, values] : expected) {
+        std::vector<std::string_view> actual;
+        for (const auto& po : index->postings.forLabel(key)) {
+            EXPECT_EQ(key, po.labelKey);
+            actual.push_back(po.labelValue);
+        }
+        EXPECT_EQ(values, actual) << key;
+    }
+
+    for (auto missing : {"", "0", "b", "zz"}) {
+        auto itr = index->postings.forLabel(missing);
+        EXPECT_EQ(itr, end(itr)) << missing;
+    }
+}
+
+/**
+ * Append a chunk of the given samples for a series to a head chunk file.
+ */
+void appendHeadChunk(std::string& file,
+                     uint64_t ref,
+                     const std::vector<Sample>& samples) {
+    std::stringstream chunk;
+    {
+        ChunkWriter writer(chunk);
+        for (const auto& sample : samples) {
+            writer.append(sample);
+        }
+    }
+    std::stringstream ss;
+    Encoder e(ss);
+    if (file.empty()) {
+        e.write_int(HeadChunkFileMagic);
+        e.write_int(uint8_t(1)); // version
+        e.write(std::string_view("\0\0\0", 3)); // padding
+    }
+    e.write_int(ref);
+    e.write_int(uint64_t(samples.front().timestamp));
+    e.write_int(uint64_t(samples.back().timestamp));
+    e.write_int(uint8_t(1)); // XOR encoding
+    e.write_varuint(chunk.str().size());
+    e.write(chunk.str());
+    e.write_int(uint32_t(0)); // crc, not checked
+    file += ss.str();
+}
+
+TEST(PrometheusDataTest, RefreshReadsNewData) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+    fs::create_directories(dir / "chunks_head");
+
+    auto samplesBetween = [](int64_t from, int64_t to) {
+        std::vector<Sample> samples;
+        for (auto ts = from; ts <= to; ts += 10) {
+            samples.push_back({ts, ts * 0.5});
+        }
+        return samples;
+    };
+    auto addSamples = [&](TestWalSegment& segment,
+                          uint64_t ref,
+                          int64_t from,
+                          int64_t to) {
+        for (const auto& s : samplesBetween(from, to)) {
+            segment.addSamples({{ref, s.timestamp, s.value}});
+        }
+    };
+    auto addSeries = [](TestWalSegment& segment, uint64_t ref) {
+        segment.addSeries(ref,
+                          {{"__name__", "foo"}, {"ref", std::to_string(ref)}});
+    };
+    auto write = [](const fs::path& path, const std::string& data) {
+        std::ofstream(path.string(), std::ios::binary) << data;
+    };
+    auto refs = [](const PrometheusData& data) {
+        std::set<std::string> result;
+        for (const auto& series : data) {
+            result.emplace(series.getLabels().at("ref"));
+        }
+        return result;
+    };
+    auto collect = [](const PrometheusData& data) {
+        std::map<std::string, std::vector<Sample>> result;
+        for (const auto& series : data) {
+            auto& samples = result[std::string(series.getLabels().at("ref"))];
+            series.getSamples().readAll(samples);
+        }
+        return result;
+    };
+
+    std::string headChunkFile;
+    appendHeadChunk(headChunkFile, 1, samplesBetween(0, 90));
+    std::vector<TestWalSegment> segments(2);
+    addSeries(segments[0], 1);
+    addSeries(segments[0], 2);
+    addSamples(segments[0], 1, 0, 150);
+    addSamples(segments[0], 2, 0, 150);
+    write(dir / "chunks_head" / "000001", headChunkFile);
+    write(dir / "wal" / "00000000", segments[0].data);
+
+    auto data = pdu::load(dir);
+    std::map<std::string, std::vector<Sample>> expected{
+            {"1", samplesBetween(0, 150)}, {"2", samplesBetween(0, 150)}};
+    EXPECT_EQ(expected, collect(data));
+
+    // series, samples part way read, and copies of the data held across
+    // a refresh keep seeing the data as it was
+    auto copy = data;
+    auto held = *data.begin();
+    auto heldSamples = held.getSamples();
+    ++heldSamples;
+
+    // Prometheus continues writing; a head chunk is cut for series 1, which
+    // covers samples already read from the WAL.
+    appendHeadChunk(headChunkFile, 1, samplesBetween(100, 150));
+    addSamples(segments[0], 1, 160, 200);
+    addSamples(segments[0], 2, 160, 200);
+    addSeries(segments[1], 3);
+    addSamples(segments[1], 3, 0, 50);
+    // a record only partly written so far
+    segments[1].writeFragment(RecordStart, "abc");
+    write(dir / "chunks_head" / "000001", headChunkFile);
+    write(dir / "wal" / "00000000", segments[0].data);
+    write(dir / "wal" / "00000001", segments[1].data);
+
+    data.refresh();
+    expected = {{"1", samplesBetween(0, 200)},
+                {"2", samplesBetween(0, 200)},
+                {"3", samplesBetween(0, 50)}};
+    EXPECT_EQ(expected, collect(data));
+    EXPECT_EQ(collect(pdu::load(dir)), collect(data));
+
+    auto before = samplesBetween(0, 150);
+    EXPECT_EQ("1", held.getLabels().at("ref"));
+    std::vector<Sample> samples;
+    heldSamples.readAll(samples);
+    EXPECT_EQ(std::vector<Sample>(before.begin() + 1, before.end()), samples);
+    samples.clear();
+    held.getSamples().readAll(samples);
+    EXPECT_EQ(before, samples);
+    EXPECT_EQ(2, refs(copy).size());
+    EXPECT_EQ((std::map<std::string, std::vector<Sample>>{{"1", before},
+                                                          {"2", before}}),
+              collect(copy));
+
+    // blocks appear, and are deleted
+    writeTestIndex(dir / "01BLOCK",
+                   {{{"__name__", "bar"}, {"ref", "block"}}},
+                   "01BLOCK");
+    data.refresh();
+    EXPECT_EQ(1, refs(data).count("block"));
+    fs::remove_all(dir / "01BLOCK");
+    data.refresh();
+    EXPECT_EQ(0, refs(data).count("block"));
+    EXPECT_EQ(expected, collect(data));
+
+    // the WAL is truncated, and replaced by a checkpoint. The head needs
+    // loading again, as the old samples would now be in a block.
+    TestWalSegment checkpoint;
+    addSeries(checkpoint, 1);
+    addSeries(checkpoint, 2);
+    addSamples(checkpoint, 2, 100, 200);
+    fs::create_directories(dir / "wal" / "checkpoint.00000001");
+    write(dir / "wal" / "checkpoint.00000001" / "00000000", checkpoint.data);
+    fs::remove(dir / "wal" / "00000000");
+
+    data.refresh();
+    expected["2"] = samplesBetween(100, 200);
+    expected["3"] = samplesBetween(0, 50);
+    EXPECT_EQ(expected["2"], collect(data)["2"]);
+    EXPECT_EQ(collect(pdu::load(dir)), collect(data));
+
+    fs::remove_all(dir);
+}
+
+TEST_F(HeadChunkTest, RefreshSharesUnchangedSeries) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+    fs::create_directories(dir / "chunks_head");
+    auto writeWal = [&](const TestWalSegment& segment) {
+        std::ofstream((dir / "wal" / "00000000").string(), std::ios::binary)
+                << segment.data;
+    };
+
+    TestWalSegment segment;
+    for (uint64_t ref : {1, 2, 3}) {
+        segment.addSeries(ref, {{"ref", std::to_string(ref)}});
+    }
+    for (int64_t ts = 0; ts < 100; ts += 10) {
+        segment.addSamples({{1, ts, 1.0}, {2, ts, 2.0}, {3, ts, 3.0}});
+    }
+    writeWal(segment);
+    auto head = std::make_shared<HeadChunks>(dir);
+
+    // only series 2 gains samples
+    segment.addSamples({{2, 100, 2.0}});
+    writeWal(segment);
+    auto refreshed = head->refreshed();
+    ASSERT_TRUE(refreshed);
+
+    const auto& walChunks = FakeHeadChunks::getWalChunks(*head);
+    const auto& refreshedWalChunks = FakeHeadChunks::getWalChunks(*refreshed);
+    for (uint64_t ref : {1, 3}) {
+        EXPECT_EQ(&head->getSeries(ref), &refreshed->getSeries(ref));
+        EXPECT_EQ(walChunks.find(ref)->second,
+                  refreshedWalChunks.find(ref)->second);
+    }
+    EXPECT_NE(&head->getSeries(2), &refreshed->getSeries(2));
+    EXPECT_NE(walChunks.find(2)->second, refreshedWalChunks.find(2)->second);
+
+    // each snapshot reads the samples it loaded, through its own cache
+    auto countSamples = [](const HeadChunks& head, uint64_t ref) {
+        size_t count = 0;
+        for (const auto& chunk : head.getSeries(ref).chunks) {
+            auto resource = head.getCache().get(chunk.getSegmentFileId());
+            count += resource->getView().size() / 16;
+        }
+        return count;
+    };
+    for (uint64_t ref : {1, 3}) {
+        EXPECT_EQ(10, countSamples(*head, ref));
+        EXPECT_EQ(10, countSamples(*refreshed, ref));
+    }
+    EXPECT_EQ(10, countSamples(*head, 2));
+    EXPECT_EQ(11, countSamples(*refreshed, 2));
+
+    fs::remove_all(dir);
+}
+
+TEST(BlockRegistryTest, SharesLoadedBlocks) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    auto& registry = BlockRegistry::instance();
+    auto initialSize = registry.size();
+
+    writeTestIndex(dir / "01BLOCKA",
+                   {{{"__name__", "foo"}, {"block", "a"}}},
+                   "01BLOCKA");
+    auto indexFile = dir / "01BLOCKA" / "index";
+
+    auto a = registry.load(indexFile);
+    auto b = registry.load(indexFile);
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(initialSize + 1, registry.size());
+
+    // a different load mode is a different index
+    auto lazy = registry.load(indexFile, SeriesLoadMode::Lazy);
+    EXPECT_NE(a, lazy);
+    lazy.reset();
+    EXPECT_EQ(initialSize + 1, registry.size());
+
+    // the entry is released once the last user drops it
+    a.reset();
+    EXPECT_EQ(initialSize + 1, registry.size());
+    b.reset();
+    EXPECT_EQ(initialSize, registry.size());
+
+    {
+        // loading the data directory twice shares the block
+        auto first = pdu::load(dir);
+        auto second = pdu::load(dir);
+        EXPECT_EQ(initialSize + 1, registry.size());
+    }
+    EXPECT_EQ(initialSize, registry.size());
+
+    // a series handed out by the index keeps the registered index alive,
+    // so a reload gets the same one
+    for (auto mode : {SeriesLoadMode::Eager, SeriesLoadMode::Lazy}) {
+        a = registry.load(indexFile, mode);
+        const Index* held = a.get();
+        auto series = a->getSeriesPtr(a->series.getRefs().front());
+        a.reset();
+        EXPECT_EQ(initialSize + 1, registry.size());
+        a = registry.load(indexFile, mode);
+        EXPECT_EQ(held, a.get());
+        EXPECT_EQ("foo", series->labels.at("__name__"));
+        a.reset();
+        series.reset();
+        EXPECT_EQ(initialSize, registry.size());
+    }
+
+    // a block rewritten on disk is loaded again
+    a = registry.load(indexFile);
+    writeTestIndex(dir / "01BLOCKA",
+                   {{{"__name__", "foo"}, {"block", "a"}},
+                    {{"__name__", "bar"}, {"block", "a"}}},
+                   "01BLOCKA");
+    b = registry.load(indexFile);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(2, b->series.size());
+
+    a.reset();
+    b.reset();
+    fs::remove_all(dir);
+}
+
+TEST(PrometheusDataTest, ParallelTraversalMatchesSerial) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+    fs::create_directories(dir / "chunks_head");
+
+    // enough series for many shards, with varying numbers of samples
+    TestWalSegment segment;
+    for (uint64_t ref = 1; ref <= 1000; ++ref) {
+        segment.addSeries(ref,
+                          {{"__name__", ref % 2 ? "odd" : "even"},
+                           {"ref", std::to_string(ref)}});
+    }
+    for (uint64_t ref = 1; ref <= 1000; ++ref) {
+        std::vector<WalSample> samples;
+        for (int64_t ts = 0; ts < int64_t(ref % 17); ++ts) {
+            samples.push_back({ref, ts * 1000, double(ref)});
+        }
+        if (!samples.empty()) {
+            segment.addSamples(samples);
+        }
+    }
+    std::ofstream((dir / "wal" / "00000000").string(), std::ios::binary)
+            << segment.data;
+
+    auto data = pdu::load(dir);
+
+    using Summary = std::pair<std::string, size_t>;
+    auto summarise = [](const CrossIndexSeries& series) {
+        std::vector<Sample> samples;
+        series.getSamples().readAll(samples);
+        return Summary{std::string(series.getLabels().at("ref")),
+                       samples.size()};
+    };
+
+    SeriesFilter filter;
+    filter.addFilter("__name__", "odd");
+    std::vector<Summary> expected;
+    for (const auto& series : data.filtered(filter)) {
+        expected.push_back(summarise(series));
+    }
+    ASSERT_EQ(500, expected.size());
+
+    // results are recombined in label order, regardless of thread count
+    for (size_t threads : {1, 4}) {
+        EXPECT_EQ(expected, data.parallelTransform(filter, summarise, threads));
+    }
+
+    std::atomic<size_t> seriesCount = 0;
+    std::atomic<size_t> sampleCount = 0;
+    data.parallelForEach(
+            {},
+            [&](const CrossIndexSeries& series) {
+                ++seriesCount;
+                sampleCount += summarise(series).second;
+            },
+            4);
+    EXPECT_EQ(1000, seriesCount);
+    size_t expectedSamples = 0;
+    for (uint64_t ref = 1; ref <= 1000; ++ref) {
+        expectedSamples += ref % 17;
+    }
+    EXPECT_EQ(expectedSamples, sampleCount);
+
+    // shards are contiguous and numbered in order
+    std::mutex mutex;
+    std::map<size_t, std::vector<std::string>> shards;
+    data.forEachShard(
+            filter,
+            [&](size_t shard, const std::vector<CrossIndexSeries>& series) {
+                std::lock_guard lock(mutex);
+                for (const auto& s : series) {
+                    shards[shard].emplace_back(s.getLabels().at("ref"));
+                }
+            },
+            4,
+            64);
+    ASSERT_EQ(8, shards.size());
+    std::vector<std::string> ordered;
+    for (const auto& [shard, refs] : shards) {
+        ordered.insert(ordered.end(), refs.begin(), refs.end());
+    }
+    ASSERT_EQ(expected.size(), ordered.size());
+    for (size_t i = 0; i < ordered.size(); ++i) {
+        EXPECT_EQ(expected[i].first, ordered[i]);
+    }
+
+    // exceptions are propagated to the caller
+    EXPECT_THROW(data.parallelForEach(
+                         {},
+                         [](const CrossIndexSeries&) {
+                             throw std::runtime_error("oops");
+                         },
+                         4),
+                 std::runtime_error);
+
+    fs::remove_all(dir);
+}
+
+TEST(PrometheusDataTest, PrefetchingMatchesSerial) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+    fs::create_directories(dir / "chunks_head");
+
+    TestWalSegment segment;
+    for (uint64_t ref = 1; ref <= 200; ++ref) {
+        segment.addSeries(ref,
+                          {{"__name__", "foo"}, {"ref", std::to_string(ref)}});
+        std::vector<WalSample> samples;
+        for (int64_t ts = 0; ts <= int64_t(ref % 13); ++ts) {
+            samples.push_back({ref, ts * 1000, double(ts)});
+        }
+        segment.addSamples(samples);
+    }
+    std::ofstream((dir / "wal" / "00000000").string(), std::ios::binary)
+            << segment.data;
+
+    auto data = pdu::load(dir);
+
+    using Summary = std::pair<std::string, std::vector<Sample>>;
+    std::vector<Summary> expected;
+    for (const auto& series : data) {
+        auto& [ref, samples] = expected.emplace_back();
+        ref = series.getLabels().at("ref");
+        series.getSamples().readAll(samples);
+    }
+    ASSERT_EQ(200, expected.size());
+
+    for (size_t threads : {1, 3}) {
+        PrefetchingSeriesIterator itr(data.begin(), {4, threads});
+        std::vector<Summary> actual;
+        for (const auto& [series, samples] : itr) {
+            actual.emplace_back(series.getLabels().at("ref"), samples);
+        }
+        EXPECT_EQ(expected, actual);
+        EXPECT_EQ(200, itr.getStats().series);
+    }
+
+    // abandoning iteration part way stops the background work
+    {
+        PrefetchingSeriesIterator itr(data.begin(), {4, 2});
+        ++itr;
+        EXPECT_EQ(expected[1].first, itr->series.getLabels().at("ref"));
+    }
+
+    fs::remove_all(dir);
+}
+
+TEST(PrometheusDataTest, PrefetchingReusesBuffers) {
+    namespace fs = boost::filesystem;
+    auto dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir / "wal");
+    fs::create_directories(dir / "chunks_head");
+
+    // every series has the same number of samples, so once a buffer has
+    // been used it is never reallocated
+    TestWalSegment segment;
+    for (uint64_t ref = 1; ref <= 100; ++ref) {
+        segment.addSeries(ref,
+                          {{"__name__", "foo"}, {"ref", std::to_string(ref)}});
+        std::vector<WalSample> samples;
+        for (int64_t ts = 0; ts < 10; ++ts) {
+            samples.push_back({ref, ts * 1000, double(ts + ref)});
+        }
+        segment.addSamples(samples);
+    }
+    std::ofstream((dir / "wal" / "00000000").string(), std::ios::binary)
+            << segment.data;
+
+    auto data = pdu::load(dir);
+
+    struct SampleRecorder : public OrderedSeriesVisitor {
+        using OrderedSeriesVisitor::visit;
+        void visit(const Series& series) override {
+            visited.emplace_back(std::string(series.labels.at("ref")),
+                                 std::vector<Sample>{});
+        }
+        void visit(const SampleInfo& sample) override {
+            visited.back().second.push_back(sample);
+        }
+        std::vector<std::pair<std::string, std::vector<Sample>>> visited;
+    };
+
+    SampleRecorder serial;
+    serial.visit(data);
+    ASSERT_EQ(100, serial.visited.size());
+
+    for (size_t threads : {1, 3}) {
+        const size_t depth = 4;
+        std::set<const Sample*> buffers;
+        std::vector<std::pair<std::string, std::vector<Sample>>> actual;
+        PrefetchingSeriesIterator itr(data.begin(), {depth, threads});
+        for (const auto& [series, samples] : itr) {
+            buffers.insert(samples.data());
+            actual.emplace_back(series.getLabels().at("ref"), samples);
+        }
+        EXPECT_EQ(serial.visited, actual);
+        // one buffer per queued series, plus the current one
+        EXPECT_LE(buffers.size(), depth + 1);
+
+        // visiting with prefetch gives the same output as without
+        SampleRecorder prefetched;
+        prefetched.setPrefetch({depth, threads});
+        prefetched.visit(data);
+        EXPECT_EQ(serial.visited, prefetched.visited);
+        auto stats = prefetched.getPrefetchStats();
+        EXPECT_EQ(100, stats.series);
+        EXPECT_LE(stats.stalls, stats.series);
+    }
+
+    fs::remove_all(dir);
 }